@@ -0,0 +1,272 @@
+#include "Analyze.h"
+#include "TCO.h"
+#include "Options.h"
+#include "Scheduler.h"
+
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string_view>
+
+#include "lz4.h"
+#include "lz4hc.h"
+
+struct CodecResult {
+	uint64 size = 0;
+	double decodeSeconds = 0.0;
+	// Compression failed, the entry is left out of this codec's totals
+	bool failed = false;
+};
+
+struct AnalyzeEntry {
+	std::string name;
+	TCOHeader header = {};
+	uint64 rawSize = 0;
+	CodecResult lz4;
+	std::vector<CodecResult> vecHC;
+	CodecResult raw;
+	bool valid = false;
+};
+
+// Best time out of several runs, so that one preempted run does not skew the result
+template<typename F>
+static double MeasureBest(F&& fn) {
+	constexpr int minRuns = 3;
+	constexpr int maxRuns = 50;
+	constexpr double minTotalSeconds = 0.002;
+
+	double best = 1e30;
+	double total = 0.0;
+	for ( int run = 0; run < maxRuns && (run < minRuns || total < minTotalSeconds); ++run ) {
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::min(best, elapsed.count());
+		total += elapsed.count();
+	}
+	return best;
+}
+
+static double ToMBps(uint64 bytes, double seconds) {
+	return seconds > 0.0 ? (bytes / seconds) / (1024.0 * 1024.0) : 0.0;
+}
+
+static void AnalyzeOneFile(const std::filesystem::path& path, AnalyzeEntry& entry) {
+	entry.name = path.filename().string();
+
+	std::string data = ReadFile(path);
+	if ( data.empty() )
+		return;
+
+	CompressedDataHeader compHeader;
+	std::string err = ParseTCOHeaders(data.data(), data.size(), compHeader, entry.header);
+	if ( !err.empty() )
+		return LogError(entry.name, err);
+
+	if ( TCOPayloadOffset + compHeader.compressedSize > data.size() )
+		return LogError(entry.name, "Compressed size exceeds the file size");
+
+	// LZ4 cannot expand a block by more than 255 times, a larger size is a corrupt header and must not reach the allocations
+	uint64 maxRawSize = std::min<uint64>(uint64(compHeader.compressedSize) * 255 + 16, LZ4_MAX_INPUT_SIZE);
+	if ( compHeader.decompressedSize == 0 || compHeader.decompressedSize > maxRawSize )
+		return LogError(entry.name, std::format("Decompressed size {} is not possible for {} compressed bytes", compHeader.decompressedSize, compHeader.compressedSize));
+
+	const char* pPayload = data.data() + TCOPayloadOffset;
+	int compSize = int(compHeader.compressedSize);
+	int rawSize = int(compHeader.decompressedSize);
+
+	std::unique_ptr<char[]> pRaw(new char[rawSize]);
+	std::unique_ptr<char[]> pScratch(new char[rawSize]);
+	if ( LZ4_decompress_safe(pPayload, pRaw.get(), compSize, rawSize) != rawSize )
+		return LogError(entry.name, "Failed to decompress file data");
+
+	entry.rawSize = uint64(rawSize);
+	entry.lz4.size = uint64(compSize);
+	entry.lz4.decodeSeconds = MeasureBest([&]() {
+		LZ4_decompress_safe(pPayload, pScratch.get(), compSize, rawSize);
+	});
+
+	int bound = LZ4_compressBound(rawSize);
+	std::unique_ptr<char[]> pHC(new char[bound]);
+	for ( int level : gOptions.vecHCLevels ) {
+		CodecResult& hc = entry.vecHC.emplace_back();
+		int hcSize = LZ4_compress_HC(pRaw.get(), pHC.get(), rawSize, bound, level);
+		if ( hcSize <= 0 ) {
+			LogError(entry.name, std::format("LZ4HC level {} failed to compress", level));
+			hc.failed = true;
+			continue;
+		}
+		hc.size = uint64(hcSize);
+		hc.decodeSeconds = MeasureBest([&]() {
+			LZ4_decompress_safe(pHC.get(), pScratch.get(), hcSize, rawSize);
+		});
+	}
+
+	// Uncompressed payloads still need one copy out of the read buffer
+	entry.raw.size = entry.rawSize;
+	entry.raw.decodeSeconds = MeasureBest([&]() {
+		memcpy(pScratch.get(), pRaw.get(), rawSize);
+	});
+
+	entry.valid = true;
+}
+
+struct AnalyzeGroup {
+	uint64 count = 0;
+	uint64 rawSize = 0;
+	CodecResult lz4;
+	std::vector<CodecResult> vecHC;
+	// Raw bytes of the entries each HC level compressed, the ratio is taken over these
+	std::vector<uint64> vecHCRawSize;
+	CodecResult raw;
+
+	void Add(const AnalyzeEntry& entry) {
+		vecHC.resize(entry.vecHC.size());
+		vecHCRawSize.resize(entry.vecHC.size());
+		++count;
+		rawSize += entry.rawSize;
+		lz4.size += entry.lz4.size;
+		lz4.decodeSeconds += entry.lz4.decodeSeconds;
+		for ( uint64 i = 0; i < vecHC.size(); ++i ) {
+			if ( entry.vecHC[i].failed )
+				continue;
+			vecHCRawSize[i] += entry.rawSize;
+			vecHC[i].size += entry.vecHC[i].size;
+			vecHC[i].decodeSeconds += entry.vecHC[i].decodeSeconds;
+		}
+		raw.size += entry.raw.size;
+		raw.decodeSeconds += entry.raw.decodeSeconds;
+	}
+};
+
+// Quoted if it holds a separator, quote or line break, with quotes doubled (RFC 4180)
+static std::string CsvField(std::string_view str) {
+	if ( str.find_first_of(",\"\r\n") == std::string_view::npos )
+		return std::string(str);
+
+	std::string field = "\"";
+	for ( char c : str ) {
+		if ( c == '"' )
+			field += '"';
+		field += c;
+	}
+	return field + '"';
+}
+
+// Quoted JSON string, with quotes, backslashes and control characters escaped
+static std::string JsonString(std::string_view str) {
+	std::string s = "\"";
+	for ( char c : str ) {
+		if ( c == '"' || c == '\\' )
+			s += '\\';
+		if ( uint8(c) < 0x20 )
+			s += std::format("\\u{:04x}", uint32(c));
+		else
+			s += c;
+	}
+	return s + '"';
+}
+
+static std::string CodecJson(const CodecResult& res, uint64 rawSize) {
+	return std::format(
+		"\"bytes\": {}, \"ratio\": {:.4f}, \"decodeMBps\": {:.1f}",
+		res.size, rawSize ? double(res.size) / rawSize : 0.0, ToMBps(rawSize, res.decodeSeconds)
+	);
+}
+
+static std::string GroupJson(const AnalyzeGroup& group, const std::string& indent) {
+	std::string s = std::format("{}\"count\": {},\n{}\"rawBytes\": {},\n", indent, group.count, indent, group.rawSize);
+	s += std::format("{}\"lz4\": {{ {} }},\n", indent, CodecJson(group.lz4, group.rawSize));
+	s += std::format("{}\"lz4hc\": [\n", indent);
+	for ( uint64 i = 0; i < group.vecHC.size(); ++i ) {
+		s += std::format(
+			"{}\t{{ \"level\": {}, {} }}{}\n",
+			indent, gOptions.vecHCLevels[i], CodecJson(group.vecHC[i], group.vecHCRawSize[i]), i + 1 < group.vecHC.size() ? "," : ""
+		);
+	}
+	s += std::format("{}],\n", indent);
+	s += std::format("{}\"raw\": {{ {} }}\n", indent, CodecJson(group.raw, group.rawSize));
+	return s;
+}
+
+static bool WriteCsv(const std::string& path, const std::vector<AnalyzeEntry>& vecEntries) {
+	std::ofstream file(path);
+	if ( !file )
+		return false;
+
+	file << "file,layout,width,height,mips,raw_bytes,lz4_bytes,lz4_ratio,lz4_decode_mbps";
+	for ( int level : gOptions.vecHCLevels )
+		file << std::format(",hc{0}_bytes,hc{0}_ratio,hc{0}_decode_mbps", level);
+	file << ",raw_copy_mbps\n";
+
+	for ( const AnalyzeEntry& entry : vecEntries ) {
+		if ( !entry.valid )
+			continue;
+
+		file << std::format(
+			"{},{},{},{},{},{},{},{:.4f},{:.1f}",
+			CsvField(entry.name), CsvField(ToString(entry.header.layout)), entry.header.width, entry.header.height, entry.header.numMips,
+			entry.rawSize, entry.lz4.size, double(entry.lz4.size) / entry.rawSize, ToMBps(entry.rawSize, entry.lz4.decodeSeconds)
+		);
+		for ( const CodecResult& hc : entry.vecHC ) {
+			if ( hc.failed )
+				file << ",,,";
+			else
+				file << std::format(",{},{:.4f},{:.1f}", hc.size, double(hc.size) / entry.rawSize, ToMBps(entry.rawSize, hc.decodeSeconds));
+		}
+		file << std::format(",{:.1f}\n", ToMBps(entry.rawSize, entry.raw.decodeSeconds));
+	}
+	return bool(file);
+}
+
+static bool WriteJson(const std::string& path, const std::vector<AnalyzeEntry>& vecEntries) {
+	std::map<std::pair<int, uint32>, AnalyzeGroup> mapGroups;
+	AnalyzeGroup total;
+	for ( const AnalyzeEntry& entry : vecEntries ) {
+		if ( !entry.valid )
+			continue;
+		mapGroups[{int(entry.header.layout), GetSizeClass(entry.rawSize)}].Add(entry);
+		total.Add(entry);
+	}
+
+	std::ofstream file(path);
+	if ( !file )
+		return false;
+
+	file << "{\n\t\"groups\": [\n";
+	uint64 i = 0;
+	for ( const auto& [key, group] : mapGroups ) {
+		file << std::format(
+			"\t\t{{\n\t\t\t\"layout\": {},\n\t\t\t\"sizeClass\": {},\n{}\t\t}}{}\n",
+			JsonString(ToString(TCOLayout(key.first))), JsonString(GetSizeClassName(key.second)), GroupJson(group, "\t\t\t"),
+			++i < mapGroups.size() ? "," : ""
+		);
+	}
+	file << "\t],\n\t\"total\": {\n" << GroupJson(total, "\t\t") << "\t}\n}\n";
+	return bool(file);
+}
+
+int RunAnalyze(const std::filesystem::path& dir) {
+	std::vector<std::filesystem::path> vecFiles = CollectTCOFiles(dir);
+	Print(std::format("Analyzing {} TCO files on {} threads", vecFiles.size(), GetNumThreads()));
+
+	// Decode timings run concurrently and share memory bandwidth, so they are comparable
+	// between codecs but lower than what a single file would achieve on an idle machine.
+	std::vector<AnalyzeEntry> vecEntries(vecFiles.size());
+	ParallelFor(vecFiles.size(), [&](uint64 i) {
+		AnalyzeOneFile(vecFiles[i], vecEntries[i]);
+	});
+
+	std::string reportPath = gOptions.reportPath.empty() ? "./analyze_report" : gOptions.reportPath;
+	std::string csvPath = reportPath + ".csv";
+	std::string jsonPath = reportPath + ".json";
+	if ( !WriteCsv(csvPath, vecEntries) || !WriteJson(jsonPath, vecEntries) ) {
+		Print(std::format("Failed to write report to '{}'", reportPath));
+		return 1;
+	}
+
+	Print(std::format("Wrote '{}' and '{}'", csvPath, jsonPath));
+	return 0;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "Common.h"
+
+// Trials the LZ4 payload of every TCO file in `dir` against LZ4HC (levels from --hc-levels) and raw storage.
+// Writes a per-entry CSV and a JSON summary aggregated per layout and size class to --report.
+int RunAnalyze(const std::filesystem::path& dir);
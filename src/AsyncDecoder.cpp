@@ -0,0 +1,260 @@
+#include "AsyncDecoder.h"
+#include "Storage.h"
+
+#include <algorithm>
+
+// Decoder whose worker the current thread is, so Submit() can tell it was called from a callback
+static thread_local const AsyncDecoder* tl_pWorkerOf = nullptr;
+
+AsyncDecoder::AsyncDecoder(uint32 numThreads, uint64 maxInFlightBytes) : m_maxInFlightBytes(maxInFlightBytes) {
+	for ( uint32 i = 0; i < std::max(numThreads, 1u); ++i )
+		m_vecThreads.emplace_back(&AsyncDecoder::Worker, this);
+}
+
+AsyncDecoder::~AsyncDecoder() {
+	std::deque<std::shared_ptr<JobState>> dequeQueued;
+	{
+		std::scoped_lock l(m_mutex);
+		m_stopping = true;
+		dequeQueued.swap(m_dequeQueued);
+	}
+	m_cvWork.notify_all();
+
+	for ( std::shared_ptr<JobState>& pState : dequeQueued ) {
+		DecodeResult result;
+		result.id = pState->id;
+		result.cancelled = true;
+		result.error = "Cancelled";
+		Complete(pState, result);
+	}
+
+	for ( std::thread& th : m_vecThreads )
+		th.join();
+}
+
+// Worst case of what a job holds at once: the file, the decompressed payload and the 8-bit pixels
+uint64 AsyncDecoder::EstimateCost(const DecodeJob& job) {
+	CompressedDataHeader compHeader;
+	TCOHeader tcoHeader;
+	uint64 fileSize = job.data.size();
+	if ( !job.data.empty() ) {
+		if ( !ParseTCOHeaders(job.data.data(), job.data.size(), compHeader, tcoHeader).empty() )
+			return fileSize;
+	} else {
+		TCOFileInfo info;
+		if ( !PrescanFile(job.path, info).empty() )
+			return 0;
+		fileSize = info.fileSize;
+		compHeader = info.compHeader;
+		tcoHeader = info.tcoHeader;
+	}
+	return fileSize + compHeader.decompressedSize + uint64(tcoHeader.width) * tcoHeader.height * 4;
+}
+
+DecodeTicket AsyncDecoder::Enqueue(DecodeJob& job, uint64 cost, std::function<void(const DecodeResult&)>& onComplete) {
+	// Called with m_mutex held
+	auto pState = std::make_shared<JobState>();
+	pState->id = m_nextId++;
+	pState->job = std::move(job);
+	pState->cost = cost;
+	pState->onComplete = std::move(onComplete);
+
+	DecodeTicket ticket;
+	ticket.id = pState->id;
+	ticket.future = pState->promise.get_future();
+
+	m_inFlightBytes += cost;
+	++m_numInFlight;
+	++m_numIncomplete;
+	m_mapJobs[pState->id] = pState;
+	m_dequeQueued.push_back(std::move(pState));
+	m_cvWork.notify_one();
+	return ticket;
+}
+
+DecodeTicket AsyncDecoder::Submit(DecodeJob job, std::function<void(const DecodeResult&)> onComplete) {
+	uint64 cost = EstimateCost(job);
+
+	std::unique_lock l(m_mutex);
+	if ( tl_pWorkerOf != this )
+		m_cvBudget.wait(l, [&]() { return m_numInFlight == 0 || m_inFlightBytes + cost <= m_maxInFlightBytes; });
+	return Enqueue(job, cost, onComplete);
+}
+
+bool AsyncDecoder::TrySubmit(DecodeJob& job, DecodeTicket& ticket, std::function<void(const DecodeResult&)> onComplete) {
+	uint64 cost = EstimateCost(job);
+
+	std::scoped_lock l(m_mutex);
+	if ( m_numInFlight != 0 && m_inFlightBytes + cost > m_maxInFlightBytes )
+		return false;
+	ticket = Enqueue(job, cost, onComplete);
+	return true;
+}
+
+bool AsyncDecoder::Cancel(uint64 id) {
+	std::shared_ptr<JobState> pQueued;
+	{
+		std::scoped_lock l(m_mutex);
+		auto it = m_mapJobs.find(id);
+		if ( it == m_mapJobs.end() )
+			return false;
+		it->second->cancelled = true;
+
+		auto itQueued = std::find(m_dequeQueued.begin(), m_dequeQueued.end(), it->second);
+		if ( itQueued != m_dequeQueued.end() ) {
+			pQueued = std::move(*itQueued);
+			m_dequeQueued.erase(itQueued);
+		}
+	}
+
+	if ( pQueued ) {
+		DecodeResult result;
+		result.id = id;
+		result.cancelled = true;
+		result.error = "Cancelled";
+		Complete(pQueued, result);
+	}
+	return true;
+}
+
+void AsyncDecoder::WaitIdle() {
+	std::unique_lock l(m_mutex);
+	m_cvBudget.wait(l, [this]() { return m_numIncomplete == 0; });
+}
+
+uint64 AsyncDecoder::GetInFlightBytes() {
+	std::scoped_lock l(m_mutex);
+	return m_inFlightBytes;
+}
+
+void AsyncDecoder::Complete(const std::shared_ptr<JobState>& pState, DecodeResult& result) {
+	// The budget is released before the callback, which may submit the next stage of a pipeline,
+	// and before the future is ready, so a caller woken by it can submit right away
+	{
+		std::scoped_lock l(m_mutex);
+		m_inFlightBytes -= pState->cost;
+		--m_numInFlight;
+		m_mapJobs.erase(pState->id);
+	}
+	m_cvBudget.notify_all();
+
+	if ( pState->onComplete )
+		pState->onComplete(result);
+
+	pState->promise.set_value(std::move(result));
+
+	{
+		std::scoped_lock l(m_mutex);
+		--m_numIncomplete;
+	}
+	m_cvBudget.notify_all();
+}
+
+void AsyncDecoder::Worker() {
+	tl_pWorkerOf = this;
+	for ( ;; ) {
+		std::shared_ptr<JobState> pState;
+		{
+			std::unique_lock l(m_mutex);
+			m_cvWork.wait(l, [this]() { return m_stopping || !m_dequeQueued.empty(); });
+			if ( m_dequeQueued.empty() )
+				return;
+			pState = std::move(m_dequeQueued.front());
+			m_dequeQueued.pop_front();
+		}
+
+		DecodeResult result;
+		result.id = pState->id;
+		// A job must not take the host down, e.g. with a bad_alloc for a corrupt size in the headers
+		try {
+			Run(*pState, result);
+		} catch ( const std::exception& e ) {
+			result = {};
+			result.id = pState->id;
+			result.error = std::format("Exception: {}", e.what());
+		} catch ( ... ) {
+			result = {};
+			result.id = pState->id;
+			result.error = "Unknown exception";
+		}
+		if ( pState->cancelled && !result.success ) {
+			result.cancelled = true;
+			result.error = "Cancelled";
+		}
+		Complete(pState, result);
+	}
+}
+
+void AsyncDecoder::Run(JobState& state, DecodeResult& result) {
+	const DecodeJob& job = state.job;
+	std::string fName = job.data.empty() ? job.path.filename().string() : std::format("<memory job {}>", state.id);
+
+	std::string fileData;
+	std::string_view data(job.data.data(), job.data.size());
+	if ( data.empty() ) {
+		// Not ReadFile(), its message box would block the host's thread
+		std::string err;
+		IOStatus status = ReadWithRetry(job.path, fileData, err);
+		if ( status != IOStatus::Ok ) {
+			result.error = status == IOStatus::NotFound ? "File not found" : std::format("Failed to read file: {}", err);
+			return;
+		}
+		data = fileData;
+	}
+	if ( state.cancelled )
+		return;
+
+	CompressedDataHeader compHeader;
+	TCOHeader tcoHeader;
+	result.error = ParseTCOHeaders(data.data(), data.size(), compHeader, tcoHeader);
+	if ( !result.error.empty() )
+		return;
+
+	bool needsDDS = std::find(job.vecFormats.begin(), job.vecFormats.end(), OutputFormat::DDS) != job.vecFormats.end();
+	bool needsImage = job.keepImage || std::any_of(job.vecFormats.begin(), job.vecFormats.end(), [](OutputFormat f) { return f != OutputFormat::DDS; });
+
+	DecodedImage img;
+	if ( needsDDS ) {
+		std::unique_ptr<char[]> pPayload;
+		if ( !DecompressPayload(fName, data.data(), data.size(), compHeader, pPayload) ) {
+			result.error = "Failed to decompress file data";
+			return;
+		}
+
+		std::vector<uint8> out;
+		if ( !EncodeDDS(tcoHeader, pPayload.get(), compHeader.decompressedSize, out) ) {
+			result.error = std::format("Layout {} has no DDS format", ToString(tcoHeader.layout));
+			return;
+		}
+		result.vecOutputs.emplace_back(OutputFormat::DDS, std::move(out));
+
+		if ( needsImage && !DecodePayload(fName, std::move(pPayload), compHeader.decompressedSize, tcoHeader, img) ) {
+			result.error = "Failed to decode image";
+			return;
+		}
+	} else if ( !DecodeTCO(fName, data.data(), data.size(), compHeader, tcoHeader, img) ) {
+		result.error = "Failed to decode image";
+		return;
+	}
+
+	if ( needsImage )
+		OrientForOutput(img);
+
+	for ( OutputFormat format : job.vecFormats ) {
+		if ( format == OutputFormat::DDS )
+			continue;
+		if ( state.cancelled )
+			return;
+
+		std::vector<uint8> out;
+		if ( !EncodeImage(format, img, out) ) {
+			result.error = std::format("Failed to encode image as {}", ToString(format));
+			return;
+		}
+		result.vecOutputs.emplace_back(format, std::move(out));
+	}
+
+	if ( job.keepImage )
+		result.image = std::move(img);
+	result.success = true;
+}
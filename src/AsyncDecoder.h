@@ -0,0 +1,102 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+
+#include "Common.h"
+#include "TCO.h"
+#include "Decoder.h"
+#include "Output.h"
+
+struct DecodeJob {
+	// Read from disk, unless `data` is set
+	std::filesystem::path path;
+	// A whole TCO file in memory, which must stay valid until the job completed
+	std::span<const char> data;
+
+	// Encoded outputs to produce, the decoded image is returned as well if `keepImage` is set
+	std::vector<OutputFormat> vecFormats;
+	bool keepImage = false;
+};
+
+struct DecodeResult {
+	uint64 id = 0;
+	bool success = false;
+	bool cancelled = false;
+	std::string error;
+
+	// Rows in top-down order, see OrientForOutput()
+	DecodedImage image;
+	std::vector<std::pair<OutputFormat, std::vector<uint8>>> vecOutputs;
+};
+
+struct DecodeTicket {
+	uint64 id = 0;
+	std::future<DecodeResult> future;
+};
+
+// Decodes a stream of jobs on a pool of worker threads, for embedding the decoder into other programs.
+// Every job is charged its estimated peak memory (file, payload and pixels) against `maxInFlightBytes`
+// from submission until completion; Submit() blocks while that budget is used up, which gives callers
+// backpressure. A job bigger than the whole budget is admitted once nothing else is in flight.
+class AsyncDecoder {
+public:
+	AsyncDecoder(uint32 numThreads, uint64 maxInFlightBytes);
+	// Cancels all jobs that did not start yet and waits for the running ones
+	~AsyncDecoder();
+	AsyncDecoder(const AsyncDecoder&) = delete;
+	AsyncDecoder& operator=(const AsyncDecoder&) = delete;
+
+	// `onComplete` runs on the worker thread before the future becomes ready, also for failed and cancelled jobs.
+	// The job's budget is released before it runs. Submit() from a callback admits the job right away instead of
+	// waiting, as the budget it would wait for may only be freed by jobs queued behind the callback.
+	DecodeTicket Submit(DecodeJob job, std::function<void(const DecodeResult&)> onComplete = nullptr);
+	// Like Submit(), but returns false instead of blocking when the budget is used up
+	bool TrySubmit(DecodeJob& job, DecodeTicket& ticket, std::function<void(const DecodeResult&)> onComplete = nullptr);
+
+	// Queued jobs complete as cancelled right away, running ones stop after their current stage.
+	// Returns false if the job already completed or is unknown.
+	bool Cancel(uint64 id);
+
+	// Blocks until every submitted job completed and its callback returned
+	void WaitIdle();
+
+	uint64 GetInFlightBytes();
+
+private:
+	struct JobState {
+		uint64 id;
+		DecodeJob job;
+		uint64 cost;
+		std::atomic<bool> cancelled = false;
+		std::promise<DecodeResult> promise;
+		std::function<void(const DecodeResult&)> onComplete;
+	};
+
+	uint64 EstimateCost(const DecodeJob& job);
+	DecodeTicket Enqueue(DecodeJob& job, uint64 cost, std::function<void(const DecodeResult&)>& onComplete);
+	void Complete(const std::shared_ptr<JobState>& pState, DecodeResult& result);
+	void Worker();
+	void Run(JobState& state, DecodeResult& result);
+
+	uint64 m_maxInFlightBytes;
+	uint64 m_inFlightBytes = 0;
+	uint64 m_numInFlight = 0;
+	// Jobs whose future is not ready yet, they stay counted while their callback runs
+	uint64 m_numIncomplete = 0;
+	uint64 m_nextId = 1;
+	bool m_stopping = false;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cvWork;
+	std::condition_variable m_cvBudget;
+	std::deque<std::shared_ptr<JobState>> m_dequeQueued;
+	std::unordered_map<uint64, std::shared_ptr<JobState>> m_mapJobs;
+	std::vector<std::thread> m_vecThreads;
+};
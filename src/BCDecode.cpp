@@ -0,0 +1,356 @@
+#include "BCDecode.h"
+#include "BPTCDecode.h"
+#include "Kernels.h"
+#include "Options.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+
+#include "DirectXTex.h"
+
+// Constant stretches shorter than this are decoded together with the blocks around them,
+// a separate DirectXTex call per block would cost more than it saves
+constexpr uint32 MinConstantRun = 4;
+
+// Every 3 bit index of a BC3 alpha / BC4 / BC5 block set to 1
+constexpr uint64 Index3Ones = 0x249249249249ull;
+
+static void GetBCFormats(TCOLayout layout, DXGI_FORMAT& sourceFormat, DXGI_FORMAT& dstFormat) {
+	switch(layout) {
+		case TCOLayout::BC1:
+			sourceFormat = DXGI_FORMAT_BC1_TYPELESS;
+			break;
+		case TCOLayout::BC2:
+			sourceFormat = DXGI_FORMAT_BC2_TYPELESS;
+			break;
+		case TCOLayout::BC3:
+			sourceFormat = DXGI_FORMAT_BC3_TYPELESS;
+			break;
+		case TCOLayout::BC4:
+			sourceFormat = DXGI_FORMAT_BC4_TYPELESS;
+			break;
+		case TCOLayout::BC5:
+			sourceFormat = DXGI_FORMAT_BC5_TYPELESS;
+			break;
+		case TCOLayout::BC6H:
+			sourceFormat = DXGI_FORMAT_BC6H_UF16;
+			break;
+		case TCOLayout::BC7:
+			sourceFormat = DXGI_FORMAT_BC7_TYPELESS;
+			break;
+	}
+
+	switch(layout) {
+		case TCOLayout::BC1:
+		case TCOLayout::BC2:
+		case TCOLayout::BC3:
+		case TCOLayout::BC7:
+			dstFormat = DXGI_FORMAT_R8G8B8A8_UNORM;
+			break;
+		case TCOLayout::BC6H:
+			dstFormat = DXGI_FORMAT_R32G32B32A32_FLOAT;
+			break;
+		case TCOLayout::BC4:
+			dstFormat = DXGI_FORMAT_R8_UNORM;
+			break;
+		case TCOLayout::BC5:
+			dstFormat = DXGI_FORMAT_R8G8_UNORM;
+			break;
+	}
+}
+
+bool IsBCLayout(TCOLayout layout) {
+	return (layout >= TCOLayout::BC1 && layout <= TCOLayout::BC5) || layout == TCOLayout::BC6H || layout == TCOLayout::BC7;
+}
+
+uint32 GetBCNumChannels(TCOLayout layout) {
+	if ( layout == TCOLayout::BC4 )
+		return 1;
+	if ( layout == TCOLayout::BC5 )
+		return 2;
+	return 4;
+}
+
+uint64 GetBCBlockBytes(TCOLayout layout) {
+	return (layout == TCOLayout::BC1 || layout == TCOLayout::BC4) ? 8 : 16;
+}
+
+/*
+	DirectXTex decodes blocks to float and stores them to 8 bits rounded (R8G8B8A8_UNORM, R8G8_UNORM)
+	or truncated (R8_UNORM). Every rounded palette entry computed below is a multiple of 1/93, 1/189,
+	1/7 or 1/5 before rounding, so it never lies on a tie and integer rounding yields the same byte
+	as the float math. The one exception is the BC1 3-colour midpoint, which is left to DirectXTex.
+*/
+static uint8 RoundDiv(uint32 num, uint32 den) {
+	return uint8((2 * num + den) / (2 * den));
+}
+
+// Entry `index` of a BC1 colour palette as RGBA8, false if it cannot be derived exactly
+static bool GetBC1Color(uint16 c0, uint16 c1, uint32 index, bool isBC1, uint8 color[4]) {
+	color[3] = 255;
+	if ( isBC1 && c0 <= c1 ) {
+		if ( index == 3 ) {
+			std::memset(color, 0, 4);
+			return true;
+		}
+		if ( index == 2 ) {
+			if ( c0 != c1 )
+				return false;
+			index = 0;
+		}
+	}
+
+	// Weights of c0 and c1 in thirds
+	static constexpr uint32 weights0[4] = {3, 0, 2, 1};
+	uint32 w0 = weights0[index];
+	uint32 w1 = 3 - w0;
+	color[0] = RoundDiv(255 * (w0 * (c0 >> 11) + w1 * (c1 >> 11)), 3 * 31);
+	color[1] = RoundDiv(255 * (w0 * ((c0 >> 5) & 0x3F) + w1 * ((c1 >> 5) & 0x3F)), 3 * 63);
+	color[2] = RoundDiv(255 * (w0 * (c0 & 0x1F) + w1 * (c1 & 0x1F)), 3 * 31);
+	return true;
+}
+
+static bool GetConstantBC1(const uint8* pBlock, bool isBC1, uint8 color[4]) {
+	uint16 c0, c1;
+	uint32 indices;
+	std::memcpy(&c0, pBlock, 2);
+	std::memcpy(&c1, pBlock + 2, 2);
+	std::memcpy(&indices, pBlock + 4, 4);
+
+	uint32 index = indices & 3;
+	if ( indices == index * 0x55555555u )
+		return GetBC1Color(c0, c1, index, isBC1, color);
+
+	// Equal endpoints make every entry the same, apart from the transparent one in 3-colour mode
+	if ( c0 == c1 && (!isBC1 || (indices & (indices >> 1) & 0x55555555u) == 0) )
+		return GetBC1Color(c0, c1, 0, isBC1, color);
+
+	return false;
+}
+
+// Entry `index` of a BC3 alpha / BC4 / BC5 palette, rounded
+static uint8 GetBC4Value(uint8 v0, uint8 v1, uint32 index) {
+	if ( index == 0 )
+		return v0;
+	if ( index == 1 )
+		return v1;
+	if ( v0 > v1 )
+		return RoundDiv((8 - index) * v0 + (index - 1) * v1, 7);
+	if ( index == 6 )
+		return 0;
+	if ( index == 7 )
+		return 255;
+	return RoundDiv((6 - index) * v0 + (index - 1) * v1, 5);
+}
+
+// The same for BC4 to R8_UNORM, which DirectXTex truncates. That is not robust against float error, so its math is repeated.
+static uint8 GetBC4ValueTruncated(uint8 v0, uint8 v1, uint32 index) {
+	float f0 = float(v0) / 255.0f;
+	float f1 = float(v1) / 255.0f;
+	float v;
+	if ( index == 0 )
+		v = f0;
+	else if ( index == 1 )
+		v = f1;
+	else if ( v0 > v1 )
+		v = (f0 * float(8u - index) + f1 * float(index - 1)) / 7.0f;
+	else if ( index == 6 )
+		v = 0.0f;
+	else if ( index == 7 )
+		v = 1.0f;
+	else
+		v = (f0 * float(6u - index) + f1 * float(index - 1)) / 5.0f;
+	return uint8(std::clamp(v, 0.0f, 1.0f) * 255.0f);
+}
+
+// An 8 byte BC4-style block: two endpoints and 16 3-bit indices
+static bool GetConstantBC4(const uint8* pBlock, bool truncated, uint8& value) {
+	uint64 indices = 0;
+	std::memcpy(&indices, pBlock + 2, 6);
+
+	uint32 index = uint32(indices & 7);
+	if ( indices == index * Index3Ones ) {
+		value = truncated ? GetBC4ValueTruncated(pBlock[0], pBlock[1], index) : GetBC4Value(pBlock[0], pBlock[1], index);
+		return true;
+	}
+
+	// Equal endpoints select 6-value mode, where only indices 6 and 7 differ.
+	// Truncation can tell the interpolated entries apart by one, so that case only takes uniform indices.
+	bool hasIndex67 = ((indices >> 2) & (indices >> 1) & Index3Ones) != 0;
+	if ( !truncated && pBlock[0] == pBlock[1] && !hasIndex67 ) {
+		value = pBlock[0];
+		return true;
+	}
+	return false;
+}
+
+static bool GetConstantBC2Alpha(const uint8* pBlock, uint8& value) {
+	uint64 alpha;
+	std::memcpy(&alpha, pBlock, 8);
+	uint64 nibble = alpha & 0xF;
+	value = uint8(nibble * 17);
+	return alpha == nibble * 0x1111111111111111ull;
+}
+
+// Colour of all 16 pixels of a block, with GetBCNumChannels() channels, false if they differ (or might)
+static bool GetConstantBlock(TCOLayout layout, const uint8* pBlock, uint8 color[4]) {
+	switch(layout) {
+		case TCOLayout::BC1:
+			return GetConstantBC1(pBlock, true, color);
+		case TCOLayout::BC2: {
+			uint8 alpha;
+			if ( !GetConstantBC2Alpha(pBlock, alpha) || !GetConstantBC1(pBlock + 8, false, color) )
+				return false;
+			color[3] = alpha;
+			return true;
+		}
+		case TCOLayout::BC3: {
+			uint8 alpha;
+			if ( !GetConstantBC4(pBlock, false, alpha) || !GetConstantBC1(pBlock + 8, false, color) )
+				return false;
+			color[3] = alpha;
+			return true;
+		}
+		case TCOLayout::BC4:
+			return GetConstantBC4(pBlock, true, color[0]);
+		case TCOLayout::BC5:
+			return GetConstantBC4(pBlock, false, color[0]) && GetConstantBC4(pBlock + 8, false, color[1]);
+		default:
+			return false;
+	}
+}
+
+static void AddColor(ConstantColor& constant, const uint8* color, uint32 numChannels) {
+	if ( !constant.isConstant )
+		return;
+	if ( !constant.hasColor ) {
+		std::memcpy(constant.color, color, numChannels);
+		constant.hasColor = true;
+	} else if ( std::memcmp(constant.color, color, numChannels) != 0 ) {
+		constant.isConstant = false;
+	}
+}
+
+// Every pixel decodes on its own here, so whether the texture has one colour is checked on the output rows
+static void AddRows(ConstantColor& constant, const uint8* pRows, uint64 pitch, uint32 width, uint32 numRows) {
+	for ( uint32 row = 0; row < numRows && constant.isConstant; ++row ) {
+		const uint8* pRow = pRows + row * pitch;
+		AddColor(constant, pRow, 4);
+		for ( uint32 x = 1; x < width && constant.isConstant; ++x )
+			constant.isConstant = std::memcmp(pRow + x * 4, constant.color, 4) == 0;
+	}
+}
+
+static void DecodeBPTCRows(TCOLayout layout, const uint8* pBlocks, uint64 blockRowPitch, uint32 width, uint32 numRows, uint8* pDst, uint64 dstPitch, ConstantColor& constant, float* pHDR) {
+	uint32 numBlocksX = (width + 3) / 4;
+	uint64 hdrPitch = uint64(width) * 4;
+
+	for ( uint32 y = 0; y < numRows; y += 4 ) {
+		const uint8* pBlockRow = pBlocks + (y / 4) * blockRowPitch;
+		uint8* pDstRow = pDst + y * dstPitch;
+		uint32 blockHeight = std::min(4u, numRows - y);
+
+		for ( uint32 bx = 0; bx < numBlocksX; ++bx ) {
+			uint32 blockWidth = std::min(4u, width - bx * 4);
+			if ( layout == TCOLayout::BC7 ) {
+				uint8 pixels[16 * 4];
+				DecodeBC7Block(pBlockRow + bx * 16, pixels);
+				for ( uint32 row = 0; row < blockHeight; ++row )
+					std::memcpy(pDstRow + row * dstPitch + bx * 16, pixels + row * 16, blockWidth * 4);
+			} else {
+				float pixels[16 * 4];
+				DecodeBC6HBlock(pBlockRow + bx * 16, pixels);
+				for ( uint32 row = 0; row < blockHeight; ++row )
+					std::memcpy(pHDR + (y + row) * hdrPitch + bx * 16, pixels + row * 16, blockWidth * 4 * sizeof(float));
+			}
+		}
+
+		if ( layout == TCOLayout::BC6H ) {
+			for ( uint32 row = 0; row < blockHeight; ++row )
+				gKernels.TonemapRGBAFloat(pHDR + (y + row) * hdrPitch, pDstRow + row * dstPitch, width, gOptions.exposure);
+		}
+		AddRows(constant, pDstRow, dstPitch, width, blockHeight);
+	}
+}
+
+bool DecodeBCRows(TCOLayout layout, const uint8* pBlocks, uint64 blockRowPitch, uint32 width, uint32 numRows, uint8* pDst, uint64 dstPitch, ConstantColor& constant, float* pHDR) {
+	if ( layout == TCOLayout::BC6H || layout == TCOLayout::BC7 ) {
+		DecodeBPTCRows(layout, pBlocks, blockRowPitch, width, numRows, pDst, dstPitch, constant, pHDR);
+		return true;
+	}
+
+	DXGI_FORMAT sourceFormat;
+	DXGI_FORMAT dstFormat;
+	GetBCFormats(layout, sourceFormat, dstFormat);
+	uint32 numChannels = GetBCNumChannels(layout);
+	uint64 blockBytes = GetBCBlockBytes(layout);
+	uint32 numBlocksX = (width + 3) / 4;
+
+	std::vector<uint8> vecIsConstant(numBlocksX);
+	std::vector<uint32> vecColors(numBlocksX);
+
+	for ( uint32 y = 0; y < numRows; y += 4 ) {
+		const uint8* pBlockRow = pBlocks + (y / 4) * blockRowPitch;
+		uint8* pDstRow = pDst + y * dstPitch;
+		uint32 blockHeight = std::min(4u, numRows - y);
+
+		for ( uint32 bx = 0; bx < numBlocksX; ++bx )
+			vecIsConstant[bx] = GetConstantBlock(layout, pBlockRow + bx * blockBytes, (uint8*)&vecColors[bx]);
+
+		for ( uint32 bx = 0; bx < numBlocksX; ) {
+			uint32 end = bx;
+			while ( end < numBlocksX && vecIsConstant[end] )
+				++end;
+
+			if ( end - bx >= MinConstantRun || (end == numBlocksX && end != bx) ) {
+				for ( ; bx < end; ++bx ) {
+					const uint8* color = (const uint8*)&vecColors[bx];
+					AddColor(constant, color, numChannels);
+
+					uint8 pattern[16];
+					for ( uint32 i = 0; i < 4; ++i )
+						std::memcpy(pattern + i * numChannels, color, numChannels);
+
+					uint32 blockWidth = std::min(4u, width - bx * 4);
+					for ( uint32 row = 0; row < blockHeight; ++row )
+						std::memcpy(pDstRow + row * dstPitch + bx * 4 * numChannels, pattern, blockWidth * numChannels);
+				}
+				continue;
+			}
+
+			// Extend the run up to the next constant stretch long enough to fill directly
+			for ( end = bx + 1; end < numBlocksX; ++end ) {
+				uint32 runEnd = end;
+				while ( runEnd < numBlocksX && vecIsConstant[runEnd] )
+					++runEnd;
+				if ( runEnd - end >= MinConstantRun || (runEnd == numBlocksX && runEnd != end) )
+					break;
+				end = runEnd;
+			}
+			constant.isConstant = false;
+
+			DirectX::Image cImage;
+			cImage.width = std::min(end * 4, width) - bx * 4;
+			cImage.height = blockHeight;
+			cImage.format = sourceFormat;
+			cImage.rowPitch = blockRowPitch;
+			cImage.slicePitch = blockRowPitch;
+			cImage.pixels = const_cast<uint8*>(pBlockRow + bx * blockBytes);
+
+			DirectX::ScratchImage resImage;
+			HRESULT hRes = DirectX::Decompress(cImage, dstFormat, resImage);
+			if ( FAILED(hRes) )
+				return false;
+
+			const DirectX::Image* pRes = resImage.GetImage(0, 0, 0);
+			for ( uint32 row = 0; row < blockHeight; ++row )
+				std::memcpy(pDstRow + row * dstPitch + bx * 4 * numChannels, pRes->pixels + row * pRes->rowPitch, cImage.width * numChannels);
+			bx = end;
+		}
+	}
+	return true;
+}
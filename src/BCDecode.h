@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Common.h"
+#include "TCO.h"
+
+bool IsBCLayout(TCOLayout layout);
+// Channels of the 8 bit image a BC layout decodes to
+uint32 GetBCNumChannels(TCOLayout layout);
+// Bytes per 4x4 block
+uint64 GetBCBlockBytes(TCOLayout layout);
+
+// Whether every pixel decoded so far had one colour, accumulated over DecodeBCRows() calls
+struct ConstantColor {
+	bool isConstant = true;
+	bool hasColor = false;
+	uint8 color[4] = {};
+};
+
+// Decodes `numRows` pixel rows of `width` pixels of BC blocks, `blockRowPitch` bytes per row of blocks, to
+// GetBCNumChannels() bytes per pixel at `pDst`, `dstPitch` bytes per row. The output equals DirectX::Decompress.
+// Blocks whose 16 pixels share one colour are filled in directly, only the remaining runs of blocks are
+// handed to DirectXTex. BC6H and BC7 are decoded without DirectXTex, see BPTCDecode.h.
+// BC6H also needs `pHDR`, which receives the RGBA floats (width * 4 per row) that `pDst` is tone-mapped from.
+// Returns false if DirectXTex fails.
+bool DecodeBCRows(TCOLayout layout, const uint8* pBlocks, uint64 blockRowPitch, uint32 width, uint32 numRows, uint8* pDst, uint64 dstPitch, ConstantColor& constant, float* pHDR = nullptr);
@@ -0,0 +1,382 @@
+#include "BPTCDecode.h"
+
+#include <bit>
+#include <cstring>
+#include <utility>
+
+/*
+	BC6H and BC7 ("BPTC") decoded with integer math only, following the reference decoder of DirectXTex
+	(BC6HBC7.cpp) step by step so the results are bit-exact. DirectXTex decodes through floats and per-bit
+	descriptor loops, which makes these formats several times slower to dump than BC1-BC5.
+	The tables below are generated from the ones in BC6HBC7.cpp.
+*/
+
+// Subset of every pixel for 1, 2 and 3 subsets by shape, 2 bits per pixel starting at the lowest bits
+static constexpr uint32 PartitionTable[3][64] = {
+	{
+		0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+		0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+		0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+		0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+		0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+		0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+		0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+		0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	},
+	{
+		0x50505050, 0x40404040, 0x54545454, 0x54505040, 0x50404000, 0x55545450, 0x55545040, 0x54504000,
+		0x50400000, 0x55555450, 0x55544000, 0x54400000, 0x55555440, 0x55550000, 0x55555500, 0x55000000,
+		0x55150100, 0x00004054, 0x15010000, 0x00405054, 0x00004050, 0x15050100, 0x05010000, 0x40505054,
+		0x00404050, 0x05010100, 0x14141414, 0x05141450, 0x01155440, 0x00555500, 0x15014054, 0x05414150,
+		0x44444444, 0x55005500, 0x11441144, 0x05055050, 0x05500550, 0x11114444, 0x41144114, 0x44111144,
+		0x15055054, 0x01055040, 0x05041050, 0x05455150, 0x14414114, 0x50050550, 0x41411414, 0x00141400,
+		0x00041504, 0x00105410, 0x10541000, 0x04150400, 0x50410514, 0x41051450, 0x05415014, 0x14054150,
+		0x41050514, 0x41505014, 0x40011554, 0x54150140, 0x50505500, 0x00555050, 0x15151010, 0x54540404,
+	},
+	{
+		0xAA685050, 0x6A5A5040, 0x5A5A4200, 0x5450A0A8, 0xA5A50000, 0xA0A05050, 0x5555A0A0, 0x5A5A5050,
+		0xAA550000, 0xAA555500, 0xAAAA5500, 0x90909090, 0x94949494, 0xA4A4A4A4, 0xA9A59450, 0x2A0A4250,
+		0xA5945040, 0x0A425054, 0xA5A5A500, 0x55A0A0A0, 0xA8A85454, 0x6A6A4040, 0xA4A45000, 0x1A1A0500,
+		0x0050A4A4, 0xAAA59090, 0x14696914, 0x69691400, 0xA08585A0, 0xAA821414, 0x50A4A450, 0x6A5A0200,
+		0xA9A58000, 0x5090A0A8, 0xA8A09050, 0x24242424, 0x00AA5500, 0x24924924, 0x24499224, 0x50A50A50,
+		0x500AA550, 0xAAAA4444, 0x66660000, 0xA5A0A5A0, 0x50A050A0, 0x69286928, 0x44AAAA44, 0x66666600,
+		0xAA444444, 0x54A854A8, 0x95809580, 0x96969600, 0xA85454A8, 0x80959580, 0xAA141414, 0x96960000,
+		0xAAAA1414, 0xA05050A0, 0xA0A5A5A0, 0x96000000, 0x40804080, 0xA9A8A9A8, 0xAAAAAA44, 0x2A4A5254,
+	},
+};
+
+// Pixels whose index is stored with one bit less (the first pixel of every subset), by subset count and shape
+static constexpr uint16 AnchorMasks[3][64] = {
+	{
+		0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001,
+		0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001,
+		0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001,
+		0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001,
+		0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001,
+		0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001,
+		0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001,
+		0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001,
+	},
+	{
+		0x8001, 0x8001, 0x8001, 0x8001, 0x8001, 0x8001, 0x8001, 0x8001,
+		0x8001, 0x8001, 0x8001, 0x8001, 0x8001, 0x8001, 0x8001, 0x8001,
+		0x8001, 0x0005, 0x0101, 0x0005, 0x0005, 0x0101, 0x0101, 0x8001,
+		0x0005, 0x0101, 0x0005, 0x0005, 0x0101, 0x0101, 0x0005, 0x0005,
+		0x8001, 0x8001, 0x0041, 0x0101, 0x0005, 0x0101, 0x8001, 0x8001,
+		0x0005, 0x0101, 0x0005, 0x0005, 0x0005, 0x8001, 0x8001, 0x0041,
+		0x0041, 0x0005, 0x0041, 0x0101, 0x8001, 0x8001, 0x0005, 0x0005,
+		0x8001, 0x8001, 0x8001, 0x8001, 0x8001, 0x0005, 0x0005, 0x8001,
+	},
+	{
+		0x8009, 0x0109, 0x8101, 0x8009, 0x8101, 0x8009, 0x8009, 0x8101,
+		0x8101, 0x8101, 0x8041, 0x8041, 0x8041, 0x8021, 0x8009, 0x0109,
+		0x8009, 0x0109, 0x8101, 0x8009, 0x8009, 0x0109, 0x8041, 0x0501,
+		0x0029, 0x8101, 0x0141, 0x0441, 0x8101, 0x8021, 0x8401, 0x8101,
+		0x8101, 0x8009, 0x8009, 0x0421, 0x0441, 0x0501, 0x0301, 0x8401,
+		0x8041, 0x8009, 0x8101, 0x8021, 0x8009, 0x8041, 0x8041, 0x8101,
+		0x8009, 0x8009, 0x8021, 0x8021, 0x8021, 0x8101, 0x8021, 0x8401,
+		0x8021, 0x8401, 0x8101, 0xA001, 0x8009, 0x9001, 0x8009, 0x0109,
+	},
+};
+
+static constexpr uint8 Weights2[4] = {0, 21, 43, 64};
+static constexpr uint8 Weights3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+static constexpr uint8 Weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// By index precision
+static constexpr const uint8* Weights[5] = {nullptr, nullptr, Weights2, Weights3, Weights4};
+
+static uint32 Interpolate(uint32 e0, uint32 e1, uint32 weight) {
+	return (e0 * (64 - weight) + e1 * weight + 32) >> 6;
+}
+
+static uint32 GetSubset(uint32 numSubsets, uint32 shape, uint32 pixel) {
+	return (PartitionTable[numSubsets - 1][shape] >> (pixel * 2)) & 3;
+}
+
+static bool IsAnchor(uint32 numSubsets, uint32 shape, uint32 pixel) {
+	return (AnchorMasks[numSubsets - 1][shape] >> pixel) & 1;
+}
+
+// Reads a 128 bit block from its lowest bit upwards, by shifting the consumed bits out
+class BlockBits {
+public:
+	explicit BlockBits(const uint8* pBlock) {
+		std::memcpy(&m_lo, pBlock, 8);
+		std::memcpy(&m_hi, pBlock + 8, 8);
+	}
+
+	uint32 Read(uint32 count) {
+		if ( count == 0 )
+			return 0;
+		uint32 bits = uint32(m_lo & ((1ull << count) - 1));
+		m_lo = (m_lo >> count) | (m_hi << (64 - count));
+		m_hi >>= count;
+		return bits;
+	}
+
+private:
+	uint64 m_lo;
+	uint64 m_hi;
+};
+
+
+struct BC7Mode {
+	uint8 numSubsets;
+	uint8 partitionBits;
+	uint8 rotationBits;
+	uint8 indexModeBits;
+	uint8 colorBits;
+	uint8 alphaBits;
+	// 0, one per endpoint or one per subset
+	uint8 numPBits;
+	uint8 indexBits;
+	uint8 indexBits2;
+};
+
+static constexpr BC7Mode BC7Modes[8] = {
+	{3, 4, 0, 0, 4, 0, 6, 3, 0},
+	{2, 6, 0, 0, 6, 0, 2, 3, 0},
+	{3, 6, 0, 0, 5, 0, 0, 2, 0},
+	{2, 6, 0, 0, 7, 0, 4, 2, 0},
+	{1, 0, 2, 1, 5, 6, 0, 2, 3},
+	{1, 0, 2, 0, 7, 8, 0, 2, 2},
+	{1, 0, 0, 0, 7, 7, 2, 4, 0},
+	{2, 6, 0, 0, 5, 5, 4, 2, 0},
+};
+
+// Instantiated per mode, so every field width is a constant and the loops unroll
+template <uint32 mode>
+static void DecodeBC7Mode(const uint8* pBlock, uint8* pPixels) {
+	constexpr BC7Mode info = BC7Modes[mode];
+
+	BlockBits bits(pBlock);
+	bits.Read(mode + 1);
+	uint32 shape = bits.Read(info.partitionBits);
+	uint32 rotation = bits.Read(info.rotationBits);
+	uint32 indexMode = bits.Read(info.indexModeBits);
+
+	constexpr uint32 numEndpoints = info.numSubsets * 2u;
+	uint32 endpoints[6][4];
+	for ( uint32 c = 0; c < 3; ++c ) {
+		for ( uint32 i = 0; i < numEndpoints; ++i )
+			endpoints[i][c] = bits.Read(info.colorBits);
+	}
+	for ( uint32 i = 0; i < numEndpoints; ++i )
+		endpoints[i][3] = info.alphaBits ? bits.Read(info.alphaBits) : 255;
+
+	uint32 pBits[6] = {};
+	for ( uint32 i = 0; i < info.numPBits; ++i )
+		pBits[i] = bits.Read(1);
+
+	// Expand to 8 bits by replicating the top bits, P-bits become the lowest bit of every channel that has one
+	constexpr uint32 precision = info.colorBits + (info.numPBits ? 1u : 0u);
+	constexpr uint32 alphaPrecision = info.alphaBits ? info.alphaBits + (info.numPBits ? 1u : 0u) : 0u;
+	for ( uint32 i = 0; i < numEndpoints; ++i ) {
+		uint32 pBit = pBits[info.numPBits ? i * info.numPBits / numEndpoints : 0];
+		for ( uint32 c = 0; c < 4; ++c ) {
+			uint32 prec = c < 3 ? precision : alphaPrecision;
+			if ( prec == 0 )
+				continue;
+			uint32 v = endpoints[i][c];
+			if ( info.numPBits )
+				v = (v << 1) | pBit;
+			v = (v << (8 - prec)) & 0xFF;
+			endpoints[i][c] = v | (v >> prec);
+		}
+	}
+
+	uint32 partition = PartitionTable[info.numSubsets - 1][shape];
+	uint32 anchors = AnchorMasks[info.numSubsets - 1][shape];
+	uint8 indices[16];
+	for ( uint32 i = 0; i < 16; ++i )
+		indices[i] = uint8(bits.Read(info.indexBits - ((anchors >> i) & 1)));
+
+	// Every pixel picks one of at most 16 colours of its subset, so those are interpolated up front
+	uint8 palettes[3][16][4];
+	const uint8* weights = Weights[info.indexBits];
+	for ( uint32 s = 0; s < info.numSubsets; ++s ) {
+		for ( uint32 w = 0; w < (1u << info.indexBits); ++w ) {
+			for ( uint32 c = 0; c < 4; ++c )
+				palettes[s][w][c] = uint8(Interpolate(endpoints[s * 2][c], endpoints[s * 2 + 1][c], weights[w]));
+		}
+	}
+
+	if constexpr ( info.indexBits2 == 0 ) {
+		for ( uint32 i = 0; i < 16; ++i )
+			std::memcpy(pPixels + i * 4, palettes[(partition >> (i * 2)) & 3][indices[i]], 4);
+	} else {
+		// Modes 4 and 5 have one subset and a second index set, which drives alpha unless the index mode swaps them
+		uint8 indices2[16];
+		for ( uint32 i = 0; i < 16; ++i )
+			indices2[i] = uint8(bits.Read(info.indexBits2 - (i == 0 ? 1u : 0u)));
+
+		uint8 palette2[8][4];
+		const uint8* weights2 = Weights[info.indexBits2];
+		for ( uint32 w = 0; w < (1u << info.indexBits2); ++w ) {
+			for ( uint32 c = 0; c < 4; ++c )
+				palette2[w][c] = uint8(Interpolate(endpoints[0][c], endpoints[1][c], weights2[w]));
+		}
+
+		const uint8 (*colorPalette)[4] = indexMode ? palette2 : palettes[0];
+		const uint8 (*alphaPalette)[4] = indexMode ? palettes[0] : palette2;
+		const uint8* colorIndices = indexMode ? indices2 : indices;
+		const uint8* alphaIndices = indexMode ? indices : indices2;
+		for ( uint32 i = 0; i < 16; ++i ) {
+			uint8 px[4];
+			std::memcpy(px, colorPalette[colorIndices[i]], 3);
+			px[3] = alphaPalette[alphaIndices[i]][3];
+			if ( rotation != 0 )
+				std::swap(px[rotation - 1], px[3]);
+			std::memcpy(pPixels + i * 4, px, 4);
+		}
+	}
+}
+
+void DecodeBC7Block(const uint8* pBlock, uint8* pPixels) {
+	static constexpr void (*decoders[8])(const uint8*, uint8*) = {
+		DecodeBC7Mode<0>, DecodeBC7Mode<1>, DecodeBC7Mode<2>, DecodeBC7Mode<3>,
+		DecodeBC7Mode<4>, DecodeBC7Mode<5>, DecodeBC7Mode<6>, DecodeBC7Mode<7>,
+	};
+
+	// The mode is the number of zero bits before the first set one, 8 or more is reserved and decodes to transparent black
+	if ( pBlock[0] == 0 ) {
+		std::memset(pPixels, 0, 16 * 4);
+		return;
+	}
+	decoders[std::countr_zero(pBlock[0])](pBlock, pPixels);
+}
+
+
+struct BC6HMode {
+	uint8 numRegions;
+	bool transformed;
+	uint8 indexBits;
+	uint8 endpointBits;
+	// Bits of the delta-coded endpoints per channel
+	uint8 deltaBits[3];
+};
+
+// By mode index, see BC6HModeIndex
+static constexpr BC6HMode BC6HModes[14] = {
+	{2, true, 3, 10, {5, 5, 5}},
+	{2, true, 3, 7, {6, 6, 6}},
+	{2, true, 3, 11, {5, 4, 4}},
+	{2, true, 3, 11, {4, 5, 4}},
+	{2, true, 3, 11, {4, 4, 5}},
+	{2, true, 3, 9, {5, 5, 5}},
+	{2, true, 3, 8, {6, 5, 5}},
+	{2, true, 3, 8, {5, 6, 5}},
+	{2, true, 3, 8, {5, 5, 6}},
+	{2, false, 3, 6, {6, 6, 6}},
+	{1, false, 4, 10, {10, 10, 10}},
+	{1, true, 4, 11, {9, 9, 9}},
+	{1, true, 4, 12, {8, 8, 8}},
+	{1, true, 4, 16, {4, 4, 4}},
+};
+
+// Mode index of every 2 or 5 bit mode code, -1 = reserved
+static constexpr int BC6HModeIndex[32] = {
+	0, 1, 2, 10, -1, -1, 3, 11, -1, -1, 4, 12, -1, -1, 5, 13,
+	-1, -1, 6, -1, -1, -1, 7, -1, -1, -1, 8, -1, -1, -1, 9, -1,
+};
+
+// The header after the mode code is a sequence of bit runs, each holding `count` bits of one
+// value starting at its bit `shift`. Values 0-11 are endpoint A0, B0, A1, B1 of red, then green and blue,
+// value 12 is the shape. A run with count 0 ends the list.
+struct BC6HFieldRun {
+	uint8 field;
+	uint8 shift;
+	uint8 count;
+};
+
+constexpr uint32 BC6HMaxRuns = 24;
+
+static constexpr BC6HFieldRun BC6HRuns[14][BC6HMaxRuns] = {
+	{{6, 4, 1}, {10, 4, 1}, {11, 4, 1}, {0, 0, 10}, {4, 0, 10}, {8, 0, 10}, {1, 0, 5}, {7, 4, 1}, {6, 0, 4}, {5, 0, 5}, {11, 0, 1}, {7, 0, 4}, {9, 0, 5}, {11, 1, 1}, {10, 0, 4}, {2, 0, 5}, {11, 2, 1}, {3, 0, 5}, {11, 3, 1}, {12, 0, 5}},
+	{{6, 5, 1}, {7, 4, 2}, {0, 0, 7}, {11, 0, 2}, {10, 4, 1}, {4, 0, 7}, {10, 5, 1}, {11, 2, 1}, {6, 4, 1}, {8, 0, 7}, {11, 3, 1}, {11, 5, 1}, {11, 4, 1}, {1, 0, 6}, {6, 0, 4}, {5, 0, 6}, {7, 0, 4}, {9, 0, 6}, {10, 0, 4}, {2, 0, 6}, {3, 0, 6}, {12, 0, 5}},
+	{{0, 0, 10}, {4, 0, 10}, {8, 0, 10}, {1, 0, 5}, {0, 10, 1}, {6, 0, 4}, {5, 0, 4}, {4, 10, 1}, {11, 0, 1}, {7, 0, 4}, {9, 0, 4}, {8, 10, 1}, {11, 1, 1}, {10, 0, 4}, {2, 0, 5}, {11, 2, 1}, {3, 0, 5}, {11, 3, 1}, {12, 0, 5}},
+	{{0, 0, 10}, {4, 0, 10}, {8, 0, 10}, {1, 0, 4}, {0, 10, 1}, {7, 4, 1}, {6, 0, 4}, {5, 0, 5}, {4, 10, 1}, {7, 0, 4}, {9, 0, 4}, {8, 10, 1}, {11, 1, 1}, {10, 0, 4}, {2, 0, 4}, {11, 0, 1}, {11, 2, 1}, {3, 0, 4}, {6, 4, 1}, {11, 3, 1}, {12, 0, 5}},
+	{{0, 0, 10}, {4, 0, 10}, {8, 0, 10}, {1, 0, 4}, {0, 10, 1}, {10, 4, 1}, {6, 0, 4}, {5, 0, 4}, {4, 10, 1}, {11, 0, 1}, {7, 0, 4}, {9, 0, 5}, {8, 10, 1}, {10, 0, 4}, {2, 0, 4}, {11, 1, 2}, {3, 0, 4}, {11, 4, 1}, {11, 3, 1}, {12, 0, 5}},
+	{{0, 0, 9}, {10, 4, 1}, {4, 0, 9}, {6, 4, 1}, {8, 0, 9}, {11, 4, 1}, {1, 0, 5}, {7, 4, 1}, {6, 0, 4}, {5, 0, 5}, {11, 0, 1}, {7, 0, 4}, {9, 0, 5}, {11, 1, 1}, {10, 0, 4}, {2, 0, 5}, {11, 2, 1}, {3, 0, 5}, {11, 3, 1}, {12, 0, 5}},
+	{{0, 0, 8}, {7, 4, 1}, {10, 4, 1}, {4, 0, 8}, {11, 2, 1}, {6, 4, 1}, {8, 0, 8}, {11, 3, 2}, {1, 0, 6}, {6, 0, 4}, {5, 0, 5}, {11, 0, 1}, {7, 0, 4}, {9, 0, 5}, {11, 1, 1}, {10, 0, 4}, {2, 0, 6}, {3, 0, 6}, {12, 0, 5}},
+	{{0, 0, 8}, {11, 0, 1}, {10, 4, 1}, {4, 0, 8}, {6, 5, 1}, {6, 4, 1}, {8, 0, 8}, {7, 5, 1}, {11, 4, 1}, {1, 0, 5}, {7, 4, 1}, {6, 0, 4}, {5, 0, 6}, {7, 0, 4}, {9, 0, 5}, {11, 1, 1}, {10, 0, 4}, {2, 0, 5}, {11, 2, 1}, {3, 0, 5}, {11, 3, 1}, {12, 0, 5}},
+	{{0, 0, 8}, {11, 1, 1}, {10, 4, 1}, {4, 0, 8}, {10, 5, 1}, {6, 4, 1}, {8, 0, 8}, {11, 5, 1}, {11, 4, 1}, {1, 0, 5}, {7, 4, 1}, {6, 0, 4}, {5, 0, 5}, {11, 0, 1}, {7, 0, 4}, {9, 0, 6}, {10, 0, 4}, {2, 0, 5}, {11, 2, 1}, {3, 0, 5}, {11, 3, 1}, {12, 0, 5}},
+	{{0, 0, 6}, {7, 4, 1}, {11, 0, 2}, {10, 4, 1}, {4, 0, 6}, {6, 5, 1}, {10, 5, 1}, {11, 2, 1}, {6, 4, 1}, {8, 0, 6}, {7, 5, 1}, {11, 3, 1}, {11, 5, 1}, {11, 4, 1}, {1, 0, 6}, {6, 0, 4}, {5, 0, 6}, {7, 0, 4}, {9, 0, 6}, {10, 0, 4}, {2, 0, 6}, {3, 0, 6}, {12, 0, 5}},
+	{{0, 0, 10}, {4, 0, 10}, {8, 0, 10}, {1, 0, 10}, {5, 0, 10}, {9, 0, 10}},
+	{{0, 0, 10}, {4, 0, 10}, {8, 0, 10}, {1, 0, 9}, {0, 10, 1}, {5, 0, 9}, {4, 10, 1}, {9, 0, 9}, {8, 10, 1}},
+	{{0, 0, 10}, {4, 0, 10}, {8, 0, 10}, {1, 0, 8}, {0, 11, 1}, {0, 10, 1}, {5, 0, 8}, {4, 11, 1}, {4, 10, 1}, {9, 0, 8}, {8, 11, 1}, {8, 10, 1}},
+	{{0, 0, 10}, {4, 0, 10}, {8, 0, 10}, {1, 0, 4}, {0, 15, 1}, {0, 14, 1}, {0, 13, 1}, {0, 12, 1}, {0, 11, 1}, {0, 10, 1}, {5, 0, 4}, {4, 15, 1}, {4, 14, 1}, {4, 13, 1}, {4, 12, 1}, {4, 11, 1}, {4, 10, 1}, {9, 0, 4}, {8, 15, 1}, {8, 14, 1}, {8, 13, 1}, {8, 12, 1}, {8, 11, 1}, {8, 10, 1}},
+};
+
+static int SignExtend(int v, uint32 numBits) {
+	return (v & (1 << (numBits - 1))) ? v | ~((1 << numBits) - 1) : v;
+}
+
+static int UnquantizeBC6H(int v, uint32 numBits) {
+	if ( numBits >= 15 || v == 0 )
+		return v;
+	if ( v == (1 << numBits) - 1 )
+		return 0xFFFF;
+	return ((v << 16) + 0x8000) >> numBits;
+}
+
+// Unsigned half floats have no sign bit and nothing above 0x7BFF, so this is the same rebias as for R11G11B10
+static float HalfToFloat(uint32 half) {
+	return std::bit_cast<float>(half << 13) * 5.192296858534828e33f; // 2^112
+}
+
+void DecodeBC6HBlock(const uint8* pBlock, float* pPixels) {
+	BlockBits bits(pBlock);
+	uint32 modeCode = bits.Read(2);
+	if ( modeCode > 1 )
+		modeCode |= bits.Read(3) << 2;
+
+	int modeIndex = BC6HModeIndex[modeCode];
+	if ( modeIndex < 0 ) {
+		// Reserved modes decode to opaque black
+		for ( uint32 i = 0; i < 16; ++i ) {
+			pPixels[i * 4 + 0] = 0.0f;
+			pPixels[i * 4 + 1] = 0.0f;
+			pPixels[i * 4 + 2] = 0.0f;
+			pPixels[i * 4 + 3] = 1.0f;
+		}
+		return;
+	}
+	const BC6HMode& info = BC6HModes[modeIndex];
+
+	int values[13] = {};
+	for ( const BC6HFieldRun& run : BC6HRuns[modeIndex] ) {
+		if ( run.count == 0 )
+			break;
+		values[run.field] |= int(bits.Read(run.count) << run.shift);
+	}
+	uint32 shape = uint32(values[12]);
+
+	// Endpoints A0, B0, A1, B1 of every channel, all but A0 are deltas to A0 in transformed modes
+	uint32 numEndpoints = info.numRegions * 2u;
+	int endpoints[4][3];
+	for ( uint32 c = 0; c < 3; ++c ) {
+		int wrapMask = (1 << info.endpointBits) - 1;
+		for ( uint32 e = 0; e < numEndpoints; ++e ) {
+			int v = values[c * 4 + e];
+			if ( info.transformed && e != 0 )
+				v = (SignExtend(v, info.deltaBits[c]) + values[c * 4]) & wrapMask;
+			endpoints[e][c] = UnquantizeBC6H(v, info.endpointBits);
+		}
+	}
+
+	const uint8* weights = Weights[info.indexBits];
+	for ( uint32 i = 0; i < 16; ++i ) {
+		uint32 index = bits.Read(info.indexBits - (IsAnchor(info.numRegions, shape, i) ? 1u : 0u));
+		const int* e0 = endpoints[GetSubset(info.numRegions, shape, i) * 2];
+		const int* e1 = endpoints[GetSubset(info.numRegions, shape, i) * 2 + 1];
+		int w = weights[index];
+		for ( uint32 c = 0; c < 3; ++c ) {
+			// Scale the interpolated value by 31/64 to the half float range
+			int v = (e0[c] * (64 - w) + e1[c] * w + 32) >> 6;
+			pPixels[i * 4 + c] = HalfToFloat(uint32((v * 31) >> 6));
+		}
+		pPixels[i * 4 + 3] = 1.0f;
+	}
+}
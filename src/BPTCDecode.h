@@ -0,0 +1,10 @@
+#pragma once
+
+#include "Common.h"
+
+// Decodes one 16 byte BC7 block to 16 RGBA8 pixels in row order. Equals DirectX::Decompress to R8G8B8A8_UNORM.
+void DecodeBC7Block(const uint8* pBlock, uint8* pPixels);
+
+// Decodes one 16 byte BC6H_UF16 block to 16 RGBA float pixels in row order, alpha is 1.
+// Equals DirectX::Decompress to R32G32B32A32_FLOAT.
+void DecodeBC6HBlock(const uint8* pBlock, float* pPixels);
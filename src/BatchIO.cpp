@@ -0,0 +1,133 @@
+#include "BatchIO.h"
+
+#include <algorithm>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+
+// Unbuffered reads need sector-aligned offsets, sizes and buffers, 4 KB covers 512e and 4Kn drives
+constexpr uint64 IOAlignment = 4096;
+
+struct BatchReader::Request {
+	std::filesystem::path path;
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	OVERLAPPED overlapped = {};
+	uint64 arenaOffset = 0;
+	uint64 size = 0;
+	bool pending = false;
+	bool done = false;
+	// Neither the overlapped read nor the fallback got any data
+	bool failed = false;
+	std::string_view data;
+	// Holds the data of files read by the blocking fallback
+	std::string fallbackData;
+};
+
+static uint64 AlignUp(uint64 v) {
+	return (v + IOAlignment - 1) & ~(IOAlignment - 1);
+}
+
+BatchReader::BatchReader(bool unbuffered) : m_unbuffered(unbuffered) {}
+
+BatchReader::~BatchReader() {
+	WaitAll();
+	if ( m_pArena )
+		VirtualFree(m_pArena, 0, MEM_RELEASE);
+}
+
+void BatchReader::ReserveArena(uint64 size) {
+	if ( size <= m_arenaSize )
+		return;
+	if ( m_pArena )
+		VirtualFree(m_pArena, 0, MEM_RELEASE);
+
+	// Grows in 16 MB steps, so similar groups reuse the same arena
+	m_arenaSize = std::max<uint64>((size + (16 << 20) - 1) & ~uint64((16 << 20) - 1), 16 << 20);
+	m_pArena = (uint8*)VirtualAlloc(nullptr, m_arenaSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if ( m_pArena == nullptr )
+		m_arenaSize = 0;
+}
+
+void BatchReader::Submit(const std::vector<std::filesystem::path>& vecPaths, const std::vector<uint64>& vecSizes) {
+	WaitAll();
+	m_vecRequests.clear();
+	m_vecRequests.resize(vecPaths.size());
+
+	uint64 arenaSize = 0;
+	for ( uint64 i = 0; i < vecPaths.size(); ++i ) {
+		m_vecRequests[i].arenaOffset = arenaSize;
+		arenaSize += AlignUp(std::max<uint64>(vecSizes[i], 1));
+	}
+	ReserveArena(arenaSize);
+
+	DWORD flags = FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN;
+	if ( m_unbuffered )
+		flags = FILE_FLAG_OVERLAPPED | FILE_FLAG_NO_BUFFERING;
+
+	for ( uint64 i = 0; i < vecPaths.size(); ++i ) {
+		Request& req = m_vecRequests[i];
+		req.path = vecPaths[i];
+		req.size = vecSizes[i];
+
+		// Sizes beyond what one ReadFile call takes, and a failed arena, go to the fallback
+		if ( m_pArena == nullptr || AlignUp(req.size) > 0xFFFFFFFFull )
+			continue;
+
+		req.hFile = CreateFileW(req.path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+		if ( req.hFile == INVALID_HANDLE_VALUE )
+			continue;
+
+		// Without an event, completion is signalled on the file handle, which has this one request only
+		BOOL res = ::ReadFile(req.hFile, m_pArena + req.arenaOffset, DWORD(AlignUp(req.size)), nullptr, &req.overlapped);
+		if ( res || GetLastError() == ERROR_IO_PENDING ) {
+			req.pending = true;
+		} else {
+			CloseHandle(req.hFile);
+			req.hFile = INVALID_HANDLE_VALUE;
+		}
+	}
+}
+
+bool BatchReader::Wait(uint64 index, std::string_view& data) {
+	Request& req = m_vecRequests[index];
+	if ( !req.done ) {
+		req.done = true;
+		bool read = false;
+		if ( req.pending ) {
+			DWORD bytesRead = 0;
+			BOOL res = GetOverlappedResult(req.hFile, &req.overlapped, &bytesRead, TRUE);
+			CloseHandle(req.hFile);
+			req.hFile = INVALID_HANDLE_VALUE;
+			req.pending = false;
+
+			// A file that changed size since the prescan is read again by the fallback
+			if ( res && bytesRead == req.size ) {
+				req.data = std::string_view((const char*)m_pArena + req.arenaOffset, req.size);
+				read = true;
+			}
+		}
+
+		if ( !read ) {
+			++m_numFallbacks;
+			req.fallbackData = ReadFile(req.path);
+			req.data = req.fallbackData;
+		}
+		// Empty files count as failed reads, like everywhere else
+		req.failed = req.data.empty();
+	}
+
+	data = req.data;
+	return !req.failed;
+}
+
+void BatchReader::WaitAll() {
+	for ( Request& req : m_vecRequests ) {
+		if ( req.pending ) {
+			DWORD bytesRead = 0;
+			GetOverlappedResult(req.hFile, &req.overlapped, &bytesRead, TRUE);
+			CloseHandle(req.hFile);
+			req.pending = false;
+		}
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string_view>
+
+#include "Common.h"
+
+/*
+	Reads a group of files with overlapped I/O. All reads are issued by one thread up front, so the
+	device sees them together instead of one at a time per thread. Data lands in one page-aligned arena
+	that is kept between groups, which also satisfies the alignment rules of unbuffered reads.
+	Files that cannot be read this way fall back to a plain blocking read.
+*/
+class BatchReader {
+public:
+	// `unbuffered` reads with FILE_FLAG_NO_BUFFERING, bypassing and not polluting the file cache
+	explicit BatchReader(bool unbuffered);
+	~BatchReader();
+	BatchReader(const BatchReader&) = delete;
+	BatchReader& operator=(const BatchReader&) = delete;
+
+	// Starts reading all files, `vecSizes` are their sizes from the prescan. Waits for any previous group first.
+	void Submit(const std::vector<std::filesystem::path>& vecPaths, const std::vector<uint64>& vecSizes);
+
+	// Blocks until file `index` of the current group was read. Returns false if the fallback read failed as well,
+	// which already reported the error, so the file must not be read again. Empty files fail too.
+	bool Wait(uint64 index, std::string_view& data);
+
+	uint64 GetNumFallbacks() const { return m_numFallbacks; }
+
+private:
+	struct Request;
+
+	void WaitAll();
+	void ReserveArena(uint64 size);
+
+	bool m_unbuffered;
+	uint8* m_pArena = nullptr;
+	uint64 m_arenaSize = 0;
+	std::vector<Request> m_vecRequests;
+	uint64 m_numFallbacks = 0;
+};
@@ -0,0 +1,373 @@
+#include "Bench.h"
+#include "AsyncDecoder.h"
+#include "BCDecode.h"
+#include "Kernels.h"
+#include "Scheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <functional>
+#include <memory>
+#include <random>
+#include <thread>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+
+#include "DirectXTex.h"
+#include "lz4.h"
+
+struct KernelBenchCase {
+	const char* name;
+	uint64 inputBytes;
+	// Runs the currently bound kernel once over the case's input, writing the result to `out`
+	std::function<void(std::vector<uint8>& out)> run;
+};
+
+static std::vector<KernelBenchCase> BuildKernelBenchCases() {
+	constexpr uint64 numValues = 1 << 22;
+
+	auto pSrc16 = std::make_shared<std::vector<uint16>>(numValues * 2);
+	std::mt19937 rng(1234);
+	for ( uint16& v : *pSrc16 )
+		v = uint16(rng());
+
+	std::vector<KernelBenchCase> vecCases;
+	vecCases.push_back({"Narrow16To8 (RG16)", numValues * sizeof(uint16), [pSrc16](std::vector<uint8>& out) {
+		out.resize(numValues);
+		gKernels.Narrow16To8(pSrc16->data(), out.data(), numValues, 1);
+	}});
+	vecCases.push_back({"Narrow16To8 (R16)", numValues * sizeof(uint16) * 2, [pSrc16](std::vector<uint8>& out) {
+		out.resize(numValues);
+		gKernels.Narrow16To8(pSrc16->data(), out.data(), numValues, 2);
+	}});
+
+	auto pSrc32 = std::make_shared<std::vector<uint32>>(numValues);
+	for ( uint32& v : *pSrc32 )
+		v = uint32(rng());
+
+	vecCases.push_back({"UnpackR11G11B10", numValues * sizeof(uint32), [pSrc32](std::vector<uint8>& out) {
+		out.resize(numValues * sizeof(float) * 4);
+		gKernels.UnpackR11G11B10(pSrc32->data(), (float*)out.data(), numValues);
+	}});
+	vecCases.push_back({"TonemapR11G11B10", numValues * sizeof(uint32), [pSrc32](std::vector<uint8>& out) {
+		out.resize(numValues * 4);
+		gKernels.TonemapR11G11B10(pSrc32->data(), out.data(), numValues, 1.0f);
+	}});
+
+	auto pSrcFloat = std::make_shared<std::vector<float>>(numValues * 4);
+	std::uniform_real_distribution<float> hdrRange(0.0f, 16.0f);
+	for ( float& v : *pSrcFloat )
+		v = hdrRange(rng);
+
+	vecCases.push_back({"TonemapRGBAFloat", numValues * sizeof(float) * 4, [pSrcFloat](std::vector<uint8>& out) {
+		out.resize(numValues * 4);
+		gKernels.TonemapRGBAFloat(pSrcFloat->data(), out.data(), numValues, 1.0f);
+	}});
+
+	vecCases.push_back({"RGBAToYCbCr", numValues * 4, [pSrc32](std::vector<uint8>& out) {
+		out.resize(numValues * sizeof(float) * 3);
+		float* pOut = (float*)out.data();
+		gKernels.RGBAToYCbCr((const uint8*)pSrc32->data(), pOut, pOut + numValues, pOut + numValues * 2, numValues);
+	}});
+
+	// Level-shifted samples like the JPEG encoder feeds in, as a plane of 1024 wide rows of blocks
+	constexpr uint64 planeWidth = 1024;
+	auto pSrcPlane = std::make_shared<std::vector<float>>(numValues);
+	for ( float& v : *pSrcPlane )
+		v = float(int(rng() % 256) - 128);
+	auto pScales = std::make_shared<std::vector<float>>(64);
+	for ( uint32 i = 0; i < 64; ++i )
+		(*pScales)[i] = 1.0f / (8.0f * float(1 + i % 16));
+
+	vecCases.push_back({"ForwardDCT8x8", numValues * sizeof(float), [pSrcPlane, pScales](std::vector<uint8>& out) {
+		out.resize(numValues * sizeof(int16_t));
+		for ( uint64 row = 0; row < numValues / planeWidth; row += 8 ) {
+			int16_t* pOut = (int16_t*)out.data() + row * planeWidth;
+			gKernels.ForwardDCT8x8(pSrcPlane->data() + row * planeWidth, planeWidth, planeWidth / 8, pScales->data(), pOut);
+		}
+	}});
+	return vecCases;
+}
+
+// Random BC6H / BC7 blocks. Uniformly random bits would almost only hit the first modes, so every mode is set in turn.
+static std::vector<uint8> MakeBPTCBlocks(TCOLayout layout, uint64 numBlocks) {
+	static constexpr uint8 BC6HModeCodes[] = {0x00, 0x01, 0x02, 0x06, 0x0A, 0x0E, 0x12, 0x16, 0x1A, 0x1E, 0x03, 0x07, 0x0B, 0x0F, 0x13};
+
+	std::vector<uint8> vecBlocks(numBlocks * 16);
+	std::mt19937 rng(4321);
+	for ( uint8& v : vecBlocks )
+		v = uint8(rng());
+
+	for ( uint64 i = 0; i < numBlocks; ++i ) {
+		uint8& first = vecBlocks[i * 16];
+		if ( layout == TCOLayout::BC7 ) {
+			uint32 modeBit = 1u << (i % 8);
+			first = uint8((first & ~(modeBit * 2 - 1)) | modeBit);
+		} else {
+			uint8 code = BC6HModeCodes[i % std::size(BC6HModeCodes)];
+			first = uint8(code < 2 ? (first & ~0x3) | code : (first & ~0x1F) | code);
+		}
+	}
+	return vecBlocks;
+}
+
+// Times DecodeBCRows() on BC6H and BC7 against DirectXTex, and checks that both give the same pixels
+static int RunBPTCBench(int numRuns) {
+	constexpr uint32 width = 1024;
+	constexpr uint32 height = 1024;
+	constexpr uint64 blockRowPitch = (width / 4) * 16;
+
+	int numMismatches = 0;
+	for ( TCOLayout layout : {TCOLayout::BC7, TCOLayout::BC6H} ) {
+		bool isHDR = layout == TCOLayout::BC6H;
+		std::vector<uint8> vecBlocks = MakeBPTCBlocks(layout, uint64(width / 4) * (height / 4));
+
+		DirectX::Image cImage;
+		cImage.width = width;
+		cImage.height = height;
+		cImage.format = isHDR ? DXGI_FORMAT_BC6H_UF16 : DXGI_FORMAT_BC7_UNORM;
+		cImage.rowPitch = blockRowPitch;
+		cImage.slicePitch = blockRowPitch * (height / 4);
+		cImage.pixels = vecBlocks.data();
+
+		DirectX::ScratchImage resImage;
+		double dxSeconds = 1e30;
+		for ( int run = 0; run < numRuns; ++run ) {
+			auto start = std::chrono::steady_clock::now();
+			if ( FAILED(DirectX::Decompress(cImage, isHDR ? DXGI_FORMAT_R32G32B32A32_FLOAT : DXGI_FORMAT_R8G8B8A8_UNORM, resImage)) ) {
+				Print(std::format("\n{} decode: DirectXTex failed", ToString(layout)));
+				return numMismatches + 1;
+			}
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			dxSeconds = std::min(dxSeconds, elapsed.count());
+		}
+
+		std::vector<uint8> vecPixels(uint64(width) * height * 4);
+		std::vector<float> vecHDR(isHDR ? uint64(width) * height * 4 : 0);
+		double ownSeconds = 1e30;
+		for ( int run = 0; run < numRuns; ++run ) {
+			ConstantColor constant;
+			auto start = std::chrono::steady_clock::now();
+			DecodeBCRows(layout, vecBlocks.data(), blockRowPitch, width, height, vecPixels.data(), uint64(width) * 4, constant, isHDR ? vecHDR.data() : nullptr);
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			ownSeconds = std::min(ownSeconds, elapsed.count());
+		}
+
+		// DirectXTex has no float to 8 bit tone-mapping, so BC6H is compared on the floats
+		const DirectX::Image* pRes = resImage.GetImage(0, 0, 0);
+		const void* pOwn = isHDR ? (const void*)vecHDR.data() : (const void*)vecPixels.data();
+		bool match = true;
+		for ( uint32 y = 0; y < height && match; ++y )
+			match = std::memcmp(pRes->pixels + y * pRes->rowPitch, (const uint8*)pOwn + uint64(y) * width * (isHDR ? 16 : 4), width * (isHDR ? 16 : 4)) == 0;
+		if ( !match )
+			++numMismatches;
+
+		double megabytes = double(vecBlocks.size()) / (1024.0 * 1024.0);
+		Print(std::format("\n{} decode:", ToString(layout)));
+		Print(std::format("  {:<10} {:>10.1f} MB/s", "DirectXTex", megabytes / dxSeconds));
+		Print(std::format("  {:<10} {:>10.1f} MB/s  {}", "integer", megabytes / ownSeconds, match ? "OK" : "MISMATCH"));
+	}
+	return numMismatches;
+}
+
+int RunKernelBench() {
+	constexpr int numRuns = 10;
+
+	CpuLevel detected = GetDetectedCpuLevel();
+	Print(std::format("Detected CPU level: {}", ToString(detected)));
+
+	int numMismatches = 0;
+	for ( KernelBenchCase& bench : BuildKernelBenchCases() ) {
+		Print(std::format("\n{}:", bench.name));
+
+		std::vector<uint8> vecReference;
+		BindKernels(CpuLevel::Scalar);
+		bench.run(vecReference);
+
+		for ( int i = int(CpuLevel::Scalar); i <= int(detected); ++i ) {
+			CpuLevel level = CpuLevel(i);
+			BindKernels(level);
+
+			std::vector<uint8> vecOut;
+			double bestSeconds = 1e30;
+			for ( int run = 0; run < numRuns; ++run ) {
+				auto start = std::chrono::steady_clock::now();
+				bench.run(vecOut);
+				std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+				bestSeconds = std::min(bestSeconds, elapsed.count());
+			}
+
+			bool match = vecOut == vecReference;
+			if ( !match )
+				++numMismatches;
+
+			Print(std::format(
+				"  {:<8} {:>10.1f} MB/s  {}",
+				ToString(level), (bench.inputBytes / bestSeconds) / (1024.0 * 1024.0), match ? "OK" : "MISMATCH"
+			));
+		}
+	}
+
+	BindKernels(GetActiveCpuLevel());
+	numMismatches += RunBPTCBench(numRuns);
+	return numMismatches;
+}
+
+// An RGBA8 TCO file of smooth gradients with some noise, which compresses about as well as real textures
+static std::vector<char> MakeTCOFile(uint32 width, uint32 height, uint32 seed) {
+	std::mt19937 rng(seed);
+	std::vector<uint8> vecPixels(uint64(width) * height * 4);
+	for ( uint32 y = 0; y < height; ++y ) {
+		for ( uint32 x = 0; x < width; ++x ) {
+			uint8* pPixel = &vecPixels[(uint64(y) * width + x) * 4];
+			pPixel[0] = uint8(x + seed + rng() % 4);
+			pPixel[1] = uint8(y + rng() % 4);
+			pPixel[2] = uint8((x + y) / 2);
+			pPixel[3] = 0xFF;
+		}
+	}
+
+	CompressedDataHeader compHeader = {};
+	compHeader.flag = 0x4;
+	compHeader.dataHeaderSize = sizeof(TCOHeader);
+	compHeader.decompressedSize = uint32(vecPixels.size());
+
+	TCOHeader tcoHeader = {};
+	tcoHeader.width = width;
+	tcoHeader.height = height;
+	tcoHeader.layout = TCOLayout::RGBA8;
+	tcoHeader.numMips = 1;
+
+	std::vector<char> vecFile(TCOPayloadOffset + LZ4_compressBound(int(vecPixels.size())));
+	int compSize = LZ4_compress_default((const char*)vecPixels.data(), vecFile.data() + TCOPayloadOffset, int(vecPixels.size()), int(vecFile.size() - TCOPayloadOffset));
+	compHeader.compressedSize = uint32(compSize);
+	std::memcpy(vecFile.data(), &compHeader, sizeof(compHeader));
+	std::memcpy(vecFile.data() + sizeof(compHeader), &tcoHeader, sizeof(tcoHeader));
+	vecFile.resize(TCOPayloadOffset + compSize);
+	return vecFile;
+}
+
+static DecodeJob MakeMemoryJob(const std::vector<char>& vecFile) {
+	DecodeJob job;
+	job.data = std::span<const char>(vecFile.data(), vecFile.size());
+	return job;
+}
+
+int RunAsyncBench() {
+	constexpr uint32 numFiles = 64;
+	constexpr uint32 size = 512;
+	// File, payload and pixels, as AsyncDecoder::EstimateCost() charges them
+	constexpr uint64 rawSize = uint64(size) * size * 4;
+
+	std::vector<std::vector<char>> vecFiles(numFiles);
+	ParallelFor(numFiles, [&](uint64 i) {
+		vecFiles[i] = MakeTCOFile(size, size, uint32(i));
+	});
+	uint64 jobCost = vecFiles[0].size() + 2 * rawSize;
+
+	int numFailed = 0;
+	auto check = [&numFailed](bool ok, const std::string& what) {
+		Print(std::format("  {:<56} {}", what, ok ? "OK" : "FAILED"));
+		numFailed += !ok;
+	};
+
+	// Throughput with a budget of a few jobs, the in-flight bytes must never exceed it
+	{
+		uint32 numThreads = GetNumThreads();
+		uint64 budget = jobCost * 4;
+		Print(std::format("\nBackpressure: {} files of {}x{} RGBA8 on {} threads, budget of 4 jobs:", numFiles, size, size, numThreads));
+
+		AsyncDecoder decoder(numThreads, budget);
+		std::vector<DecodeTicket> vecTickets;
+		uint64 peakBytes = 0;
+		auto start = std::chrono::steady_clock::now();
+		for ( const std::vector<char>& vecFile : vecFiles ) {
+			DecodeJob job = MakeMemoryJob(vecFile);
+			job.keepImage = true;
+			vecTickets.push_back(decoder.Submit(std::move(job)));
+			peakBytes = std::max(peakBytes, decoder.GetInFlightBytes());
+		}
+
+		uint32 numSucceeded = 0;
+		for ( DecodeTicket& ticket : vecTickets ) {
+			DecodeResult result = ticket.future.get();
+			numSucceeded += result.success && result.image.width == size && result.image.height == size && result.image.pPixels;
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		Print(std::format("  {:.1f} files/s, {:.1f} MB/s decoded", numFiles / seconds, (numFiles * rawSize / seconds) / (1024.0 * 1024.0)));
+		check(numSucceeded == numFiles, std::format("{} of {} jobs decoded", numSucceeded, numFiles));
+		check(peakBytes <= budget, std::format("peak in flight {:.1f} of {:.1f} MB", peakBytes / (1024.0 * 1024.0), budget / (1024.0 * 1024.0)));
+		decoder.WaitIdle();
+		check(decoder.GetInFlightBytes() == 0, "no bytes in flight once idle");
+	}
+
+	// Every other job is cancelled while the single worker is busy with the first ones
+	{
+		Print("\nCancellation, 1 thread:");
+		AsyncDecoder decoder(1, UINT64_MAX);
+		std::atomic<uint32> numCallbacks = 0;
+		std::vector<DecodeTicket> vecTickets;
+		for ( const std::vector<char>& vecFile : vecFiles )
+			vecTickets.push_back(decoder.Submit(MakeMemoryJob(vecFile), [&numCallbacks](const DecodeResult&) { ++numCallbacks; }));
+
+		for ( uint64 i = 1; i < vecTickets.size(); i += 2 )
+			decoder.Cancel(vecTickets[i].id);
+		decoder.WaitIdle();
+
+		uint32 numCancelled = 0;
+		bool consistent = true;
+		for ( uint64 i = 0; i < vecTickets.size(); ++i ) {
+			DecodeResult result = vecTickets[i].future.get();
+			numCancelled += result.cancelled;
+			// A cancel can lose the race against the worker, the job then finished normally
+			consistent &= i % 2 == 0 ? result.success : result.success != result.cancelled;
+		}
+		check(consistent, std::format("{} of {} cancel requests took effect, the rest finished", numCancelled, numFiles / 2));
+		check(numCallbacks == numFiles, "every job ran its callback");
+		check(!decoder.Cancel(vecTickets[0].id), "cancelling a completed job is refused");
+		check(decoder.GetInFlightBytes() == 0, "no bytes in flight once idle");
+	}
+
+	// Callbacks submit a second stage while the caller keeps the budget of one job full
+	{
+		Print("\nChained submission from callbacks, 1 thread, budget of 1 job:");
+		AsyncDecoder decoder(1, jobCost);
+		std::atomic<uint32> numSecondStage = 0;
+		std::vector<DecodeTicket> vecTickets;
+
+		// A deadlock would hang Submit() and the destructor, so this side polls with a timeout instead
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+		bool finished = true;
+		for ( uint64 i = 0; i < vecFiles.size() && finished; ++i ) {
+			const std::vector<char>& vecFile = vecFiles[i];
+			auto submitNext = [&decoder, &vecFile, &numSecondStage](const DecodeResult& result) {
+				if ( result.success )
+					decoder.Submit(MakeMemoryJob(vecFile), [&numSecondStage](const DecodeResult& next) { numSecondStage += next.success; });
+			};
+
+			DecodeJob job = MakeMemoryJob(vecFile);
+			DecodeTicket& ticket = vecTickets.emplace_back();
+			while ( !decoder.TrySubmit(job, ticket, submitNext) && finished ) {
+				finished = std::chrono::steady_clock::now() < deadline;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+		for ( DecodeTicket& ticket : vecTickets )
+			finished = finished && ticket.future.wait_until(deadline) == std::future_status::ready;
+		if ( !finished ) {
+			check(false, "first stage completed");
+			Print("The decoder deadlocked, exiting");
+			ExitProcess(1);
+		}
+		decoder.WaitIdle();
+		check(numSecondStage == numFiles, std::format("{} of {} second stage jobs decoded", numSecondStage.load(), numFiles));
+	}
+
+	Print(numFailed == 0 ? "\nAll checks passed" : std::format("\n{} checks failed", numFailed));
+	return numFailed;
+}
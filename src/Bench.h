@@ -0,0 +1,11 @@
+#pragma once
+
+// Runs every kernel in gKernels at each CPU level up to the detected one.
+// Outputs are compared against the scalar implementation, so this doubles as a kernel self-test.
+// Returns the number of kernels whose output did not match.
+int RunKernelBench();
+
+// Runs the AsyncDecoder over synthetic in-memory TCO files and checks its contract: the in-flight budget is never
+// exceeded, cancelled jobs complete as cancelled or finished, and callbacks can submit follow-up jobs on a single
+// thread without deadlocking. Returns the number of failed checks.
+int RunAsyncBench();
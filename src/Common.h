@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#define CHECKSZ(t, s) static_assert(sizeof(t) == s)
+
+using uint64 = uint64_t;
+using uint32 = uint32_t;
+using uint16 = uint16_t;
+using uint8 = uint8_t;
+
+std::string ReadFile(const std::filesystem::path& p);
+void Print(const std::string& str);
+void LogError(const std::string& fname, const std::string& str);
@@ -0,0 +1,96 @@
+#include "CpuDispatch.h"
+#include "Kernels.h"
+
+#include <format>
+
+#include <intrin.h>
+
+static CpuLevel gDetectedLevel = CpuLevel::Scalar;
+static CpuLevel gActiveLevel = CpuLevel::Scalar;
+
+const char* ToString(CpuLevel level) {
+	switch(level) {
+		case CpuLevel::Scalar:
+			return "scalar";
+		case CpuLevel::SSE2:
+			return "sse2";
+		case CpuLevel::SSE41:
+			return "sse41";
+		case CpuLevel::AVX2:
+			return "avx2";
+		case CpuLevel::AVX512:
+			return "avx512";
+		default:
+			return "ERROR";
+	}
+}
+
+bool ParseCpuLevel(std::string_view str, CpuLevel& level) {
+	for ( int i = int(CpuLevel::Scalar); i <= int(CpuLevel::AVX512); ++i ) {
+		if ( str == ToString(CpuLevel(i)) ) {
+			level = CpuLevel(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+CpuLevel DetectCpuLevel() {
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	// The OS has to save the upper register halves on context switches, otherwise AVX is unusable
+	uint64 xcr0 = osxsave ? _xgetbv(0) : 0;
+	bool ymmState = (xcr0 & 0x6) == 0x6;
+	bool zmmState = (xcr0 & 0xE6) == 0xE6;
+
+	bool avx2 = false;
+	bool avx512 = false;
+	if ( maxLeaf >= 7 ) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+		bool avx512f = (info[1] & (1 << 16)) != 0;
+		bool avx512bw = (info[1] & (1 << 30)) != 0;
+		bool avx512vl = (info[1] & (1 << 31)) != 0;
+		avx512 = avx512f && avx512bw && avx512vl;
+	}
+
+	if ( avx512 && avx2 && avx && ymmState && zmmState )
+		return CpuLevel::AVX512;
+	if ( avx2 && avx && ymmState )
+		return CpuLevel::AVX2;
+	if ( sse41 )
+		return CpuLevel::SSE41;
+	if ( sse2 )
+		return CpuLevel::SSE2;
+	return CpuLevel::Scalar;
+}
+
+void InitCpuDispatch(const CpuLevel* forced) {
+	gDetectedLevel = DetectCpuLevel();
+	gActiveLevel = gDetectedLevel;
+
+	if ( forced != nullptr ) {
+		if ( *forced > gDetectedLevel )
+			Print(std::format("CPU level '{}' is not supported on this machine, using '{}'", ToString(*forced), ToString(gDetectedLevel)));
+		else
+			gActiveLevel = *forced;
+	}
+
+	BindKernels(gActiveLevel);
+}
+
+CpuLevel GetDetectedCpuLevel() {
+	return gDetectedLevel;
+}
+
+CpuLevel GetActiveCpuLevel() {
+	return gActiveLevel;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string_view>
+
+#include "Common.h"
+
+// Ordered so that every level implies support for all levels below it
+enum class CpuLevel : int {
+	Scalar, SSE2, SSE41, AVX2, AVX512
+};
+
+const char* ToString(CpuLevel level);
+bool ParseCpuLevel(std::string_view str, CpuLevel& level);
+
+// Highest level supported by both the CPU and the OS (XSAVE state for YMM/ZMM registers)
+CpuLevel DetectCpuLevel();
+
+// Detects the CPU level once and binds all kernels for it.
+// If `forced` is given, kernels are bound for that level instead, clamped to what the CPU supports.
+void InitCpuDispatch(const CpuLevel* forced = nullptr);
+CpuLevel GetDetectedCpuLevel();
+CpuLevel GetActiveCpuLevel();
@@ -0,0 +1,375 @@
+#include "Decoder.h"
+#include "BCDecode.h"
+#include "Kernels.h"
+#include "LZ4Stream.h"
+#include "Options.h"
+
+#include <algorithm>
+#include <cmath>
+#include <format>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+
+#include "lz4.h"
+
+static void DecompressBC(const std::string& fName, uint8* source, uint64 sourceSize, uint8*& dst, uint32& numChannels, const TCOHeader& header, DecodedImage& img);
+static bool DecodeBCFused(const std::string& fName, const char* data, uint64 size, const CompressedDataHeader& compHeader, const TCOHeader& tcoHeader, DecodedImage& img);
+
+// Output bytes decoded per step by the fused path, sized to stay resident in L2 together with the block data
+constexpr uint64 FusedChunkBytes = 256 * 1024;
+
+const char* ToString(R11G11B10Encoding encoding) {
+	switch(encoding) {
+		case R11G11B10Encoding::RGBA8:
+			return "rgba8";
+		case R11G11B10Encoding::PackedFloat:
+			return "float";
+		default:
+			return "ERROR";
+	}
+}
+
+bool ParseR11G11B10Encoding(std::string_view str, R11G11B10Encoding& encoding) {
+	for ( int i = int(R11G11B10Encoding::RGBA8); i <= int(R11G11B10Encoding::PackedFloat); ++i ) {
+		if ( str == ToString(R11G11B10Encoding(i)) ) {
+			encoding = R11G11B10Encoding(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+static float Float11ToFloat(uint32 bits) {
+	uint32 exponent = (bits >> 6) & 0x1F;
+	float mantissa = float(bits & 0x3F) / 64.0f;
+	return exponent == 0 ? std::ldexp(mantissa, -14) : std::ldexp(1.0f + mantissa, int(exponent) - 15);
+}
+
+static float RelativeDiff(float a, float b) {
+	return std::abs(a - b) / (a + b + 1e-6f);
+}
+
+/*
+	Both encodings take 4 bytes per pixel, so the payload size cannot tell them apart. Two heuristics do:
+	- An all-ones exponent (Inf/NaN) practically never occurs in real float data, while RGBA8 hits it in the
+	  blue channel for every opaque pixel (alpha 0xFF), and at random in roughly every 11th other pixel.
+	- Neighbouring pixels are similar in the right interpretation. Read the wrong way, the bit fields cut
+	  across channels and neighbours look like noise.
+	Only a sample of mip 0 is looked at.
+*/
+R11G11B10Encoding DetectR11G11B10Encoding(const char* payload, uint64 size, const TCOHeader& tcoHeader) {
+	if ( gOptions.forceR11G11B10 )
+		return gOptions.r11g11b10Encoding;
+
+	uint32 width = tcoHeader.width;
+	uint32 height = tcoHeader.height;
+	if ( width < 2 || size < uint64(width) * height * 4 )
+		return R11G11B10Encoding::RGBA8;
+
+	constexpr uint32 maxSamplesPerAxis = 256;
+	uint32 rowStep = std::max(height / maxSamplesPerAxis, 1u);
+	uint32 colStep = std::max((width - 1) / maxSamplesPerAxis, 1u);
+
+	uint64 numSamples = 0;
+	uint64 numSpecial = 0;
+	double floatDiff = 0.0;
+	double byteDiff = 0.0;
+	for ( uint32 y = 0; y < height; y += rowStep ) {
+		const uint32* pRow = (const uint32*)payload + uint64(y) * width;
+		for ( uint32 x = 0; x + 1 < width; x += colStep ) {
+			uint32 a = pRow[x];
+			uint32 b = pRow[x + 1];
+			if ( a == 0 && b == 0 )
+				continue;
+			++numSamples;
+
+			// Exponents are the top 5 bits of each channel
+			if ( ((a >> 6) & 0x1F) == 0x1F || ((a >> 17) & 0x1F) == 0x1F || ((a >> 27) & 0x1F) == 0x1F )
+				++numSpecial;
+
+			floatDiff += RelativeDiff(Float11ToFloat(a), Float11ToFloat(b));
+			floatDiff += RelativeDiff(Float11ToFloat(a >> 11), Float11ToFloat(b >> 11));
+			floatDiff += RelativeDiff(Float11ToFloat((a >> 22) << 1), Float11ToFloat((b >> 22) << 1));
+			for ( uint32 shift = 0; shift < 24; shift += 8 )
+				byteDiff += RelativeDiff(float((a >> shift) & 0xFF), float((b >> shift) & 0xFF));
+		}
+	}
+
+	if ( numSamples == 0 || numSpecial * 1000 > numSamples || floatDiff >= byteDiff )
+		return R11G11B10Encoding::RGBA8;
+	return R11G11B10Encoding::PackedFloat;
+}
+
+bool DecompressPayload(const std::string& fName, const char* data, uint64 size, const CompressedDataHeader& compHeader, std::unique_ptr<char[]>& pPayload, uint64 targetSize) {
+	if ( TCOPayloadOffset + compHeader.compressedSize > size ) {
+		LogError(fName, "Compressed size exceeds the file size");
+		return false;
+	}
+
+	const char* pData = data + TCOPayloadOffset;
+	if ( targetSize == 0 || targetSize >= compHeader.decompressedSize ) {
+		pPayload.reset(new char[compHeader.decompressedSize]);
+
+		int res = LZ4_decompress_safe(pData, pPayload.get(), compHeader.compressedSize, compHeader.decompressedSize);
+		if ( res <= 0 ) {
+			pPayload.reset();
+			LogError(fName, "Failed to decompress file data");
+			return false;
+		}
+		return true;
+	}
+
+	pPayload.reset(new char[targetSize]);
+
+	int res = LZ4_decompress_safe_partial(pData, pPayload.get(), compHeader.compressedSize, int(targetSize), int(targetSize));
+	if ( res < int(targetSize) ) {
+		pPayload.reset();
+		LogError(fName, "Failed to decompress file data");
+		return false;
+	}
+	return true;
+}
+
+bool DecodeTCO(const std::string& fName, const char* data, uint64 size, const CompressedDataHeader& compHeader, const TCOHeader& tcoHeader, DecodedImage& img) {
+	if ( gOptions.fusedDecode && IsBCLayout(tcoHeader.layout) )
+		return DecodeBCFused(fName, data, size, compHeader, tcoHeader, img);
+
+	// Only mip 0 is decoded, so the LZ4 stream can stop where mip 1 begins
+	uint64 payloadSize = GetMipChainSize(tcoHeader, 1);
+	if ( payloadSize == 0 || payloadSize > compHeader.decompressedSize )
+		payloadSize = compHeader.decompressedSize;
+
+	std::unique_ptr<char[]> pPayload;
+	if ( !DecompressPayload(fName, data, size, compHeader, pPayload, payloadSize) )
+		return false;
+
+	return DecodePayload(fName, std::move(pPayload), payloadSize, tcoHeader, img);
+}
+
+bool DecodePayload(const std::string& fName, std::unique_ptr<char[]> pPayload, uint64 payloadSize, const TCOHeader& tcoHeader, DecodedImage& img) {
+	char* pDecData = pPayload.release();
+	char* pDecDataEnd = pDecData + payloadSize;
+
+	uint8* p8BitData = nullptr;
+	uint32 numChannels = 0;
+
+	switch( tcoHeader.layout ) {
+		case TCOLayout::BC1:
+		case TCOLayout::BC2:
+		case TCOLayout::BC3:
+		case TCOLayout::BC4:
+		case TCOLayout::BC5:
+		case TCOLayout::BC6H:
+		case TCOLayout::BC7:
+			DecompressBC(fName, (uint8*)pDecData, payloadSize, p8BitData, numChannels, tcoHeader, img);
+			break;
+		case TCOLayout::R11G11B10: {
+			numChannels = 4;
+			// Both encodings read 4 bytes for every pixel of mip 0
+			if ( payloadSize < uint64(tcoHeader.width) * tcoHeader.height * 4 ) {
+				LogError(fName, std::format("Payload of {} bytes is too small for a {}x{} R11G11B10 image", payloadSize, tcoHeader.width, tcoHeader.height));
+				break;
+			}
+			if ( DetectR11G11B10Encoding(pDecData, payloadSize, tcoHeader) == R11G11B10Encoding::RGBA8 ) {
+				// It claims to be R11G11B10 but the actual data is just standard RGBA - wtf?
+				p8BitData = (uint8*)pDecData;
+				break;
+			}
+
+			// Genuine packed floats, tone-mapped for the 8 bit outputs and kept as floats for HDR output
+			uint64 numPixels = uint64(tcoHeader.width) * tcoHeader.height;
+			p8BitData = new uint8[numPixels * numChannels];
+			gKernels.TonemapR11G11B10((const uint32*)pDecData, p8BitData, numPixels, gOptions.exposure);
+			img.pHDR.reset(new float[numPixels * 4]);
+			gKernels.UnpackR11G11B10((const uint32*)pDecData, img.pHDR.get(), numPixels);
+			break;
+		}
+		case TCOLayout::RGBA8: {
+			numChannels = 4;
+			p8BitData = (uint8*)pDecData;
+			break;
+		}
+		case TCOLayout::RG16: {
+			numChannels = 2;
+			uint64 numPixels = uint64(tcoHeader.width) * tcoHeader.height;
+			p8BitData = new uint8[numPixels * numChannels];
+
+			// Only mip 0 is written out, the remaining mips would overrun the output buffer
+			uint64 numValues = std::min(numPixels * numChannels, uint64(pDecDataEnd - pDecData) / sizeof(uint16));
+			gKernels.Narrow16To8((uint16*)pDecData, p8BitData, numValues, 1);
+			break;
+		}
+		case TCOLayout::R16: {
+			numChannels = 1;
+			uint64 numPixels = uint64(tcoHeader.width) * tcoHeader.height;
+			p8BitData = new uint8[numPixels * numChannels];
+
+			// Each pixel occupies 2 values, only the first one is used
+			numPixels = std::min(numPixels, uint64(pDecDataEnd - pDecData) / (sizeof(uint16) * 2));
+			gKernels.Narrow16To8((uint16*)pDecData, p8BitData, numPixels, 2);
+			break;
+		}
+		case TCOLayout::R32: {
+			numChannels = 1;
+			p8BitData = new uint8[(tcoHeader.width * tcoHeader.height) * numChannels];
+
+			uint32 i = 0;
+			for ( uint16* pPix = (uint16*)pDecData; pPix != (uint16*)pDecDataEnd; pPix += 2 ) {
+				p8BitData[i] = uint8((float(*pPix) / UINT_MAX) * UINT8_MAX);
+				++i;
+			}
+			break;
+		}
+		case TCOLayout::R32G8: {
+			numChannels = 2;
+			p8BitData = new uint8[(tcoHeader.width * tcoHeader.height) * numChannels];
+
+			uint32 i = 0;
+			uint8* pPixel = (uint8*)pDecData;
+			while( pPixel != (uint8*)pDecDataEnd ) {
+				uint16 red = *(uint16*)pPixel;
+				uint8 green = *(uint8*)(pPixel + sizeof(uint16));
+				pPixel += 0x3;
+				p8BitData[i * 2 + 0] = uint8((float(red) / UINT16_MAX) * UINT8_MAX);
+				p8BitData[i * 2 + 1] = green;
+				++i;
+			}
+
+			break;
+		}
+		case TCOLayout::R24G8: {
+			numChannels = 2;
+			p8BitData = new uint8[(tcoHeader.width * tcoHeader.height) * numChannels];
+
+			uint32 i = 0;
+			uint32* pPixel = (uint32*)pDecData;
+			while ( pPixel != (uint32*)pDecDataEnd ) {
+				uint32 pix = *pPixel;
+				uint32 red = pix & 0xFFFFFF00;
+				uint8 green = (pix << 0x18) & 0xFF;
+
+				pPixel += 0x3;
+				p8BitData[i * 2 + 0] = uint8((float(red) / 0xFFFFFF00) * UINT8_MAX);
+				p8BitData[i * 2 + 1] = green;
+				++i;
+			}
+
+			break;
+		}
+		case TCOLayout::R8: {
+			numChannels = 1;
+			p8BitData = (uint8*)pDecData;
+			break;
+		}
+		default:
+			delete[] pDecData;
+			LogError(fName, std::format("TCO Layout ({}) is not currently supported", int(tcoHeader.layout)));
+			return false;
+	}
+
+	if ( p8BitData == nullptr ) {
+		delete[] pDecData;
+		return false;
+	}
+
+	if ( p8BitData != (uint8*)pDecData )
+		delete[] pDecData;
+
+	img.width = tcoHeader.width;
+	img.height = tcoHeader.height;
+	img.numChannels = numChannels;
+	img.flipV = tcoHeader.flipV;
+	img.pPixels.reset(p8BitData);
+	return true;
+}
+
+static void DecompressBC(const std::string& fName, uint8* source, uint64 sourceSize, uint8*& dst, uint32& numChannels, const TCOHeader& header, DecodedImage& img) {
+	dst = nullptr;
+	numChannels = GetBCNumChannels(header.layout);
+
+	uint64 blockRowBytes = ((uint64(header.width) + 3) / 4) * GetBCBlockBytes(header.layout);
+	if ( blockRowBytes * ((uint64(header.height) + 3) / 4) > sourceSize ) {
+		LogError(fName, "Payload is smaller than mip 0");
+		return;
+	}
+
+	uint64 rowBytes = uint64(header.width) * numChannels;
+	uint8* p8BitData = new uint8[rowBytes * header.height];
+
+	// BC6H is HDR, kept as floats like R11G11B10
+	if ( header.layout == TCOLayout::BC6H )
+		img.pHDR.reset(new float[uint64(header.width) * header.height * 4]);
+
+	ConstantColor constant;
+	if ( !DecodeBCRows(header.layout, source, blockRowBytes, header.width, header.height, p8BitData, rowBytes, constant, img.pHDR.get()) ) {
+		delete[] p8BitData;
+		img.pHDR.reset();
+		LogError(fName, "Failed to decompress image data");
+		return;
+	}
+
+	img.isConstant = constant.isConstant;
+	dst = p8BitData;
+}
+
+// Instead of LZ4-decoding the whole payload and then streaming through it again for the BC decode,
+// complete block rows are block-decoded right after the LZ4 stream produced them, while still in cache.
+// Only mip 0 is needed, so decoding stops there.
+static bool DecodeBCFused(const std::string& fName, const char* data, uint64 size, const CompressedDataHeader& compHeader, const TCOHeader& tcoHeader, DecodedImage& img) {
+	if ( TCOPayloadOffset + compHeader.compressedSize > size ) {
+		LogError(fName, "Compressed size exceeds the file size");
+		return false;
+	}
+
+	uint32 numChannels = GetBCNumChannels(tcoHeader.layout);
+	uint64 blockBytes = GetBCBlockBytes(tcoHeader.layout);
+	uint64 blockRowBytes = ((uint64(tcoHeader.width) + 3) / 4) * blockBytes;
+	uint64 numBlockRows = (uint64(tcoHeader.height) + 3) / 4;
+	uint64 mip0Size = blockRowBytes * numBlockRows;
+	if ( mip0Size == 0 || mip0Size > compHeader.decompressedSize ) {
+		LogError(fName, "Payload is smaller than mip 0");
+		return false;
+	}
+
+	uint64 blockRowsPerChunk = std::max<uint64>(FusedChunkBytes / blockRowBytes, 1);
+	LZ4BlockStream stream(data + TCOPayloadOffset, compHeader.compressedSize, mip0Size, blockRowsPerChunk * blockRowBytes);
+
+	uint64 outRowBytes = uint64(tcoHeader.width) * numChannels;
+	std::unique_ptr<uint8[]> pPixels(new uint8[outRowBytes * tcoHeader.height]);
+	std::unique_ptr<float[]> pHDR;
+	if ( tcoHeader.layout == TCOLayout::BC6H )
+		pHDR.reset(new float[uint64(tcoHeader.width) * tcoHeader.height * 4]);
+
+	ConstantColor constant;
+	uint32 y = 0;
+	while ( !stream.IsDone() ) {
+		const uint8* pChunk = nullptr;
+		uint64 chunkSize = 0;
+		if ( !stream.Next(pChunk, chunkSize) ) {
+			LogError(fName, "Failed to decompress file data");
+			return false;
+		}
+
+		// Chunks always hold whole block rows, mip0Size is a multiple of the chunk size except for the last one
+		uint32 chunkBlockRows = uint32(chunkSize / blockRowBytes);
+
+		uint32 numRows = std::min(chunkBlockRows * 4, tcoHeader.height - y);
+		float* pHDRRows = pHDR ? pHDR.get() + uint64(y) * tcoHeader.width * 4 : nullptr;
+		if ( !DecodeBCRows(tcoHeader.layout, pChunk, blockRowBytes, tcoHeader.width, numRows, pPixels.get() + y * outRowBytes, outRowBytes, constant, pHDRRows) ) {
+			LogError(fName, "Failed to decompress image data");
+			return false;
+		}
+		y += numRows;
+	}
+
+	img.width = tcoHeader.width;
+	img.height = tcoHeader.height;
+	img.numChannels = numChannels;
+	img.flipV = tcoHeader.flipV;
+	img.isConstant = constant.isConstant;
+	img.pPixels = std::move(pPixels);
+	img.pHDR = std::move(pHDR);
+	return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+
+#include "Common.h"
+#include "TCO.h"
+
+// Mip 0 of a texture, converted to 8 bits per channel
+struct DecodedImage {
+	uint32 width = 0;
+	uint32 height = 0;
+	uint32 numChannels = 0;
+	bool flipV = false;
+	// Every pixel has the same value (only detected for BC layouts), such images can be stored tiny or deduplicated
+	bool isConstant = false;
+	std::unique_ptr<uint8[]> pPixels;
+	// RGBA float copy of the pixels for sources with a higher range than 8 bits, otherwise null
+	std::unique_ptr<float[]> pHDR;
+};
+
+// How the payload of an R11G11B10 texture is really stored
+enum class R11G11B10Encoding {
+	RGBA8, PackedFloat
+};
+
+const char* ToString(R11G11B10Encoding encoding);
+bool ParseR11G11B10Encoding(std::string_view str, R11G11B10Encoding& encoding);
+
+// Tells the two encodings apart from a sample of mip 0, unless --r11g11b10= forces one
+R11G11B10Encoding DetectR11G11B10Encoding(const char* payload, uint64 size, const TCOHeader& tcoHeader);
+
+// LZ4-decompresses the payload of an in-memory TCO file, all mips unless `targetSize` asks for fewer bytes.
+// A partial decode stops as soon as the first `targetSize` bytes are out, only those are allocated.
+// Errors are logged under `fName`.
+bool DecompressPayload(const std::string& fName, const char* data, uint64 size, const CompressedDataHeader& compHeader, std::unique_ptr<char[]>& pPayload, uint64 targetSize = 0);
+
+// Decodes mip 0 of a payload from DecompressPayload(), `payloadSize` bytes long, taking ownership of it.
+// Errors are logged under `fName`.
+bool DecodePayload(const std::string& fName, std::unique_ptr<char[]> pPayload, uint64 payloadSize, const TCOHeader& tcoHeader, DecodedImage& img);
+
+// Decodes mip 0 of an in-memory TCO file whose headers were already parsed, LZ4-decoding no further than mip 0
+// where the layout allows. Errors are logged under `fName`.
+bool DecodeTCO(const std::string& fName, const char* data, uint64 size, const CompressedDataHeader& compHeader, const TCOHeader& tcoHeader, DecodedImage& img);
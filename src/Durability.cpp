@@ -0,0 +1,190 @@
+#include "Durability.h"
+#include "Metrics.h"
+#include "Options.h"
+
+#include <format>
+#include <mutex>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+
+struct PendingOutput {
+	std::string sourceName;
+	// Where the data was written, and where it ends up
+	std::filesystem::path writtenPath;
+	std::filesystem::path path;
+	uint64 size;
+};
+
+static std::mutex gPendingMutex;
+static std::vector<PendingOutput> gVecPending;
+static uint64 gPendingBytes = 0;
+
+static std::mutex gManifestMutex;
+static HANDLE gManifest = INVALID_HANDLE_VALUE;
+// Handle of the output volume, flushing it flushes every file on it at once. Needs an elevated process.
+static HANDLE gVolume = INVALID_HANDLE_VALUE;
+
+static uint64 gNumSyncs = 0;
+static uint64 gNumDurable = 0;
+// Outputs of flushed groups that could not be renamed to their final name
+static uint64 gNumIncomplete = 0;
+
+static void AppendManifest(const std::string& lines, bool flush) {
+	std::scoped_lock l(gManifestMutex);
+	if ( gManifest == INVALID_HANDLE_VALUE )
+		return;
+
+	DWORD numWritten = 0;
+	WriteFile(gManifest, lines.data(), DWORD(lines.size()), &numWritten, nullptr);
+	if ( flush )
+		FlushFileBuffers(gManifest);
+}
+
+static std::string GetManifestLine(const PendingOutput& output, bool durable) {
+	return std::format("{}\t{}\t{}\t{}\n", durable ? "durable" : "written", output.sourceName, output.path.string(), output.size);
+}
+
+// Moves a complete output to its final name
+static bool Complete(const PendingOutput& output, std::string& err) {
+	if ( output.writtenPath == output.path )
+		return true;
+	return RenameWithRetry(output.writtenPath, output.path, err) == IOStatus::Ok;
+}
+
+// Flushes a group of outputs, then renames and lists them, and flushes the manifest once for all of them.
+// `flushVolume` flushes the whole volume in one call instead of each file, where that is allowed.
+// Outputs that cannot be renamed are logged and counted as write errors, their writers already reported them as queued.
+// With `pErr`, for a single output whose writer waits for it, the failure is returned instead and the result is false.
+static bool SyncGroup(std::vector<PendingOutput>& vecOutputs, bool flushVolume, std::string* pErr = nullptr) {
+	if ( vecOutputs.empty() )
+		return true;
+
+	std::vector<uint8> vecDurable(vecOutputs.size(), 1);
+	if ( !flushVolume || gVolume == INVALID_HANDLE_VALUE || !FlushFileBuffers(gVolume) ) {
+		for ( uint64 i = 0; i < vecOutputs.size(); ++i ) {
+			std::string err;
+			if ( SyncWithRetry(vecOutputs[i].writtenPath, err) != IOStatus::Ok ) {
+				LogError(vecOutputs[i].sourceName, std::format("Failed to flush '{}': {}", vecOutputs[i].path.string(), err));
+				vecDurable[i] = 0;
+			}
+		}
+	}
+
+	std::string lines;
+	uint64 numDurable = 0;
+	uint64 numIncomplete = 0;
+	for ( uint64 i = 0; i < vecOutputs.size(); ++i ) {
+		std::string err;
+		if ( !Complete(vecOutputs[i], err) ) {
+			++numIncomplete;
+			if ( pErr != nullptr ) {
+				*pErr = err;
+				continue;
+			}
+			LogError(vecOutputs[i].sourceName, std::format("Failed to complete '{}', it stays as '{}': {}", vecOutputs[i].path.string(), vecOutputs[i].writtenPath.string(), err));
+			RecordError(ErrorType::Write);
+			continue;
+		}
+		lines += GetManifestLine(vecOutputs[i], vecDurable[i]);
+		numDurable += vecDurable[i];
+	}
+	AppendManifest(lines, true);
+
+	std::scoped_lock l(gPendingMutex);
+	++gNumSyncs;
+	gNumDurable += numDurable;
+	if ( pErr == nullptr )
+		gNumIncomplete += numIncomplete;
+	return numIncomplete == 0;
+}
+
+void StartDurability() {
+	gManifest = CreateFileW(
+		L"./Textures_OUT/manifest.txt", FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr
+	);
+	if ( gManifest == INVALID_HANDLE_VALUE )
+		Print(std::format("Failed to open ./Textures_OUT/manifest.txt ({}), outputs are not recorded", GetLastError()));
+
+	if ( (gOptions.durability & DurabilityBatch) && GetStorage().IsLocal() ) {
+		wchar_t volumePath[MAX_PATH];
+		std::wstring outDir = std::filesystem::absolute("./Textures_OUT").wstring();
+		if ( GetVolumePathNameW(outDir.c_str(), volumePath, MAX_PATH) ) {
+			// "C:\" -> "\\.\C:"
+			std::wstring volume = L"\\\\.\\" + std::wstring(volumePath);
+			if ( volume.ends_with(L'\\') )
+				volume.pop_back();
+			gVolume = CreateFileW(volume.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+		}
+	}
+}
+
+void FinishDurability() {
+	std::vector<PendingOutput> vecOutputs;
+	{
+		std::scoped_lock l(gPendingMutex);
+		vecOutputs.swap(gVecPending);
+		gPendingBytes = 0;
+	}
+	SyncGroup(vecOutputs, true);
+
+	if ( gOptions.durability & (DurabilityBatch | DurabilityLarge) ) {
+		Print(std::format(
+			"\nDurability: {} outputs flushed to the device in {} groups{}",
+			gNumDurable, gNumSyncs, gVolume != INVALID_HANDLE_VALUE ? ", each with one flush of the volume" : ""
+		));
+	}
+	if ( gNumIncomplete != 0 )
+		Print(std::format("WARNING: {} queued outputs could not be renamed to their final name, see the errors", gNumIncomplete));
+
+	if ( gVolume != INVALID_HANDLE_VALUE ) {
+		CloseHandle(gVolume);
+		gVolume = INVALID_HANDLE_VALUE;
+	}
+
+	std::scoped_lock l(gManifestMutex);
+	if ( gManifest != INVALID_HANDLE_VALUE ) {
+		CloseHandle(gManifest);
+		gManifest = INVALID_HANDLE_VALUE;
+	}
+}
+
+IOStatus WriteOutput(const std::string& sourceName, const std::filesystem::path& path, const void* data, uint64 size, std::string& err, bool* pQueued) {
+	PendingOutput output = {sourceName, path, path, size};
+	if ( gOptions.durability & DurabilityRename )
+		output.writtenPath += ".partial";
+
+	IOStatus status = WriteWithRetry(output.writtenPath, data, size, err);
+	if ( status != IOStatus::Ok )
+		return status;
+
+	if ( (gOptions.durability & DurabilityLarge) && size >= uint64(gOptions.syncLargeMB) << 20 ) {
+		std::vector<PendingOutput> vecOutputs = {std::move(output)};
+		return SyncGroup(vecOutputs, false, &err) ? IOStatus::Ok : IOStatus::Failed;
+	}
+
+	if ( gOptions.durability & DurabilityBatch ) {
+		// The writer that fills the group flushes it, the others keep going
+		std::vector<PendingOutput> vecOutputs;
+		{
+			std::scoped_lock l(gPendingMutex);
+			gPendingBytes += size;
+			gVecPending.push_back(std::move(output));
+			if ( gVecPending.size() >= gOptions.syncFiles || gPendingBytes >= uint64(gOptions.syncMB) << 20 ) {
+				vecOutputs.swap(gVecPending);
+				gPendingBytes = 0;
+			}
+		}
+		// Also for the writer that flushes the group, its output is one of many completed there
+		if ( pQueued != nullptr )
+			*pQueued = true;
+		SyncGroup(vecOutputs, true);
+		return IOStatus::Ok;
+	}
+
+	if ( !Complete(output, err) )
+		return IOStatus::Failed;
+	AppendManifest(GetManifestLine(output, false), false);
+	return IOStatus::Ok;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Common.h"
+#include "Storage.h"
+
+// --durability flags, any combination of them. None of them set writes outputs like any other file.
+enum DurabilityFlags : uint32 {
+	// Outputs are written as <name>.partial and renamed once complete (and flushed, with a flushing mode),
+	// so a crash never leaves a truncated file under the final name
+	DurabilityRename = 1 << 0,
+	// Outputs are flushed to the device in groups of --sync-files files or --sync-mb MB, and at the end of the dump
+	DurabilityBatch = 1 << 1,
+	// Outputs of at least --sync-large-mb MB are flushed on their own right after they were written
+	DurabilityLarge = 1 << 2
+};
+
+/*
+	Every output is appended to ./Textures_OUT/manifest.txt once complete, as one line
+	"<state>\t<source file>\t<output path>\t<bytes>". The state is "written" for outputs left to the file cache,
+	and "durable" for outputs flushed to the device, which are only listed after the flush. The manifest is
+	flushed after every group of durable lines, so what it lists as durable survives a power loss.
+	Runs append to the same manifest, the last line of an output is its current state.
+*/
+
+// Opens the manifest, and the output volume for flushing groups with a single call where that is allowed
+void StartDurability();
+// Flushes the outputs still waiting for their group, and closes the manifest
+void FinishDurability();
+
+// Writes one output of `sourceName` as --durability asks for. Failures of the flush are logged, the data
+// is written at that point and the output stays listed as "written".
+// `pQueued` is set if the output waits for its group: it only gets its final name once the group is flushed,
+// and a failure to rename it is logged and counted as a write error then.
+IOStatus WriteOutput(const std::string& sourceName, const std::filesystem::path& path, const void* data, uint64 size, std::string& err, bool* pQueued = nullptr);
@@ -0,0 +1,255 @@
+#include "Estimate.h"
+#include "TCO.h"
+#include "Decoder.h"
+#include "Output.h"
+#include "Options.h"
+#include "Scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <map>
+#include <numeric>
+
+// Calibration stops sampling once this much time was spent, whatever layouts are left use the average
+constexpr double CalibrationBudgetSeconds = 5.0;
+constexpr uint32 SamplesPerLayout = 3;
+// Free space required on top of the prediction before the estimate passes without a warning
+constexpr double SpaceMargin = 1.1;
+
+// Measured cost of one layout, per byte of input or pixel, single threaded
+struct LayoutCoefficients {
+	uint32 numSamples = 0;
+	double readSecondsPerByte = 0.0;
+	double decodeSecondsPerByte = 0.0;
+	// Indexed by OutputFormat
+	double encodeSecondsPerPixel[int(OutputFormat::Count)] = {};
+	double outputBytesPerPixel[int(OutputFormat::Count)] = {};
+};
+
+// Pixels an output of `format` holds, thumbnails are scaled down
+static uint64 GetOutputPixels(OutputFormat format, const TCOHeader& tcoHeader) {
+	uint64 width = tcoHeader.width;
+	uint64 height = tcoHeader.height;
+	uint64 longEdge = std::max(width, height);
+	if ( format == OutputFormat::Thumb && longEdge > gOptions.thumbSize ) {
+		width = std::max<uint64>(width * gOptions.thumbSize / longEdge, 1);
+		height = std::max<uint64>(height * gOptions.thumbSize / longEdge, 1);
+	}
+	return width * height;
+}
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool CalibrateOneFile(const TCOFileInfo& info, const std::vector<OutputFormat>& vecFormats, LayoutCoefficients& coeffs) {
+	std::string fName = info.path.filename().string();
+
+	auto start = std::chrono::steady_clock::now();
+	std::string data = ReadFile(info.path);
+	double readSeconds = SecondsSince(start);
+	if ( data.empty() )
+		return false;
+
+	start = std::chrono::steady_clock::now();
+	DecodedImage img;
+	if ( !DecodeTCO(fName, data.data(), data.size(), info.compHeader, info.tcoHeader, img) )
+		return false;
+	OrientForOutput(img);
+	double decodeSeconds = SecondsSince(start);
+
+	uint64 numPixels = uint64(info.tcoHeader.width) * info.tcoHeader.height;
+	double encodeSeconds[std::size(coeffs.encodeSecondsPerPixel)] = {};
+	uint64 outputBytes[std::size(coeffs.outputBytesPerPixel)] = {};
+	for ( OutputFormat format : vecFormats ) {
+		std::vector<uint8> out;
+		start = std::chrono::steady_clock::now();
+		if ( format == OutputFormat::DDS ) {
+			std::unique_ptr<char[]> pPayload;
+			if ( !DecompressPayload(fName, data.data(), data.size(), info.compHeader, pPayload) )
+				return false;
+			if ( !EncodeDDS(info.tcoHeader, pPayload.get(), info.compHeader.decompressedSize, out) )
+				continue;
+		} else if ( !EncodeImage(format, img, out) ) {
+			return false;
+		}
+		encodeSeconds[int(format)] = SecondsSince(start);
+		outputBytes[int(format)] = out.size();
+	}
+
+	// Coefficients are running means over the samples of a layout
+	double n = ++coeffs.numSamples;
+	auto addSample = [n](double& mean, double value) { mean += (value - mean) / n; };
+	addSample(coeffs.readSecondsPerByte, readSeconds / info.fileSize);
+	addSample(coeffs.decodeSecondsPerByte, decodeSeconds / std::max<uint64>(info.compHeader.decompressedSize, 1));
+	for ( OutputFormat format : vecFormats ) {
+		addSample(coeffs.encodeSecondsPerPixel[int(format)], encodeSeconds[int(format)] / std::max<uint64>(numPixels, 1));
+		addSample(coeffs.outputBytesPerPixel[int(format)], double(outputBytes[int(format)]) / std::max<uint64>(GetOutputPixels(format, info.tcoHeader), 1));
+	}
+	return true;
+}
+
+static std::string FormatBytes(double bytes) {
+	if ( bytes >= 1024.0 * 1024.0 * 1024.0 )
+		return std::format("{:.2f} GB", bytes / (1024.0 * 1024.0 * 1024.0));
+	return std::format("{:.1f} MB", bytes / (1024.0 * 1024.0));
+}
+
+static std::string FormatSeconds(double seconds) {
+	uint64 s = uint64(seconds + 0.5);
+	if ( s >= 3600 )
+		return std::format("{}h {:02}m {:02}s", s / 3600, (s / 60) % 60, s % 60);
+	if ( s >= 60 )
+		return std::format("{}m {:02}s", s / 60, s % 60);
+	return std::format("{:.1f}s", seconds);
+}
+
+int RunEstimate(const std::filesystem::path& dir) {
+	std::vector<OutputFormat> vecFormats = gOptions.vecFormats;
+	if ( vecFormats.empty() )
+		vecFormats = {OutputFormat::TGA};
+
+	std::vector<std::filesystem::path> vecPaths = CollectTCOFiles(dir);
+	std::vector<TCOFileInfo> vecInfos = PrescanFiles(vecPaths);
+	if ( vecInfos.empty() ) {
+		Print("No TCO files to estimate");
+		return 0;
+	}
+
+	uint32 numThreads = GetNumThreads();
+	Print(std::format("Prescanned {} TCO files, calibrating on this machine...", vecInfos.size()));
+
+	// Samples are spread over the size range of each layout
+	std::map<TCOLayout, std::vector<const TCOFileInfo*>> mapByLayout;
+	for ( const TCOFileInfo& info : vecInfos )
+		mapByLayout[info.tcoHeader.layout].push_back(&info);
+
+	std::map<TCOLayout, LayoutCoefficients> mapCoeffs;
+	auto calibrationStart = std::chrono::steady_clock::now();
+	for ( auto& [layout, vecLayoutInfos] : mapByLayout ) {
+		std::sort(vecLayoutInfos.begin(), vecLayoutInfos.end(), [](const TCOFileInfo* a, const TCOFileInfo* b) {
+			return a->compHeader.decompressedSize < b->compHeader.decompressedSize;
+		});
+
+		LayoutCoefficients& coeffs = mapCoeffs[layout];
+		uint64 numSamples = std::min<uint64>(SamplesPerLayout, vecLayoutInfos.size());
+		for ( uint64 i = 0; i < numSamples && SecondsSince(calibrationStart) < CalibrationBudgetSeconds; ++i ) {
+			uint64 index = numSamples > 1 ? i * (vecLayoutInfos.size() - 1) / (numSamples - 1) : 0;
+			CalibrateOneFile(*vecLayoutInfos[index], vecFormats, coeffs);
+		}
+	}
+
+	// Layouts that could not be sampled use the mean of the others
+	LayoutCoefficients fallback;
+	for ( const auto& [layout, coeffs] : mapCoeffs ) {
+		if ( coeffs.numSamples == 0 )
+			continue;
+		double n = ++fallback.numSamples;
+		fallback.readSecondsPerByte += (coeffs.readSecondsPerByte - fallback.readSecondsPerByte) / n;
+		fallback.decodeSecondsPerByte += (coeffs.decodeSecondsPerByte - fallback.decodeSecondsPerByte) / n;
+		for ( uint32 f = 0; f < std::size(fallback.encodeSecondsPerPixel); ++f ) {
+			fallback.encodeSecondsPerPixel[f] += (coeffs.encodeSecondsPerPixel[f] - fallback.encodeSecondsPerPixel[f]) / n;
+			fallback.outputBytesPerPixel[f] += (coeffs.outputBytesPerPixel[f] - fallback.outputBytesPerPixel[f]) / n;
+		}
+	}
+	if ( fallback.numSamples == 0 ) {
+		Print("Calibration failed on every sampled file, no estimate possible");
+		return 1;
+	}
+
+	struct LayoutTotals {
+		uint64 numFiles = 0;
+		uint64 inputBytes = 0;
+		double seconds = 0.0;
+	};
+	std::map<TCOLayout, LayoutTotals> mapTotals;
+	double outputBytes[std::size(fallback.outputBytesPerPixel)] = {};
+	double totalSeconds = 0.0;
+	double longestFileSeconds = 0.0;
+	std::vector<uint64> vecFootprints;
+
+	for ( const TCOFileInfo& info : vecInfos ) {
+		const LayoutCoefficients& found = mapCoeffs[info.tcoHeader.layout];
+		const LayoutCoefficients& coeffs = found.numSamples != 0 ? found : fallback;
+		uint64 numPixels = uint64(info.tcoHeader.width) * info.tcoHeader.height;
+
+		double seconds = coeffs.readSecondsPerByte * info.fileSize + coeffs.decodeSecondsPerByte * info.compHeader.decompressedSize;
+		uint64 encodedBytes = 0;
+		for ( OutputFormat format : vecFormats ) {
+			seconds += coeffs.encodeSecondsPerPixel[int(format)] * numPixels;
+
+			uint64 ddsSize = 0;
+			double bytes = coeffs.outputBytesPerPixel[int(format)] * GetOutputPixels(format, info.tcoHeader);
+			if ( format == OutputFormat::DDS )
+				bytes = GetDDSSize(info.tcoHeader, info.compHeader, ddsSize) ? double(ddsSize) : 0.0;
+			outputBytes[int(format)] += bytes;
+			encodedBytes = std::max(encodedBytes, uint64(bytes));
+		}
+
+		LayoutTotals& totals = mapTotals[info.tcoHeader.layout];
+		++totals.numFiles;
+		totals.inputBytes += info.compHeader.decompressedSize;
+		totals.seconds += seconds;
+		totalSeconds += seconds;
+		longestFileSeconds = std::max(longestFileSeconds, seconds);
+
+		// File, payload, 8 bit pixels (plus floats for HDR sources) and the largest encoded output at once
+		uint64 pixelBytes = numPixels * std::max(GetNumChannels(info.tcoHeader.layout), 1u);
+		if ( info.tcoHeader.layout == TCOLayout::R11G11B10 || info.tcoHeader.layout == TCOLayout::BC6H )
+			pixelBytes += numPixels * 4 * sizeof(float);
+		vecFootprints.push_back(info.fileSize + info.compHeader.decompressedSize + pixelBytes + encodedBytes);
+	}
+
+	// Work is handed out largest first, so the biggest files are the ones in flight together
+	std::sort(vecFootprints.begin(), vecFootprints.end(), std::greater<uint64>());
+	uint64 peakMemory = vecInfos.size() * sizeof(TCOFileInfo);
+	for ( uint64 i = 0; i < std::min<uint64>(numThreads, vecFootprints.size()); ++i )
+		peakMemory += vecFootprints[i];
+
+	// No schedule finishes before its longest single file
+	double wallSeconds = std::max(totalSeconds / numThreads, longestFileSeconds);
+
+	Print(std::format("\nCalibrated on {} files in {:.1f}s\n", std::accumulate(mapCoeffs.begin(), mapCoeffs.end(), 0u, [](uint32 sum, const auto& entry) {
+		return sum + entry.second.numSamples;
+	}), SecondsSince(calibrationStart)));
+
+	Print("Per-layout estimate (single thread):");
+	for ( const auto& [layout, totals] : mapTotals ) {
+		bool calibrated = mapCoeffs[layout].numSamples != 0;
+		Print(std::format(
+			"  {:<10} {:>7} files {:>10.1f} MB {:>9.1f} MB/s  {:>12}{}",
+			ToString(layout), totals.numFiles, totals.inputBytes / (1024.0 * 1024.0),
+			totals.seconds > 0.0 ? (totals.inputBytes / totals.seconds) / (1024.0 * 1024.0) : 0.0,
+			FormatSeconds(totals.seconds), calibrated ? "" : " (not sampled, average used)"
+		));
+	}
+
+	double totalOutput = 0.0;
+	Print("\nOutput size:");
+	for ( OutputFormat format : vecFormats ) {
+		Print(std::format("  {:<10} {:>12}", ToString(format), FormatBytes(outputBytes[int(format)])));
+		totalOutput += outputBytes[int(format)];
+	}
+
+	Print(std::format("\nPredicted wall time with {} threads: {}", numThreads, FormatSeconds(wallSeconds)));
+	Print(std::format("Predicted peak memory: {}", FormatBytes(double(peakMemory))));
+	Print(std::format("Predicted output: {}", FormatBytes(totalOutput)));
+
+	std::error_code ec;
+	std::filesystem::path outDir = std::filesystem::exists("./Textures_OUT") ? "./Textures_OUT" : ".";
+	std::filesystem::space_info space = std::filesystem::space(outDir, ec);
+	if ( ec ) {
+		Print(std::format("Could not query the free space of '{}': {}", outDir.string(), ec.message()));
+		return 0;
+	}
+
+	Print(std::format("Free space on the output volume: {}", FormatBytes(double(space.available))));
+	if ( double(space.available) < totalOutput ) {
+		Print("ERROR: the output volume does not have enough free space for this dump!");
+		return 1;
+	}
+	if ( double(space.available) < totalOutput * SpaceMargin )
+		Print("WARNING: the output volume would be almost full after this dump");
+	return 0;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "Common.h"
+
+// Predicts wall time, peak memory and output size of a dump of `dir` with the current options, from the header
+// prescan and per-layout coefficients measured on a few sample files. Returns 1 if the output volume is too small.
+int RunEstimate(const std::filesystem::path& dir);
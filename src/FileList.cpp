@@ -0,0 +1,107 @@
+#include "FileList.h"
+#include "Metrics.h"
+
+#include <format>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+
+FileListReader::FileListReader(const std::string& source) {
+	m_thread = std::thread(&FileListReader::ReadList, this, source);
+}
+
+FileListReader::~FileListReader() {
+	m_thread.join();
+}
+
+bool FileListReader::Next(std::filesystem::path& path) {
+	std::unique_lock l(m_mutex);
+	m_cv.wait(l, [this]() { return !m_dequePaths.empty() || m_ended; });
+	if ( m_dequePaths.empty() )
+		return false;
+
+	path = std::move(m_dequePaths.front());
+	m_dequePaths.pop_front();
+	return true;
+}
+
+uint64 FileListReader::GetNumRead() const {
+	std::scoped_lock l(m_mutex);
+	return m_numRead;
+}
+
+std::string FileListReader::GetError() const {
+	std::scoped_lock l(m_mutex);
+	return m_error;
+}
+
+void FileListReader::Push(std::string_view entry) {
+	if ( entry.ends_with('\r') )
+		entry.remove_suffix(1);
+	if ( entry.empty() )
+		return;
+
+	{
+		std::scoped_lock l(m_mutex);
+		m_dequePaths.emplace_back(entry);
+		++m_numRead;
+	}
+	RecordFilesQueued(1);
+	m_cv.notify_one();
+}
+
+void FileListReader::ReadList(const std::string& source) {
+	HANDLE hFile;
+	if ( source == "-" ) {
+		hFile = GetStdHandle(STD_INPUT_HANDLE);
+	} else {
+		hFile = CreateFileW(
+			std::filesystem::path(source).wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr
+		);
+	}
+
+	std::string error;
+	if ( hFile == INVALID_HANDLE_VALUE || hFile == nullptr ) {
+		error = std::format("Failed to open the file list '{}' ({})", source, GetLastError());
+	} else {
+		// A read from a pipe returns whatever the producer wrote so far, so entries are pushed as soon as they are complete
+		std::string pending;
+		char buffer[64 * 1024];
+		for ( ;; ) {
+			DWORD numRead = 0;
+			if ( !ReadFile(hFile, buffer, sizeof(buffer), &numRead, nullptr) ) {
+				// The producer closing its end of a pipe is the normal end of the list
+				DWORD err = GetLastError();
+				if ( err != ERROR_BROKEN_PIPE )
+					error = std::format("Failed to read the file list '{}' ({})", source, err);
+				break;
+			}
+			if ( numRead == 0 )
+				break;
+
+			uint64 begin = 0;
+			for ( uint64 i = 0; i < numRead; ++i ) {
+				if ( buffer[i] != '\0' && buffer[i] != '\n' )
+					continue;
+				pending.append(buffer + begin, i - begin);
+				Push(pending);
+				pending.clear();
+				begin = i + 1;
+			}
+			pending.append(buffer + begin, numRead - begin);
+		}
+		Push(pending);
+
+		if ( source != "-" )
+			CloseHandle(hFile);
+	}
+
+	{
+		std::scoped_lock l(m_mutex);
+		m_error = std::move(error);
+		m_ended = true;
+	}
+	m_cv.notify_all();
+}
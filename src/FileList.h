@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "Common.h"
+
+/*
+	Reads the paths of a --files-from list on a background thread and hands them out as they arrive,
+	so the dump can start on the first entries while the producer of the list is still running.
+	Entries are separated by NUL or newline characters, a trailing '\r' is dropped and empty entries are skipped.
+*/
+class FileListReader {
+public:
+	// `source` is a file, or "-" for stdin
+	explicit FileListReader(const std::string& source);
+	~FileListReader();
+	FileListReader(const FileListReader&) = delete;
+	FileListReader& operator=(const FileListReader&) = delete;
+
+	// Blocks until the next path arrived. Returns false once the list ended and every path was handed out.
+	// Safe to call from any number of threads.
+	bool Next(std::filesystem::path& path);
+
+	uint64 GetNumRead() const;
+	// Error that ended the list early, empty if it was read to the end
+	std::string GetError() const;
+
+private:
+	void ReadList(const std::string& source);
+	void Push(std::string_view entry);
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::deque<std::filesystem::path> m_dequePaths;
+	uint64 m_numRead = 0;
+	bool m_ended = false;
+	std::string m_error;
+	std::thread m_thread;
+};
@@ -0,0 +1,375 @@
+#include "FuseView.h"
+
+#ifndef CACHEDUMPER_WITH_FUSE
+
+int RunMount(const std::filesystem::path& dir, const std::string& mountPoint) {
+	Print("This build was compiled without FUSE support. Build the ReleaseFuse configuration with WinFsp installed (or define CACHEDUMPER_WITH_FUSE and link libfuse).");
+	return 1;
+}
+
+#else
+
+#include "TCO.h"
+#include "Decoder.h"
+#include "Output.h"
+#include "JPEGEncode.h"
+#include "Options.h"
+#include "Scheduler.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <format>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
+#define FUSE_USE_VERSION 28
+#include <fuse.h>
+
+#ifdef _WIN32
+// WinFsp's FUSE layer uses its own stat and offset types
+using FuseStat = struct fuse_stat;
+using FuseOff = fuse_off_t;
+#else
+#include <sys/stat.h>
+using FuseStat = struct stat;
+using FuseOff = off_t;
+#endif
+
+#include "stb_image_write.h"
+
+using EncodedData = std::shared_ptr<const std::vector<uint8>>;
+
+// Encoded files by name, least recently used ones are evicted once the byte budget is exceeded.
+// Concurrent requests for a file that is still being encoded wait for that encode instead of repeating it.
+class EncodedLRU {
+public:
+	explicit EncodedLRU(uint64 budget) : m_budget(budget) {}
+
+	EncodedData Find(const std::string& key) {
+		std::scoped_lock l(m_mutex);
+		auto it = m_mapEntries.find(key);
+		if ( it == m_mapEntries.end() )
+			return nullptr;
+		Touch(it->second);
+		return it->second.data;
+	}
+
+	EncodedData GetOrEncode(const std::string& key, const std::function<EncodedData()>& encode) {
+		std::unique_lock l(m_mutex);
+		for ( ;; ) {
+			auto it = m_mapEntries.find(key);
+			if ( it != m_mapEntries.end() ) {
+				Touch(it->second);
+				return it->second.data;
+			}
+			if ( !m_setPending.contains(key) )
+				break;
+			m_cv.wait(l);
+		}
+
+		m_setPending.insert(key);
+		l.unlock();
+		EncodedData data = encode();
+		l.lock();
+		m_setPending.erase(key);
+		if ( data )
+			Insert(key, data);
+		m_cv.notify_all();
+		return data;
+	}
+
+	bool IsCachedOrPending(const std::string& key) {
+		std::scoped_lock l(m_mutex);
+		return m_mapEntries.contains(key) || m_setPending.contains(key);
+	}
+
+private:
+	struct Entry {
+		EncodedData data;
+		std::list<std::string>::iterator lruIt;
+	};
+
+	void Touch(Entry& entry) {
+		m_listLRU.splice(m_listLRU.begin(), m_listLRU, entry.lruIt);
+	}
+
+	void Insert(const std::string& key, const EncodedData& data) {
+		m_listLRU.push_front(key);
+		m_mapEntries[key] = {data, m_listLRU.begin()};
+		m_used += data->size();
+
+		// Always keep the newest entry, even if it alone exceeds the budget
+		while ( m_used > m_budget && m_listLRU.size() > 1 ) {
+			auto it = m_mapEntries.find(m_listLRU.back());
+			m_used -= it->second.data->size();
+			m_mapEntries.erase(it);
+			m_listLRU.pop_back();
+		}
+	}
+
+	uint64 m_budget;
+	uint64 m_used = 0;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::list<std::string> m_listLRU;
+	std::unordered_map<std::string, Entry> m_mapEntries;
+	std::set<std::string> m_setPending;
+};
+
+struct ViewFile {
+	uint64 fileIndex;
+	OutputFormat format;
+};
+
+static std::vector<TCOFileInfo> gVecViewInfos;
+static std::map<std::string, ViewFile> gMapViewFiles;
+static EncodedLRU* gpViewCache = nullptr;
+
+static std::mutex gReadaheadMutex;
+static std::condition_variable gReadaheadCV;
+static std::deque<std::string> gDequeReadahead;
+// Set once the file system is unmounted, the readahead threads finish their current encode and exit
+static bool gStopReadahead = false;
+
+static EncodedData EncodeViewFile(const ViewFile& vf) {
+	const TCOFileInfo& info = gVecViewInfos[vf.fileIndex];
+	std::string fName = info.path.filename().string();
+
+	std::string data = ReadFile(info.path);
+	if ( data.empty() )
+		return nullptr;
+
+	CompressedDataHeader compHeader;
+	TCOHeader tcoHeader;
+	std::string err = ParseTCOHeaders(data.data(), data.size(), compHeader, tcoHeader);
+	if ( !err.empty() ) {
+		LogError(fName, err);
+		return nullptr;
+	}
+
+	auto pOut = std::make_shared<std::vector<uint8>>();
+	if ( vf.format == OutputFormat::DDS ) {
+		std::unique_ptr<char[]> pPayload;
+		if ( !DecompressPayload(fName, data.data(), data.size(), compHeader, pPayload) )
+			return nullptr;
+		if ( !EncodeDDS(tcoHeader, pPayload.get(), compHeader.decompressedSize, *pOut) )
+			return nullptr;
+		return pOut;
+	}
+
+	DecodedImage img;
+	if ( !DecodeTCO(fName, data.data(), data.size(), compHeader, tcoHeader, img) )
+		return nullptr;
+
+	OrientForOutput(img);
+	if ( !EncodeImage(vf.format, img, *pOut) ) {
+		LogError(fName, "Failed to encode image");
+		return nullptr;
+	}
+	return pOut;
+}
+
+static const ViewFile* FindViewFile(const char* path) {
+	if ( path[0] != '/' )
+		return nullptr;
+	auto it = gMapViewFiles.find(path + 1);
+	return it != gMapViewFiles.end() ? &it->second : nullptr;
+}
+
+// Size as far as it is known without encoding. Exact for TGA (no RLE in the view) and DDS, the other formats
+// report the largest file their encoder can write until they were encoded, their reads use direct_io instead.
+static uint64 GetViewFileSize(const std::string& name, const ViewFile& vf) {
+	const TCOFileInfo& info = gVecViewInfos[vf.fileIndex];
+	if ( EncodedData data = gpViewCache->Find(name) )
+		return data->size();
+
+	uint32 width = info.tcoHeader.width;
+	uint32 height = info.tcoHeader.height;
+	uint32 numChannels = GetNumChannels(info.tcoHeader.layout);
+	uint64 size = 0;
+	switch(vf.format) {
+		case OutputFormat::DDS:
+			if ( GetDDSSize(info.tcoHeader, info.compHeader, size) )
+				return size;
+			break;
+		case OutputFormat::HDR:
+			// Per scanline: a 4 byte marker and 4 components with one run header per up to 128 literals
+			return 128 + uint64(height) * (4 + 4 * (uint64(width) + width / 128 + 1));
+		case OutputFormat::PNG:
+			return GetPNGSizeBound(width, height, numChannels);
+		case OutputFormat::Thumb: {
+			uint32 thumbW = 0;
+			uint32 thumbH = 0;
+			GetDownscaledSize(width, height, gOptions.thumbSize, thumbW, thumbH);
+			return GetPNGSizeBound(thumbW, thumbH, numChannels);
+		}
+		case OutputFormat::JPEG:
+			return GetJPEGSizeBound(width, height, numChannels, gOptions.jpegQuality);
+		default:
+			break;
+	}
+	return GetTGASize(info.tcoHeader);
+}
+
+static void QueueReadahead(const ViewFile& vf) {
+	std::scoped_lock l(gReadaheadMutex);
+	uint64 end = std::min<uint64>(vf.fileIndex + 1 + gOptions.readahead, gVecViewInfos.size());
+	for ( uint64 i = vf.fileIndex + 1; i < end; ++i ) {
+		std::string name = std::format("{}.{}", gVecViewInfos[i].path.filename().string(), GetExtension(vf.format));
+		if ( gMapViewFiles.contains(name) && !gpViewCache->IsCachedOrPending(name) )
+			gDequeReadahead.push_back(std::move(name));
+	}
+	gReadaheadCV.notify_all();
+}
+
+static void ReadaheadWorker() {
+	for ( ;; ) {
+		std::string name;
+		{
+			std::unique_lock l(gReadaheadMutex);
+			gReadaheadCV.wait(l, []() { return gStopReadahead || !gDequeReadahead.empty(); });
+			if ( gStopReadahead )
+				return;
+			name = std::move(gDequeReadahead.front());
+			gDequeReadahead.pop_front();
+		}
+
+		const ViewFile& vf = gMapViewFiles.at(name);
+		gpViewCache->GetOrEncode(name, [&vf]() { return EncodeViewFile(vf); });
+	}
+}
+
+
+static int ViewGetAttr(const char* path, FuseStat* stbuf) {
+	memset(stbuf, 0, sizeof(*stbuf));
+	if ( strcmp(path, "/") == 0 ) {
+		stbuf->st_mode = 0040555; // S_IFDIR
+		stbuf->st_nlink = 2;
+		return 0;
+	}
+
+	const ViewFile* pFile = FindViewFile(path);
+	if ( pFile == nullptr )
+		return -ENOENT;
+
+	stbuf->st_mode = 0100444; // S_IFREG
+	stbuf->st_nlink = 1;
+	stbuf->st_size = GetViewFileSize(path + 1, *pFile);
+	return 0;
+}
+
+static int ViewReadDir(const char* path, void* buf, fuse_fill_dir_t filler, FuseOff offset, struct fuse_file_info* fi) {
+	if ( strcmp(path, "/") != 0 )
+		return -ENOENT;
+
+	filler(buf, ".", nullptr, 0);
+	filler(buf, "..", nullptr, 0);
+	for ( const auto& [name, vf] : gMapViewFiles )
+		filler(buf, name.c_str(), nullptr, 0);
+	return 0;
+}
+
+static int ViewOpen(const char* path, struct fuse_file_info* fi) {
+	const ViewFile* pFile = FindViewFile(path);
+	if ( pFile == nullptr )
+		return -ENOENT;
+	if ( (fi->flags & 3) != 0 ) // O_RDONLY
+		return -EACCES;
+
+	if ( pFile->format != OutputFormat::TGA && pFile->format != OutputFormat::DDS )
+		fi->direct_io = 1;
+
+	QueueReadahead(*pFile);
+	return 0;
+}
+
+static int ViewRead(const char* path, char* buf, size_t size, FuseOff offset, struct fuse_file_info* fi) {
+	const ViewFile* pFile = FindViewFile(path);
+	if ( pFile == nullptr )
+		return -ENOENT;
+
+	EncodedData data = gpViewCache->GetOrEncode(path + 1, [pFile]() { return EncodeViewFile(*pFile); });
+	if ( !data )
+		return -EIO;
+
+	if ( uint64(offset) >= data->size() )
+		return 0;
+	uint64 count = std::min<uint64>(size, data->size() - uint64(offset));
+	memcpy(buf, data->data() + offset, count);
+	return int(count);
+}
+
+int RunMount(const std::filesystem::path& dir, const std::string& mountPoint) {
+	if ( mountPoint.empty() ) {
+		Print("mount requires --mountpoint=<path>");
+		return 1;
+	}
+
+	std::vector<OutputFormat> vecFormats = gOptions.vecFormats;
+	if ( vecFormats.empty() )
+		vecFormats = {OutputFormat::TGA, OutputFormat::PNG, OutputFormat::DDS};
+
+	std::vector<std::filesystem::path> vecPaths = CollectTCOFiles(dir);
+	std::sort(vecPaths.begin(), vecPaths.end());
+	gVecViewInfos = PrescanFiles(vecPaths);
+
+	for ( uint64 i = 0; i < gVecViewInfos.size(); ++i ) {
+		const TCOFileInfo& info = gVecViewInfos[i];
+		if ( GetNumChannels(info.tcoHeader.layout) == 0 )
+			continue;
+
+		uint64 ddsSize = 0;
+		for ( OutputFormat format : vecFormats ) {
+			if ( format == OutputFormat::DDS && !GetDDSSize(info.tcoHeader, info.compHeader, ddsSize) )
+				continue;
+			gMapViewFiles[std::format("{}.{}", info.path.filename().string(), GetExtension(format))] = {i, format};
+		}
+	}
+
+	// Exact TGA sizes are only known up front without RLE
+	stbi_write_tga_with_rle = 0;
+
+	EncodedLRU cache(gOptions.cacheMB << 20);
+	gpViewCache = &cache;
+
+	uint32 numReadaheadThreads = std::max(GetNumThreads() / 2, 1u);
+	std::vector<std::thread> vecReadahead;
+	for ( uint32 i = 0; i < numReadaheadThreads; ++i )
+		vecReadahead.emplace_back(ReadaheadWorker);
+
+	Print(std::format("Mounting {} files from {} TCO files at '{}'", gMapViewFiles.size(), gVecViewInfos.size(), mountPoint));
+
+	struct fuse_operations ops = {};
+	ops.getattr = ViewGetAttr;
+	ops.readdir = ViewReadDir;
+	ops.open = ViewOpen;
+	ops.read = ViewRead;
+
+	std::string progName = "CacheDumper";
+	std::string foreground = "-f";
+	std::string mountPointArg = mountPoint;
+	char* argv[] = { progName.data(), foreground.data(), mountPointArg.data() };
+	int ret = fuse_main(3, argv, &ops, nullptr);
+
+	// The readahead threads use the cache, which goes away with this frame
+	{
+		std::scoped_lock l(gReadaheadMutex);
+		gStopReadahead = true;
+		gDequeReadahead.clear();
+	}
+	gReadaheadCV.notify_all();
+	for ( std::thread& thread : vecReadahead )
+		thread.join();
+	gpViewCache = nullptr;
+
+	return ret;
+}
+
+#endif
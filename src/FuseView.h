@@ -0,0 +1,9 @@
+#pragma once
+
+#include "Common.h"
+
+// Mounts a read-only view of `dir` at `mountPoint`, presenting every .tco as one virtual file per --formats entry.
+// Files are decoded on first read and kept in a size-bounded LRU (--cache-mb), opening one file also
+// encodes the next --readahead siblings in the background. Blocks until the file system is unmounted.
+// Requires a build with CACHEDUMPER_WITH_FUSE (WinFsp's FUSE layer on Windows, libfuse elsewhere).
+int RunMount(const std::filesystem::path& dir, const std::string& mountPoint);
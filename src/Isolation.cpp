@@ -0,0 +1,355 @@
+#include "Isolation.h"
+#include "Metrics.h"
+#include "Options.h"
+#include "Pack.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <fstream>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+
+constexpr uint32 IsolationMagic = 0x4F534943; // "CISO"
+constexpr uint64 IdleSlot = ~0ull;
+constexpr uint32 MaxWorkers = MAXIMUM_WAIT_OBJECTS;
+// Consecutive workers that die before taking any work, after which no more are started
+constexpr uint32 MaxStartupFailures = 3;
+// How often the supervisor passes the progress of the workers on to the metrics while none exits
+constexpr DWORD ProgressIntervalMs = 250;
+
+// Shared memory layout: IsolationHeader | IsolatedItem[numItems] | UTF-8 paths
+struct WorkerSlot {
+	// Position in the work order the worker is on, IdleSlot if none
+	std::atomic<uint64> currentItem;
+};
+
+struct IsolationHeader {
+	uint32 magic;
+	uint32 numWorkers;
+	uint64 numItems;
+	uint64 namesOffset;
+	std::atomic<uint64> nextItem;
+	WorkerSlot slots[MaxWorkers];
+};
+
+struct IsolatedItem {
+	uint64 pathOffset;
+	uint32 pathLength;
+	std::atomic<uint32> status;
+	uint64 fileSize;
+	uint64 nanoseconds;
+	// What the worker passed to RecordStageBytes() for this file
+	uint64 stageBytes[int(FileStage::Count)];
+	CompressedDataHeader compHeader;
+	TCOHeader tcoHeader;
+	// Errors logged for this file, truncated and zero-terminated
+	char errors[144];
+};
+CHECKSZ(IsolatedItem, 0x100);
+
+// Maps a pagefile-backed section, creating it if `size` is non-zero
+static IsolationHeader* MapSection(const std::wstring& name, uint64 size, HANDLE& hMapping) {
+	if ( size != 0 )
+		hMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, DWORD(size >> 32), DWORD(size), name.c_str());
+	else
+		hMapping = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+	if ( hMapping == nullptr )
+		return nullptr;
+
+	void* pView = MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if ( pView == nullptr ) {
+		CloseHandle(hMapping);
+		hMapping = nullptr;
+	}
+	return (IsolationHeader*)pView;
+}
+
+static IsolatedItem* GetItems(IsolationHeader* pHeader) {
+	return (IsolatedItem*)(pHeader + 1);
+}
+
+// Whether the worker that had `item` in `slot` was still processing it. Workers publish an item in their slot before
+// taking it, so the item may have been taken by another worker or never at all, and a worker can also die after
+// storing the item's status.
+static bool WasProcessing(IsolationHeader* pHeader, IsolatedItem* pItems, uint32 slot, uint64 item) {
+	if ( pHeader->nextItem <= item )
+		return false;
+	// The owner keeps the item in its slot until after its status is stored, so the slots are checked first
+	for ( uint32 other = 0; other < MaxWorkers; ++other ) {
+		if ( other != slot && pHeader->slots[other].currentItem == item )
+			return false;
+	}
+	return ItemStatus(pItems[item].status.load()) == ItemStatus::Pending;
+}
+
+// Takes the next item, publishing it in the slot first so that a crash never loses a taken item
+static bool ClaimItem(IsolationHeader* pHeader, WorkerSlot& slot, uint64& item) {
+	item = pHeader->nextItem;
+	while ( item < pHeader->numItems ) {
+		slot.currentItem = item;
+		if ( pHeader->nextItem.compare_exchange_weak(item, item + 1) )
+			return true;
+	}
+	slot.currentItem = IdleSlot;
+	return false;
+}
+
+// Items already passed on to the metrics by PublishProgress()
+struct PublishedProgress {
+	uint64 numStarted = 0;
+	// Every item below it is finished and published
+	uint64 firstOpen = 0;
+	std::vector<bool> vecFinished;
+};
+
+// Records the items the workers took and finished since the last call, so the metrics follow the run instead of
+// being filled in once it is over. A worker stores the stage bytes of an item before its status.
+static void PublishProgress(IsolationHeader* pHeader, IsolatedItem* pItems, PublishedProgress& progress) {
+	uint64 numTaken = pHeader->nextItem;
+	for ( ; progress.numStarted < numTaken; ++progress.numStarted )
+		RecordFileStarted();
+
+	for ( uint64 i = progress.firstOpen; i < numTaken; ++i ) {
+		const IsolatedItem& item = pItems[i];
+		ItemStatus status = ItemStatus(item.status.load());
+		if ( progress.vecFinished[i] || status == ItemStatus::Pending )
+			continue;
+
+		progress.vecFinished[i] = true;
+		RecordFileDone(status == ItemStatus::Done, std::chrono::nanoseconds(item.nanoseconds), nullptr);
+		if ( status == ItemStatus::Quarantined ) {
+			RecordError(ErrorType::Crash);
+			continue;
+		}
+		if ( status == ItemStatus::Failed )
+			RecordError(ErrorType::Worker);
+		for ( int stage = 0; stage < int(FileStage::Count); ++stage )
+			RecordStageBytes(FileStage(stage), item.stageBytes[stage]);
+	}
+
+	while ( progress.firstOpen < numTaken && progress.vecFinished[progress.firstOpen] )
+		++progress.firstOpen;
+}
+
+static HANDLE SpawnWorker(const std::wstring& sectionName, uint32 slot, HANDLE hJob) {
+	wchar_t exePath[MAX_PATH];
+	GetModuleFileNameW(nullptr, exePath, MAX_PATH);
+
+	std::wstring cmdLine = GetCommandLineW();
+	cmdLine += L" --worker=" + sectionName + L"," + std::to_wstring(slot);
+
+	STARTUPINFOW si = {};
+	si.cb = sizeof(si);
+	PROCESS_INFORMATION pi = {};
+	if ( !CreateProcessW(exePath, cmdLine.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &si, &pi) )
+		return nullptr;
+
+	AssignProcessToJobObject(hJob, pi.hProcess);
+	CloseHandle(pi.hThread);
+	return pi.hProcess;
+}
+
+std::vector<IsolatedResult> RunIsolated(const std::vector<TCOFileInfo>& vecInfos, const std::vector<uint64>& vecOrder, uint32 numWorkers, std::vector<std::string>& vecErrors) {
+	numWorkers = uint32(std::clamp<uint64>(numWorkers, 1, std::min<uint64>(MaxWorkers, std::max<uint64>(vecOrder.size(), 1))));
+
+	std::string names;
+	for ( uint64 index : vecOrder ) {
+		std::u8string path = vecInfos[index].path.u8string();
+		names.append((const char*)path.data(), path.size());
+	}
+
+	uint64 namesOffset = sizeof(IsolationHeader) + vecOrder.size() * sizeof(IsolatedItem);
+	std::string name = std::format("Local\\CacheDumper_{}", GetCurrentProcessId());
+	std::wstring sectionName(name.begin(), name.end());
+	HANDLE hMapping = nullptr;
+	IsolationHeader* pHeader = MapSection(sectionName, namesOffset + std::max<uint64>(names.size(), 1), hMapping);
+	if ( pHeader == nullptr ) {
+		vecErrors.emplace_back(std::format("Failed to create the shared memory section for worker processes ({})", GetLastError()));
+		return std::vector<IsolatedResult>(vecOrder.size(), {ItemStatus::Failed, 0});
+	}
+
+	// The section is zero-filled, which is a valid state for all atomics in it
+	pHeader->magic = IsolationMagic;
+	pHeader->numWorkers = numWorkers;
+	pHeader->numItems = vecOrder.size();
+	pHeader->namesOffset = namesOffset;
+	for ( WorkerSlot& slot : pHeader->slots )
+		slot.currentItem = IdleSlot;
+
+	IsolatedItem* pItems = GetItems(pHeader);
+	uint64 nameOffset = 0;
+	for ( uint64 i = 0; i < vecOrder.size(); ++i ) {
+		const TCOFileInfo& info = vecInfos[vecOrder[i]];
+		IsolatedItem& item = pItems[i];
+		uint64 length = info.path.u8string().size();
+		item.pathOffset = nameOffset;
+		item.pathLength = uint32(length);
+		item.fileSize = info.fileSize;
+		item.compHeader = info.compHeader;
+		item.tcoHeader = info.tcoHeader;
+		nameOffset += length;
+	}
+	memcpy((char*)pHeader + namesOffset, names.data(), names.size());
+
+	// Workers are killed along with the supervisor
+	HANDLE hJob = CreateJobObjectW(nullptr, nullptr);
+	JOBOBJECT_EXTENDED_LIMIT_INFORMATION jobLimits = {};
+	jobLimits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+	SetInformationJobObject(hJob, JobObjectExtendedLimitInformation, &jobLimits, sizeof(jobLimits));
+
+	Print(std::format("Starting {} worker processes", numWorkers));
+
+	std::vector<HANDLE> vecProcesses;
+	std::vector<uint32> vecSlots;
+	for ( uint32 slot = 0; slot < numWorkers; ++slot ) {
+		if ( HANDLE hProcess = SpawnWorker(sectionName, slot, hJob) ) {
+			vecProcesses.push_back(hProcess);
+			vecSlots.push_back(slot);
+		}
+	}
+
+	std::vector<std::string> vecQuarantined;
+	PublishedProgress progress;
+	progress.vecFinished.resize(vecOrder.size());
+	uint32 numStartupFailures = 0;
+	while ( !vecProcesses.empty() ) {
+		DWORD res = WaitForMultipleObjects(DWORD(vecProcesses.size()), vecProcesses.data(), FALSE, ProgressIntervalMs);
+		PublishProgress(pHeader, pItems, progress);
+		if ( res == WAIT_TIMEOUT )
+			continue;
+		if ( res == WAIT_FAILED )
+			break;
+
+		uint64 index = res - WAIT_OBJECT_0;
+		HANDLE hProcess = vecProcesses[index];
+		uint32 slot = vecSlots[index];
+		vecProcesses.erase(vecProcesses.begin() + index);
+		vecSlots.erase(vecSlots.begin() + index);
+
+		DWORD exitCode = 0;
+		GetExitCodeProcess(hProcess, &exitCode);
+		CloseHandle(hProcess);
+
+		uint64 crashedItem = pHeader->slots[slot].currentItem.exchange(IdleSlot);
+		if ( crashedItem != IdleSlot && WasProcessing(pHeader, pItems, slot, crashedItem) ) {
+			IsolatedItem& item = pItems[crashedItem];
+			item.status = uint32(ItemStatus::Quarantined);
+			std::string fName = vecInfos[vecOrder[crashedItem]].path.filename().string();
+			vecQuarantined.push_back(fName);
+			Print(std::format("Worker {} crashed (exit code 0x{:X}) on '{}', the file is quarantined", slot, exitCode, fName));
+			numStartupFailures = 0;
+		} else if ( crashedItem == IdleSlot && exitCode != 0 ) {
+			++numStartupFailures;
+		}
+
+		if ( pHeader->nextItem >= pHeader->numItems )
+			continue;
+
+		if ( numStartupFailures >= MaxStartupFailures ) {
+			if ( vecProcesses.empty() )
+				vecErrors.emplace_back(std::format("Worker processes keep failing to start (exit code 0x{:X}), giving up", exitCode));
+			continue;
+		}
+
+		if ( HANDLE hNew = SpawnWorker(sectionName, slot, hJob) ) {
+			vecProcesses.push_back(hNew);
+			vecSlots.push_back(slot);
+		}
+	}
+
+	// Quarantined items and whatever finished since the last wait
+	PublishProgress(pHeader, pItems, progress);
+
+	std::vector<IsolatedResult> vecResults(vecOrder.size());
+	for ( uint64 i = 0; i < vecOrder.size(); ++i ) {
+		const IsolatedItem& item = pItems[i];
+		vecResults[i] = {ItemStatus(item.status.load()), item.nanoseconds};
+		if ( item.errors[0] != '\0' )
+			vecErrors.emplace_back(item.errors);
+		if ( vecResults[i].status == ItemStatus::Pending )
+			vecErrors.emplace_back(std::format("File: '{}': Was not processed, no worker process was left", vecInfos[vecOrder[i]].path.filename().string()));
+	}
+
+	if ( !vecQuarantined.empty() ) {
+		std::ofstream file("./Textures_OUT/quarantine.txt");
+		for ( const std::string& fName : vecQuarantined ) {
+			file << fName << '\n';
+			vecErrors.emplace_back(std::format("File: '{}': Crashed a worker process and was quarantined", fName));
+		}
+	}
+
+	CloseHandle(hJob);
+	UnmapViewOfFile(pHeader);
+	CloseHandle(hMapping);
+	return vecResults;
+}
+
+int RunWorker(const std::string& arg, const std::function<bool(const TCOFileInfo&, std::vector<std::string>&)>& process) {
+	// A crash must end the process right away instead of waiting on an error dialog
+	SetErrorMode(SEM_FAILCRITICALERRORS | SEM_NOGPFAULTERRORBOX);
+
+	uint64 comma = arg.rfind(',');
+	uint32 slot = 0;
+	if ( comma == std::string::npos || std::from_chars(arg.data() + comma + 1, arg.data() + arg.size(), slot).ec != std::errc() || slot >= MaxWorkers )
+		return 1;
+
+	HANDLE hMapping = nullptr;
+	std::wstring sectionName(arg.begin(), arg.begin() + comma);
+	IsolationHeader* pHeader = MapSection(sectionName, 0, hMapping);
+	if ( pHeader == nullptr || pHeader->magic != IsolationMagic )
+		return 1;
+
+	PackReader pack;
+	if ( !gOptions.packPath.empty() && !pack.Open(gOptions.packPath).empty() )
+		return 1;
+
+	IsolatedItem* pItems = GetItems(pHeader);
+	const char* pNames = (const char*)pHeader + pHeader->namesOffset;
+	WorkerSlot& workerSlot = pHeader->slots[slot];
+
+	uint64 i;
+	while ( ClaimItem(pHeader, workerSlot, i) ) {
+		IsolatedItem& item = pItems[i];
+
+		TCOFileInfo info;
+		info.path = std::filesystem::path(std::u8string((const char8_t*)pNames + item.pathOffset, item.pathLength));
+		info.fileSize = item.fileSize;
+		info.compHeader = item.compHeader;
+		info.tcoHeader = item.tcoHeader;
+		if ( pack.GetNumEntries() != 0 ) {
+			if ( const PackEntry* pEntry = pack.Find(info.path.string()) )
+				info.pData = pack.GetData(*pEntry);
+		}
+
+		uint64 stageBytes[int(FileStage::Count)];
+		for ( int stage = 0; stage < int(FileStage::Count); ++stage )
+			stageBytes[stage] = GetStageBytes(FileStage(stage));
+
+		std::vector<std::string> vecErrors;
+		auto start = std::chrono::steady_clock::now();
+		bool res = process(info, vecErrors);
+		item.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		for ( int stage = 0; stage < int(FileStage::Count); ++stage )
+			item.stageBytes[stage] = GetStageBytes(FileStage(stage)) - stageBytes[stage];
+
+		std::string errors;
+		for ( const std::string& err : vecErrors )
+			errors += errors.empty() ? err : " / " + err;
+		uint64 length = std::min(errors.size(), sizeof(item.errors) - 1);
+		memcpy(item.errors, errors.data(), length);
+		item.errors[length] = '\0';
+
+		item.status = uint32(res ? ItemStatus::Done : ItemStatus::Failed);
+		workerSlot.currentItem = IdleSlot;
+	}
+
+	UnmapViewOfFile(pHeader);
+	CloseHandle(hMapping);
+	return 0;
+}
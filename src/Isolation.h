@@ -0,0 +1,28 @@
+#pragma once
+
+#include <functional>
+
+#include "Common.h"
+#include "TCO.h"
+
+enum class ItemStatus : uint32 {
+	Pending, Done, Failed, Quarantined
+};
+
+struct IsolatedResult {
+	ItemStatus status;
+	uint64 nanoseconds;
+};
+
+// Processes vecInfos in `vecOrder` on `numWorkers` child processes of this executable, started with the same
+// arguments plus --worker=. Files and results are exchanged through one shared memory section; outputs are
+// written by the workers themselves, so no pixel data crosses process boundaries.
+// A worker that crashes is restarted, and the file it was on is quarantined instead of retried: it is
+// reported and listed in ./Textures_OUT/quarantine.txt. Errors the workers logged are appended to `vecErrors`.
+// Files started and finished, their errors and stage bytes are recorded to the metrics while the workers run.
+// Returns one result per entry of `vecOrder`.
+std::vector<IsolatedResult> RunIsolated(const std::vector<TCOFileInfo>& vecInfos, const std::vector<uint64>& vecOrder, uint32 numWorkers, std::vector<std::string>& vecErrors);
+
+// Worker side of RunIsolated(), `arg` is the value of --worker=. `process` handles one file and hands
+// over the errors it logged.
+int RunWorker(const std::string& arg, const std::function<bool(const TCOFileInfo&, std::vector<std::string>&)>& process);
@@ -0,0 +1,433 @@
+#include "JPEGEncode.h"
+#include "Kernels.h"
+#include "Scheduler.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+
+/*
+	stbi_write_jpg() encodes on one thread with a scalar DCT, and always takes a copy of the image as floats.
+	This encoder converts one band of MCU rows at a time straight from the decoded pixels, runs the colour
+	conversion and the DCT through the SIMD kernels, and splits larger images into segments separated by
+	restart markers. The Huffman coder starts over at every marker, so the segments are independent and
+	encoded on helper threads, and the output is the same whatever the number of threads.
+*/
+
+// Pixels per restart interval, smaller ones cost more in thread handoffs and markers than they gain
+constexpr uint64 MinPixelsPerSegment = 256 * 1024;
+
+// Row order index of every coefficient in zigzag order
+static constexpr uint8 ZigZag[64] = {
+	0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// Quantizer steps of JPEG Annex K at quality 50, in row order
+static constexpr uint8 LumaQuant[64] = {
+	16, 11, 10, 16, 24, 40, 51, 61,
+	12, 12, 14, 19, 26, 58, 60, 55,
+	14, 13, 16, 24, 40, 57, 69, 56,
+	14, 17, 22, 29, 51, 87, 80, 62,
+	18, 22, 37, 56, 68, 109, 103, 77,
+	24, 35, 55, 64, 81, 104, 113, 92,
+	49, 64, 78, 87, 103, 121, 120, 101,
+	72, 92, 95, 98, 112, 100, 103, 99
+};
+static constexpr uint8 ChromaQuant[64] = {
+	17, 18, 24, 47, 99, 99, 99, 99,
+	18, 21, 26, 66, 99, 99, 99, 99,
+	24, 26, 56, 99, 99, 99, 99, 99,
+	47, 66, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// Scale of every output of the AAN DCT relative to the true DCT, which the quantizer absorbs
+static constexpr float AANScales[8] = {1.0f, 1.387039845f, 1.306562965f, 1.175875602f, 1.0f, 0.785694958f, 0.541196100f, 0.275899379f};
+
+// Huffman tables of JPEG Annex K.3: the number of codes of every length from 1 to 16 bits, then the symbols
+static constexpr uint8 DCLumaBits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static constexpr uint8 DCChromaBits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static constexpr uint8 DCValues[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static constexpr uint8 ACLumaBits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D};
+static constexpr uint8 ACLumaValues[162] = {
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08,
+	0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+	0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+	0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6,
+	0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+	0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA
+};
+static constexpr uint8 ACChromaBits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static constexpr uint8 ACChromaValues[162] = {
+	0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+	0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0, 0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+	0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+	0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4,
+	0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+	0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA
+};
+
+struct HuffmanTable {
+	uint16 code[256];
+	uint8 size[256];
+};
+
+// Canonical codes: shortest first, each length continuing from the last code of the previous one shifted left
+static HuffmanTable BuildHuffmanTable(const uint8* bits, const uint8* values) {
+	HuffmanTable table = {};
+	uint32 code = 0;
+	uint32 k = 0;
+	for ( uint32 length = 1; length <= 16; ++length ) {
+		for ( uint32 i = 0; i < bits[length - 1]; ++i, ++k ) {
+			table.code[values[k]] = uint16(code++);
+			table.size[values[k]] = uint8(length);
+		}
+		code <<= 1;
+	}
+	return table;
+}
+
+// Indexed by component class, 0 for luma and 1 for chroma
+struct HuffmanTables {
+	HuffmanTable dc[2];
+	HuffmanTable ac[2];
+};
+
+static const HuffmanTables& GetHuffmanTables() {
+	static const HuffmanTables tables = {
+		{BuildHuffmanTable(DCLumaBits, DCValues), BuildHuffmanTable(DCChromaBits, DCValues)},
+		{BuildHuffmanTable(ACLumaBits, ACLumaValues), BuildHuffmanTable(ACChromaBits, ACChromaValues)}
+	};
+	return tables;
+}
+
+struct JPEGSetup {
+	const DecodedImage* pImg;
+	bool colour;
+	// 4:2:0 chroma, the MCU is 16x16 pixels with 4 luma blocks instead of 8x8 with one
+	bool subsample;
+	uint32 mcuSize;
+	uint32 numMCUCols;
+	uint32 numMCURows;
+	// Indexed by component class like HuffmanTables, in row order
+	uint8 quant[2][64];
+	float scales[2][64];
+};
+
+class BitWriter {
+public:
+	explicit BitWriter(std::vector<uint8>& out) : m_out(out) {}
+
+	void Put(uint32 bits, uint32 numBits) {
+		m_buffer = (m_buffer << numBits) | bits;
+		m_numBits += numBits;
+		while ( m_numBits >= 8 ) {
+			m_numBits -= 8;
+			uint8 byte = uint8(m_buffer >> m_numBits);
+			m_out.push_back(byte);
+			// A stuffed 0 keeps 0xFF in the entropy coded data from reading as a marker
+			if ( byte == 0xFF )
+				m_out.push_back(0);
+		}
+	}
+
+	// Pads the last byte with 1 bits, segments end on a byte boundary
+	void Flush() {
+		if ( m_numBits != 0 )
+			Put((1u << (8 - m_numBits)) - 1, 8 - m_numBits);
+	}
+
+private:
+	std::vector<uint8>& m_out;
+	uint64 m_buffer = 0;
+	uint32 m_numBits = 0;
+};
+
+// Writes the size category of `value` with the code of `symbol` (which includes it), then its low bits
+static void PutValue(BitWriter& writer, const HuffmanTable& table, uint32 symbol, int value, uint32 category) {
+	writer.Put(table.code[symbol], table.size[symbol]);
+	if ( category != 0 )
+		writer.Put(uint32(value < 0 ? value - 1 : value) & ((1u << category) - 1), category);
+}
+
+static void EncodeBlock(BitWriter& writer, const int16_t* pCoeffs, int& prevDC, const HuffmanTable& dc, const HuffmanTable& ac) {
+	int diff = pCoeffs[0] - prevDC;
+	prevDC = pCoeffs[0];
+	uint32 category = uint32(std::bit_width(uint32(std::abs(diff))));
+	PutValue(writer, dc, category, diff, category);
+
+	uint32 run = 0;
+	for ( uint32 k = 1; k < 64; ++k ) {
+		int value = pCoeffs[ZigZag[k]];
+		if ( value == 0 ) {
+			++run;
+			continue;
+		}
+		for ( ; run >= 16; run -= 16 )
+			writer.Put(ac.code[0xF0], ac.size[0xF0]);
+
+		category = uint32(std::bit_width(uint32(std::abs(value))));
+		PutValue(writer, ac, (run << 4) | category, value, category);
+		run = 0;
+	}
+	if ( run != 0 )
+		writer.Put(ac.code[0x00], ac.size[0x00]);
+}
+
+// Entropy codes MCU rows [rowBegin, rowEnd) into `out`, as one restart interval
+static void EncodeSegment(const JPEGSetup& setup, uint32 rowBegin, uint32 rowEnd, std::vector<uint8>& out) {
+	const DecodedImage& img = *setup.pImg;
+	const HuffmanTables& tables = GetHuffmanTables();
+	uint32 mcuSize = setup.mcuSize;
+	uint32 numChannels = img.numChannels;
+
+	// One band of MCU rows at a time, padded to whole MCUs by repeating the last column and row
+	uint64 planeWidth = uint64(setup.numMCUCols) * mcuSize;
+	uint64 chromaWidth = setup.subsample ? planeWidth / 2 : planeWidth;
+	uint64 planeSize = planeWidth * mcuSize;
+	std::vector<float> vecY(planeSize);
+	std::vector<float> vecCb(setup.colour ? planeSize : 0);
+	std::vector<float> vecCr(setup.colour ? planeSize : 0);
+	std::vector<float> vecCbHalf(setup.subsample ? chromaWidth * 8 : 0);
+	std::vector<float> vecCrHalf(setup.subsample ? chromaWidth * 8 : 0);
+	// 64 coefficients per 64 pixels, blocks in row order
+	std::vector<int16_t> vecYCoeffs(planeSize);
+	std::vector<int16_t> vecCbCoeffs(setup.colour ? chromaWidth * 8 : 0);
+	std::vector<int16_t> vecCrCoeffs(setup.colour ? chromaWidth * 8 : 0);
+
+	BitWriter writer(out);
+	int prevDC[3] = {};
+	uint64 blocksPerRow = planeWidth / 8;
+
+	for ( uint32 mcuRow = rowBegin; mcuRow < rowEnd; ++mcuRow ) {
+		for ( uint32 row = 0; row < mcuSize; ++row ) {
+			uint32 y = std::min(mcuRow * mcuSize + row, img.height - 1);
+			const uint8* pSrc = img.pPixels.get() + uint64(y) * img.width * numChannels;
+			float* pY = vecY.data() + row * planeWidth;
+			if ( setup.colour ) {
+				float* pCb = vecCb.data() + row * planeWidth;
+				float* pCr = vecCr.data() + row * planeWidth;
+				gKernels.RGBAToYCbCr(pSrc, pY, pCb, pCr, img.width);
+				std::fill(pCb + img.width, pCb + planeWidth, pCb[img.width - 1]);
+				std::fill(pCr + img.width, pCr + planeWidth, pCr[img.width - 1]);
+			} else {
+				for ( uint32 x = 0; x < img.width; ++x )
+					pY[x] = float(pSrc[uint64(x) * numChannels]) - 128.0f;
+			}
+			std::fill(pY + img.width, pY + planeWidth, pY[img.width - 1]);
+		}
+
+		for ( uint32 blockRow = 0; blockRow < mcuSize / 8; ++blockRow )
+			gKernels.ForwardDCT8x8(vecY.data() + blockRow * 8 * planeWidth, planeWidth, blocksPerRow, setup.scales[0], vecYCoeffs.data() + blockRow * planeWidth * 8);
+
+		if ( setup.colour ) {
+			const float* pCb = vecCb.data();
+			const float* pCr = vecCr.data();
+			if ( setup.subsample ) {
+				for ( uint64 row = 0; row < 8; ++row ) {
+					for ( uint64 x = 0; x < chromaWidth; ++x ) {
+						uint64 i = row * 2 * planeWidth + x * 2;
+						vecCbHalf[row * chromaWidth + x] = ((pCb[i] + pCb[i + 1]) + (pCb[i + planeWidth] + pCb[i + planeWidth + 1])) * 0.25f;
+						vecCrHalf[row * chromaWidth + x] = ((pCr[i] + pCr[i + 1]) + (pCr[i + planeWidth] + pCr[i + planeWidth + 1])) * 0.25f;
+					}
+				}
+				pCb = vecCbHalf.data();
+				pCr = vecCrHalf.data();
+			}
+			gKernels.ForwardDCT8x8(pCb, chromaWidth, chromaWidth / 8, setup.scales[1], vecCbCoeffs.data());
+			gKernels.ForwardDCT8x8(pCr, chromaWidth, chromaWidth / 8, setup.scales[1], vecCrCoeffs.data());
+		}
+
+		uint32 blocksPerMCU = mcuSize / 8;
+		for ( uint32 mcu = 0; mcu < setup.numMCUCols; ++mcu ) {
+			for ( uint32 by = 0; by < blocksPerMCU; ++by ) {
+				for ( uint32 bx = 0; bx < blocksPerMCU; ++bx ) {
+					const int16_t* pBlock = vecYCoeffs.data() + (by * blocksPerRow + mcu * blocksPerMCU + bx) * 64;
+					EncodeBlock(writer, pBlock, prevDC[0], tables.dc[0], tables.ac[0]);
+				}
+			}
+			if ( setup.colour ) {
+				EncodeBlock(writer, vecCbCoeffs.data() + mcu * 64, prevDC[1], tables.dc[1], tables.ac[1]);
+				EncodeBlock(writer, vecCrCoeffs.data() + mcu * 64, prevDC[2], tables.dc[1], tables.ac[1]);
+			}
+		}
+	}
+	writer.Flush();
+}
+
+static void PutU16(std::vector<uint8>& out, uint32 value) {
+	out.push_back(uint8(value >> 8));
+	out.push_back(uint8(value));
+}
+
+static void PutHuffmanTable(std::vector<uint8>& out, uint8 id, const uint8* bits, const uint8* values) {
+	uint32 numValues = 0;
+	for ( uint32 i = 0; i < 16; ++i )
+		numValues += bits[i];
+	out.push_back(id);
+	out.insert(out.end(), bits, bits + 16);
+	out.insert(out.end(), values, values + numValues);
+}
+
+// Everything up to the entropy coded data. `restartInterval` is in MCUs, 0 = no restart markers.
+static void WriteHeaders(const JPEGSetup& setup, uint32 restartInterval, std::vector<uint8>& out) {
+	const DecodedImage& img = *setup.pImg;
+	uint32 numComponents = setup.colour ? 3 : 1;
+	uint32 numTables = setup.colour ? 2 : 1;
+
+	static constexpr uint8 JFIFHeader[] = {
+		0xFF, 0xD8, // SOI
+		0xFF, 0xE0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 // APP0: JFIF 1.1, 1:1 pixel aspect, no thumbnail
+	};
+	out.insert(out.end(), std::begin(JFIFHeader), std::end(JFIFHeader));
+
+	out.push_back(0xFF);
+	out.push_back(0xDB); // DQT
+	PutU16(out, 2 + numTables * 65);
+	for ( uint32 t = 0; t < numTables; ++t ) {
+		out.push_back(uint8(t));
+		for ( uint32 k = 0; k < 64; ++k )
+			out.push_back(setup.quant[t][ZigZag[k]]);
+	}
+
+	out.push_back(0xFF);
+	out.push_back(0xC0); // SOF0
+	PutU16(out, 8 + numComponents * 3);
+	out.push_back(8);
+	PutU16(out, img.height);
+	PutU16(out, img.width);
+	out.push_back(uint8(numComponents));
+	for ( uint32 c = 0; c < numComponents; ++c ) {
+		out.push_back(uint8(c + 1));
+		out.push_back(c == 0 && setup.subsample ? 0x22 : 0x11);
+		out.push_back(c == 0 ? 0 : 1);
+	}
+
+	out.push_back(0xFF);
+	out.push_back(0xC4); // DHT
+	// Length filled in below, once the tables are written
+	uint64 lengthPos = out.size();
+	PutU16(out, 0);
+	PutHuffmanTable(out, 0x00, DCLumaBits, DCValues);
+	PutHuffmanTable(out, 0x10, ACLumaBits, ACLumaValues);
+	if ( setup.colour ) {
+		PutHuffmanTable(out, 0x01, DCChromaBits, DCValues);
+		PutHuffmanTable(out, 0x11, ACChromaBits, ACChromaValues);
+	}
+	uint64 dhtLength = out.size() - lengthPos;
+	out[lengthPos] = uint8(dhtLength >> 8);
+	out[lengthPos + 1] = uint8(dhtLength);
+
+	if ( restartInterval != 0 ) {
+		out.push_back(0xFF);
+		out.push_back(0xDD); // DRI
+		PutU16(out, 4);
+		PutU16(out, restartInterval);
+	}
+
+	out.push_back(0xFF);
+	out.push_back(0xDA); // SOS
+	PutU16(out, 6 + numComponents * 2);
+	out.push_back(uint8(numComponents));
+	for ( uint32 c = 0; c < numComponents; ++c ) {
+		out.push_back(uint8(c + 1));
+		out.push_back(c == 0 ? 0x00 : 0x11);
+	}
+	// Spectral selection 0-63 and no successive approximation, as baseline requires
+	out.push_back(0);
+	out.push_back(63);
+	out.push_back(0);
+}
+
+// Fills in everything but the pixels, false if the image cannot be written as baseline JPEG
+static bool InitSetup(const DecodedImage& img, uint32 quality, JPEGSetup& setup) {
+	if ( img.width == 0 || img.height == 0 || img.width > 0xFFFF || img.height > 0xFFFF )
+		return false;
+	if ( img.numChannels != 1 && img.numChannels != 2 && img.numChannels != 4 )
+		return false;
+
+	setup.pImg = &img;
+	quality = std::clamp(quality, 1u, 100u);
+	setup.colour = img.numChannels == 4;
+	setup.subsample = setup.colour && quality <= 90;
+	setup.mcuSize = setup.subsample ? 16 : 8;
+	setup.numMCUCols = (img.width + setup.mcuSize - 1) / setup.mcuSize;
+	setup.numMCURows = (img.height + setup.mcuSize - 1) / setup.mcuSize;
+
+	uint32 scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+	for ( uint32 i = 0; i < 64; ++i ) {
+		const uint8* base[2] = {LumaQuant, ChromaQuant};
+		for ( uint32 t = 0; t < 2; ++t ) {
+			uint32 step = std::clamp((base[t][i] * scale + 50) / 100, 1u, 255u);
+			setup.quant[t][i] = uint8(step);
+			setup.scales[t][i] = 1.0f / (float(step) * AANScales[i / 8] * AANScales[i % 8] * 8.0f);
+		}
+	}
+	return true;
+}
+
+// Segments of whole MCU rows of about MinPixelsPerSegment each, so the output does not depend on the thread count.
+// Their length in MCUs has to fit the 16 bit restart interval.
+static uint32 GetRowsPerSegment(const JPEGSetup& setup) {
+	uint64 pixelsPerMCURow = uint64(setup.numMCUCols) * setup.mcuSize * setup.mcuSize;
+	return uint32(std::clamp<uint64>(MinPixelsPerSegment / pixelsPerMCURow, 1, 0xFFFF / setup.numMCUCols));
+}
+
+uint64 GetJPEGSizeBound(uint32 width, uint32 height, uint32 numChannels, uint32 quality) {
+	DecodedImage img;
+	img.width = width;
+	img.height = height;
+	img.numChannels = numChannels;
+	JPEGSetup setup;
+	if ( !InitSetup(img, quality, setup) )
+		return 0;
+
+	uint32 rowsPerSegment = GetRowsPerSegment(setup);
+	uint32 numSegments = (setup.numMCURows + rowsPerSegment - 1) / rowsPerSegment;
+	std::vector<uint8> vecHeaders;
+	WriteHeaders(setup, numSegments > 1 ? rowsPerSegment * setup.numMCUCols : 0, vecHeaders);
+
+	// Every coefficient of a block at most a 16 bit code and 11 value bits, and every byte of that stuffed.
+	// Each segment adds its padding byte (stuffed as well) and its RST marker, then comes the EOI.
+	constexpr uint64 maxBlockSize = 2 * (64 * (16 + 11) / 8);
+	uint64 blocksPerMCU = setup.subsample ? 6 : setup.colour ? 3 : 1;
+	uint64 numBlocks = uint64(setup.numMCUCols) * setup.numMCURows * blocksPerMCU;
+	return vecHeaders.size() + numBlocks * maxBlockSize + numSegments * 4 + 2;
+}
+
+bool EncodeJPEG(const DecodedImage& img, uint32 quality, std::vector<uint8>& out) {
+	out.clear();
+	JPEGSetup setup;
+	if ( !InitSetup(img, quality, setup) )
+		return false;
+
+	uint32 rowsPerSegment = GetRowsPerSegment(setup);
+	uint32 numSegments = (setup.numMCURows + rowsPerSegment - 1) / rowsPerSegment;
+
+	// On the helper threads shared with all other encodes, so concurrent encodes of many files do not multiply them
+	std::vector<std::vector<uint8>> vecSegments(numSegments);
+	ParallelForHelpers(numSegments, [&](uint64 s) {
+		uint32 rowBegin = uint32(s) * rowsPerSegment;
+		EncodeSegment(setup, rowBegin, std::min(rowBegin + rowsPerSegment, setup.numMCURows), vecSegments[s]);
+	});
+
+	WriteHeaders(setup, numSegments > 1 ? rowsPerSegment * setup.numMCUCols : 0, out);
+	for ( uint32 s = 0; s < numSegments; ++s ) {
+		out.insert(out.end(), vecSegments[s].begin(), vecSegments[s].end());
+		if ( s + 1 < numSegments ) {
+			out.push_back(0xFF);
+			out.push_back(uint8(0xD0 + s % 8)); // RSTn
+		}
+	}
+	out.push_back(0xFF);
+	out.push_back(0xD9); // EOI
+	return true;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "Common.h"
+#include "Decoder.h"
+
+// Baseline JPEG of the 8 bit pixels with the standard Huffman tables, at a `quality` of 1-100 scaled like libjpeg's.
+// 1 and 2 channel images are written as greyscale of their first channel, like the TGA and PNG outputs show them,
+// 4 channel ones in colour, with 4:2:0 chroma up to quality 90. Alpha is dropped.
+// Large images are cut into restart intervals of whole MCU rows, which are encoded in parallel.
+bool EncodeJPEG(const DecodedImage& img, uint32 quality, std::vector<uint8>& out);
+
+// Largest file EncodeJPEG() can write for an image of this size and quality, whatever its pixels. 0 if it cannot encode it.
+uint64 GetJPEGSizeBound(uint32 width, uint32 height, uint32 numChannels, uint32 quality);
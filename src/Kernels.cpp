@@ -0,0 +1,586 @@
+#include "Kernels.h"
+
+#include <bit>
+#include <cmath>
+#include <utility>
+
+#include <intrin.h>
+
+/*
+	All SIMD variants live in this one translation unit.
+	MSVC allows intrinsics of any instruction set without /arch, so nothing here may be called
+	unless BindKernels() selected it for a level that DetectCpuLevel() reported.
+*/
+
+KernelTable gKernels;
+
+
+// v / 257 == (v * 0xFF01) >> 24 for every 16 bit v, which lets the divide become a mulhi + shift
+static void Narrow16To8_Scalar(const uint16* src, uint8* dst, uint64 count, uint32 srcStride) {
+	for ( uint64 i = 0; i < count; ++i )
+		dst[i] = uint8(src[i * srcStride] / 257);
+}
+
+static void Narrow16To8_SSE2(const uint16* src, uint8* dst, uint64 count, uint32 srcStride) {
+	const __m128i mul = _mm_set1_epi16(short(0xFF01));
+	uint64 i = 0;
+
+	if ( srcStride == 1 ) {
+		for ( ; i + 16 <= count; i += 16 ) {
+			__m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i b = _mm_loadu_si128((const __m128i*)(src + i + 8));
+			a = _mm_srli_epi16(_mm_mulhi_epu16(a, mul), 8);
+			b = _mm_srli_epi16(_mm_mulhi_epu16(b, mul), 8);
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(a, b));
+		}
+	} else if ( srcStride == 2 ) {
+		// Narrow everything, then keep the low (even) 16 bits of every 32 bit lane.
+		// The results are <= 255, so the signed 32->16 pack cannot saturate.
+		const __m128i mask = _mm_set1_epi32(0xFFFF);
+		for ( ; i + 16 <= count; i += 16 ) {
+			const uint16* p = src + i * 2;
+			__m128i a = _mm_loadu_si128((const __m128i*)(p + 0));
+			__m128i b = _mm_loadu_si128((const __m128i*)(p + 8));
+			__m128i c = _mm_loadu_si128((const __m128i*)(p + 16));
+			__m128i d = _mm_loadu_si128((const __m128i*)(p + 24));
+			a = _mm_and_si128(_mm_srli_epi16(_mm_mulhi_epu16(a, mul), 8), mask);
+			b = _mm_and_si128(_mm_srli_epi16(_mm_mulhi_epu16(b, mul), 8), mask);
+			c = _mm_and_si128(_mm_srli_epi16(_mm_mulhi_epu16(c, mul), 8), mask);
+			d = _mm_and_si128(_mm_srli_epi16(_mm_mulhi_epu16(d, mul), 8), mask);
+			__m128i ab = _mm_packs_epi32(a, b);
+			__m128i cd = _mm_packs_epi32(c, d);
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(ab, cd));
+		}
+	}
+
+	Narrow16To8_Scalar(src + i * srcStride, dst + i, count - i, srcStride);
+}
+
+static void Narrow16To8_AVX2(const uint16* src, uint8* dst, uint64 count, uint32 srcStride) {
+	const __m256i mul = _mm256_set1_epi16(short(0xFF01));
+	uint64 i = 0;
+
+	if ( srcStride == 1 ) {
+		for ( ; i + 32 <= count; i += 32 ) {
+			__m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 16));
+			a = _mm256_srli_epi16(_mm256_mulhi_epu16(a, mul), 8);
+			b = _mm256_srli_epi16(_mm256_mulhi_epu16(b, mul), 8);
+			// Packing works per 128 bit lane, restore the order of the 64 bit quarters
+			__m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+			_mm256_storeu_si256((__m256i*)(dst + i), r);
+		}
+	} else if ( srcStride == 2 ) {
+		const __m256i mask = _mm256_set1_epi32(0xFFFF);
+		const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+		for ( ; i + 32 <= count; i += 32 ) {
+			const uint16* p = src + i * 2;
+			__m256i a = _mm256_loadu_si256((const __m256i*)(p + 0));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(p + 16));
+			__m256i c = _mm256_loadu_si256((const __m256i*)(p + 32));
+			__m256i d = _mm256_loadu_si256((const __m256i*)(p + 48));
+			a = _mm256_and_si256(_mm256_srli_epi16(_mm256_mulhi_epu16(a, mul), 8), mask);
+			b = _mm256_and_si256(_mm256_srli_epi16(_mm256_mulhi_epu16(b, mul), 8), mask);
+			c = _mm256_and_si256(_mm256_srli_epi16(_mm256_mulhi_epu16(c, mul), 8), mask);
+			d = _mm256_and_si256(_mm256_srli_epi16(_mm256_mulhi_epu16(d, mul), 8), mask);
+			__m256i ab = _mm256_packs_epi32(a, b);
+			__m256i cd = _mm256_packs_epi32(c, d);
+			__m256i r = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(ab, cd), order);
+			_mm256_storeu_si256((__m256i*)(dst + i), r);
+		}
+	}
+
+	Narrow16To8_Scalar(src + i * srcStride, dst + i, count - i, srcStride);
+}
+
+static void Narrow16To8_AVX512(const uint16* src, uint8* dst, uint64 count, uint32 srcStride) {
+	const __m512i mul = _mm512_set1_epi16(short(0xFF01));
+	uint64 i = 0;
+
+	if ( srcStride == 1 ) {
+		for ( ; i + 32 <= count; i += 32 ) {
+			__m512i a = _mm512_loadu_si512((const void*)(src + i));
+			a = _mm512_srli_epi16(_mm512_mulhi_epu16(a, mul), 8);
+			_mm256_storeu_si256((__m256i*)(dst + i), _mm512_cvtepi16_epi8(a));
+		}
+	} else if ( srcStride == 2 ) {
+		// The low byte of every 32 bit lane is the narrowed even element
+		for ( ; i + 16 <= count; i += 16 ) {
+			__m512i a = _mm512_loadu_si512((const void*)(src + i * 2));
+			a = _mm512_srli_epi16(_mm512_mulhi_epu16(a, mul), 8);
+			_mm_storeu_si128((__m128i*)(dst + i), _mm512_cvtepi32_epi8(a));
+		}
+	}
+
+	Narrow16To8_Scalar(src + i * srcStride, dst + i, count - i, srcStride);
+}
+
+
+/*
+	R11G11B10_FLOAT has no sign bit and a 5 bit exponent with bias 15, like half floats.
+	Moving a channel's exponent and mantissa to the top of a float's exponent field and
+	multiplying by 2^(127 - 15) rebiases it, and handles denormals the same way.
+*/
+constexpr float R11G11B10Rebias = 5.192296858534828e33f; // 2^112
+
+static float UnpackFloat11(uint32 bits) {
+	uint32 f = (bits & 0x7FF) << 17;
+	return std::bit_cast<float>(f) * R11G11B10Rebias;
+}
+
+static float UnpackFloat10(uint32 bits) {
+	uint32 f = (bits & 0x3FF) << 18;
+	return std::bit_cast<float>(f) * R11G11B10Rebias;
+}
+
+static void UnpackR11G11B10_Scalar(const uint32* src, float* dst, uint64 count) {
+	for ( uint64 i = 0; i < count; ++i ) {
+		uint32 p = src[i];
+		dst[i * 4 + 0] = UnpackFloat11(p);
+		dst[i * 4 + 1] = UnpackFloat11(p >> 11);
+		dst[i * 4 + 2] = UnpackFloat10(p >> 22);
+		dst[i * 4 + 3] = 1.0f;
+	}
+}
+
+static uint32 TonemapChannel(float c, float exposure) {
+	c = c * exposure;
+	float t = c / (1.0f + c);
+	float s = std::sqrt(t) * 255.0f;
+	return uint32(int(s + 0.5f));
+}
+
+static void TonemapR11G11B10_Scalar(const uint32* src, uint8* dst, uint64 count, float exposure) {
+	for ( uint64 i = 0; i < count; ++i ) {
+		uint32 p = src[i];
+		dst[i * 4 + 0] = uint8(TonemapChannel(UnpackFloat11(p), exposure));
+		dst[i * 4 + 1] = uint8(TonemapChannel(UnpackFloat11(p >> 11), exposure));
+		dst[i * 4 + 2] = uint8(TonemapChannel(UnpackFloat10(p >> 22), exposure));
+		dst[i * 4 + 3] = 255;
+	}
+}
+
+// Channels of 4 pixels as floats, one register per channel
+static void UnpackR11G11B10x4(__m128i p, __m128& r, __m128& g, __m128& b) {
+	const __m128i mask11 = _mm_set1_epi32(0x7FF);
+	const __m128 rebias = _mm_set1_ps(R11G11B10Rebias);
+	r = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(p, mask11), 17)), rebias);
+	g = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(p, 11), mask11), 17)), rebias);
+	b = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(_mm_srli_epi32(p, 22), 18)), rebias);
+}
+
+static void UnpackR11G11B10_SSE2(const uint32* src, float* dst, uint64 count) {
+	uint64 i = 0;
+	for ( ; i + 4 <= count; i += 4 ) {
+		__m128 r, g, b;
+		UnpackR11G11B10x4(_mm_loadu_si128((const __m128i*)(src + i)), r, g, b);
+		__m128 a = _mm_set1_ps(1.0f);
+		_MM_TRANSPOSE4_PS(r, g, b, a);
+		_mm_storeu_ps(dst + i * 4 + 0, r);
+		_mm_storeu_ps(dst + i * 4 + 4, g);
+		_mm_storeu_ps(dst + i * 4 + 8, b);
+		_mm_storeu_ps(dst + i * 4 + 12, a);
+	}
+
+	UnpackR11G11B10_Scalar(src + i, dst + i * 4, count - i);
+}
+
+static __m128i TonemapChannelx4(__m128 c, __m128 exposure) {
+	c = _mm_mul_ps(c, exposure);
+	__m128 t = _mm_div_ps(c, _mm_add_ps(_mm_set1_ps(1.0f), c));
+	__m128 s = _mm_mul_ps(_mm_sqrt_ps(t), _mm_set1_ps(255.0f));
+	return _mm_cvttps_epi32(_mm_add_ps(s, _mm_set1_ps(0.5f)));
+}
+
+static void TonemapR11G11B10_SSE2(const uint32* src, uint8* dst, uint64 count, float exposure) {
+	const __m128 vExposure = _mm_set1_ps(exposure);
+	const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+	uint64 i = 0;
+	for ( ; i + 4 <= count; i += 4 ) {
+		__m128 r, g, b;
+		UnpackR11G11B10x4(_mm_loadu_si128((const __m128i*)(src + i)), r, g, b);
+		// Every channel is <= 255, so the pixels are assembled with shifts instead of a transpose
+		__m128i px = _mm_or_si128(TonemapChannelx4(r, vExposure), _mm_slli_epi32(TonemapChannelx4(g, vExposure), 8));
+		px = _mm_or_si128(px, _mm_or_si128(_mm_slli_epi32(TonemapChannelx4(b, vExposure), 16), alpha));
+		_mm_storeu_si128((__m128i*)(dst + i * 4), px);
+	}
+
+	TonemapR11G11B10_Scalar(src + i, dst + i * 4, count - i, exposure);
+}
+
+static void UnpackR11G11B10x8(__m256i p, __m256& r, __m256& g, __m256& b) {
+	const __m256i mask11 = _mm256_set1_epi32(0x7FF);
+	const __m256 rebias = _mm256_set1_ps(R11G11B10Rebias);
+	r = _mm256_mul_ps(_mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(p, mask11), 17)), rebias);
+	g = _mm256_mul_ps(_mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(p, 11), mask11), 17)), rebias);
+	b = _mm256_mul_ps(_mm256_castsi256_ps(_mm256_slli_epi32(_mm256_srli_epi32(p, 22), 18)), rebias);
+}
+
+static void UnpackR11G11B10_AVX2(const uint32* src, float* dst, uint64 count) {
+	uint64 i = 0;
+	for ( ; i + 8 <= count; i += 8 ) {
+		__m256 r, g, b;
+		UnpackR11G11B10x8(_mm256_loadu_si256((const __m256i*)(src + i)), r, g, b);
+		__m256 a = _mm256_set1_ps(1.0f);
+
+		// 4x4 transposes within each 128 bit lane give pixels 0-3 in the low and 4-7 in the high lanes
+		__m256 rg0 = _mm256_unpacklo_ps(r, g);
+		__m256 rg1 = _mm256_unpackhi_ps(r, g);
+		__m256 ba0 = _mm256_unpacklo_ps(b, a);
+		__m256 ba1 = _mm256_unpackhi_ps(b, a);
+		__m256 p04 = _mm256_shuffle_ps(rg0, ba0, 0x44);
+		__m256 p15 = _mm256_shuffle_ps(rg0, ba0, 0xEE);
+		__m256 p26 = _mm256_shuffle_ps(rg1, ba1, 0x44);
+		__m256 p37 = _mm256_shuffle_ps(rg1, ba1, 0xEE);
+
+		float* pOut = dst + i * 4;
+		_mm256_storeu_ps(pOut + 0, _mm256_permute2f128_ps(p04, p15, 0x20));
+		_mm256_storeu_ps(pOut + 8, _mm256_permute2f128_ps(p26, p37, 0x20));
+		_mm256_storeu_ps(pOut + 16, _mm256_permute2f128_ps(p04, p15, 0x31));
+		_mm256_storeu_ps(pOut + 24, _mm256_permute2f128_ps(p26, p37, 0x31));
+	}
+
+	UnpackR11G11B10_Scalar(src + i, dst + i * 4, count - i);
+}
+
+static __m256i TonemapChannelx8(__m256 c, __m256 exposure) {
+	c = _mm256_mul_ps(c, exposure);
+	__m256 t = _mm256_div_ps(c, _mm256_add_ps(_mm256_set1_ps(1.0f), c));
+	__m256 s = _mm256_mul_ps(_mm256_sqrt_ps(t), _mm256_set1_ps(255.0f));
+	return _mm256_cvttps_epi32(_mm256_add_ps(s, _mm256_set1_ps(0.5f)));
+}
+
+static void TonemapR11G11B10_AVX2(const uint32* src, uint8* dst, uint64 count, float exposure) {
+	const __m256 vExposure = _mm256_set1_ps(exposure);
+	const __m256i alpha = _mm256_set1_epi32(int(0xFF000000));
+	uint64 i = 0;
+	for ( ; i + 8 <= count; i += 8 ) {
+		__m256 r, g, b;
+		UnpackR11G11B10x8(_mm256_loadu_si256((const __m256i*)(src + i)), r, g, b);
+		__m256i px = _mm256_or_si256(TonemapChannelx8(r, vExposure), _mm256_slli_epi32(TonemapChannelx8(g, vExposure), 8));
+		px = _mm256_or_si256(px, _mm256_or_si256(_mm256_slli_epi32(TonemapChannelx8(b, vExposure), 16), alpha));
+		_mm256_storeu_si256((__m256i*)(dst + i * 4), px);
+	}
+
+	TonemapR11G11B10_Scalar(src + i, dst + i * 4, count - i, exposure);
+}
+
+
+static void TonemapRGBAFloat_Scalar(const float* src, uint8* dst, uint64 count, float exposure) {
+	for ( uint64 i = 0; i < count; ++i ) {
+		dst[i * 4 + 0] = uint8(TonemapChannel(src[i * 4 + 0], exposure));
+		dst[i * 4 + 1] = uint8(TonemapChannel(src[i * 4 + 1], exposure));
+		dst[i * 4 + 2] = uint8(TonemapChannel(src[i * 4 + 2], exposure));
+		dst[i * 4 + 3] = 255;
+	}
+}
+
+// Tone-maps all four channels of every pixel in place and overwrites alpha afterwards, which saves the transpose
+static void TonemapRGBAFloat_SSE2(const float* src, uint8* dst, uint64 count, float exposure) {
+	const __m128 vExposure = _mm_set1_ps(exposure);
+	const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+	uint64 i = 0;
+	for ( ; i + 4 <= count; i += 4 ) {
+		const float* p = src + i * 4;
+		__m128i a = TonemapChannelx4(_mm_loadu_ps(p + 0), vExposure);
+		__m128i b = TonemapChannelx4(_mm_loadu_ps(p + 4), vExposure);
+		__m128i c = TonemapChannelx4(_mm_loadu_ps(p + 8), vExposure);
+		__m128i d = TonemapChannelx4(_mm_loadu_ps(p + 12), vExposure);
+		__m128i px = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_or_si128(px, alpha));
+	}
+
+	TonemapRGBAFloat_Scalar(src + i * 4, dst + i * 4, count - i, exposure);
+}
+
+static void TonemapRGBAFloat_AVX2(const float* src, uint8* dst, uint64 count, float exposure) {
+	const __m256 vExposure = _mm256_set1_ps(exposure);
+	const __m256i alpha = _mm256_set1_epi32(int(0xFF000000));
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	uint64 i = 0;
+	for ( ; i + 8 <= count; i += 8 ) {
+		const float* p = src + i * 4;
+		__m256i a = TonemapChannelx8(_mm256_loadu_ps(p + 0), vExposure);
+		__m256i b = TonemapChannelx8(_mm256_loadu_ps(p + 8), vExposure);
+		__m256i c = TonemapChannelx8(_mm256_loadu_ps(p + 16), vExposure);
+		__m256i d = TonemapChannelx8(_mm256_loadu_ps(p + 24), vExposure);
+		// Packing works per 128 bit lane, which leaves the pixels in the order 0 2 4 6 1 3 5 7
+		__m256i px = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+		px = _mm256_permutevar8x32_epi32(px, order);
+		_mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_or_si256(px, alpha));
+	}
+
+	TonemapRGBAFloat_Scalar(src + i * 4, dst + i * 4, count - i, exposure);
+}
+
+
+/*
+	JPEG colour conversion with the JFIF coefficients. The vector versions compute every channel with the same
+	operations in the same order as the scalar one, so all levels give the same floats. That holds as long as the
+	compiler does not contract the scalar multiply-adds into FMAs, which /fp:precise does not.
+*/
+static void RGBAToYCbCr_Scalar(const uint8* src, float* y, float* cb, float* cr, uint64 count) {
+	for ( uint64 i = 0; i < count; ++i ) {
+		float r = float(src[i * 4 + 0]);
+		float g = float(src[i * 4 + 1]);
+		float b = float(src[i * 4 + 2]);
+		y[i] = 0.29900f * r + 0.58700f * g + 0.11400f * b + -128.0f;
+		cb[i] = -0.16874f * r + -0.33126f * g + 0.50000f * b;
+		cr[i] = 0.50000f * r + -0.41869f * g + -0.08131f * b;
+	}
+}
+
+static __m128 WeightedSumx4(__m128 r, __m128 g, __m128 b, float wr, float wg, float wb) {
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(wr), r), _mm_mul_ps(_mm_set1_ps(wg), g)), _mm_mul_ps(_mm_set1_ps(wb), b));
+}
+
+static void RGBAToYCbCr_SSE2(const uint8* src, float* y, float* cb, float* cr, uint64 count) {
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	uint64 i = 0;
+	for ( ; i + 4 <= count; i += 4 ) {
+		__m128i px = _mm_loadu_si128((const __m128i*)(src + i * 4));
+		__m128 r = _mm_cvtepi32_ps(_mm_and_si128(px, mask));
+		__m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), mask));
+		__m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), mask));
+		_mm_storeu_ps(y + i, _mm_add_ps(WeightedSumx4(r, g, b, 0.29900f, 0.58700f, 0.11400f), _mm_set1_ps(-128.0f)));
+		_mm_storeu_ps(cb + i, WeightedSumx4(r, g, b, -0.16874f, -0.33126f, 0.50000f));
+		_mm_storeu_ps(cr + i, WeightedSumx4(r, g, b, 0.50000f, -0.41869f, -0.08131f));
+	}
+
+	RGBAToYCbCr_Scalar(src + i * 4, y + i, cb + i, cr + i, count - i);
+}
+
+static __m256 WeightedSumx8(__m256 r, __m256 g, __m256 b, float wr, float wg, float wb) {
+	__m256 sum = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(wr), r), _mm256_mul_ps(_mm256_set1_ps(wg), g));
+	return _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(wb), b));
+}
+
+static void RGBAToYCbCr_AVX2(const uint8* src, float* y, float* cb, float* cr, uint64 count) {
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	uint64 i = 0;
+	for ( ; i + 8 <= count; i += 8 ) {
+		__m256i px = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+		__m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(px, mask));
+		__m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 8), mask));
+		__m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 16), mask));
+		_mm256_storeu_ps(y + i, _mm256_add_ps(WeightedSumx8(r, g, b, 0.29900f, 0.58700f, 0.11400f), _mm256_set1_ps(-128.0f)));
+		_mm256_storeu_ps(cb + i, WeightedSumx8(r, g, b, -0.16874f, -0.33126f, 0.50000f));
+		_mm256_storeu_ps(cr + i, WeightedSumx8(r, g, b, 0.50000f, -0.41869f, -0.08131f));
+	}
+
+	RGBAToYCbCr_Scalar(src + i * 4, y + i, cb + i, cr + i, count - i);
+}
+
+
+/*
+	Float AAN forward DCT, as in stb_image_write and the IJG library. Rows are transformed first, then columns.
+	ForwardDCT1D() runs on floats for the scalar version and on registers holding one value of 4 or 8 rows at
+	once for the vector ones, which transpose the block so that a register holds a column. Same operations in the
+	same order, so all levels give the same coefficients.
+*/
+static float DCTAdd(float a, float b) { return a + b; }
+static float DCTSub(float a, float b) { return a - b; }
+static float DCTMul(float a, float c) { return a * c; }
+static __m128 DCTAdd(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+static __m128 DCTSub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+static __m128 DCTMul(__m128 a, float c) { return _mm_mul_ps(a, _mm_set1_ps(c)); }
+static __m256 DCTAdd(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+static __m256 DCTSub(__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+static __m256 DCTMul(__m256 a, float c) { return _mm256_mul_ps(a, _mm256_set1_ps(c)); }
+
+// Transforms d[0], d[stride], .. d[7 * stride] in place
+template<typename V>
+static void ForwardDCT1D(V* d, uint64 stride) {
+	V tmp0 = DCTAdd(d[0 * stride], d[7 * stride]);
+	V tmp7 = DCTSub(d[0 * stride], d[7 * stride]);
+	V tmp1 = DCTAdd(d[1 * stride], d[6 * stride]);
+	V tmp6 = DCTSub(d[1 * stride], d[6 * stride]);
+	V tmp2 = DCTAdd(d[2 * stride], d[5 * stride]);
+	V tmp5 = DCTSub(d[2 * stride], d[5 * stride]);
+	V tmp3 = DCTAdd(d[3 * stride], d[4 * stride]);
+	V tmp4 = DCTSub(d[3 * stride], d[4 * stride]);
+
+	// Even part
+	V tmp10 = DCTAdd(tmp0, tmp3);
+	V tmp13 = DCTSub(tmp0, tmp3);
+	V tmp11 = DCTAdd(tmp1, tmp2);
+	V tmp12 = DCTSub(tmp1, tmp2);
+
+	d[0 * stride] = DCTAdd(tmp10, tmp11);
+	d[4 * stride] = DCTSub(tmp10, tmp11);
+
+	V z1 = DCTMul(DCTAdd(tmp12, tmp13), 0.707106781f);
+	d[2 * stride] = DCTAdd(tmp13, z1);
+	d[6 * stride] = DCTSub(tmp13, z1);
+
+	// Odd part
+	tmp10 = DCTAdd(tmp4, tmp5);
+	tmp11 = DCTAdd(tmp5, tmp6);
+	tmp12 = DCTAdd(tmp6, tmp7);
+
+	V z5 = DCTMul(DCTSub(tmp10, tmp12), 0.382683433f);
+	V z2 = DCTAdd(DCTMul(tmp10, 0.541196100f), z5);
+	V z4 = DCTAdd(DCTMul(tmp12, 1.306562965f), z5);
+	V z3 = DCTMul(tmp11, 0.707106781f);
+
+	V z11 = DCTAdd(tmp7, z3);
+	V z13 = DCTSub(tmp7, z3);
+
+	d[5 * stride] = DCTAdd(z13, z2);
+	d[3 * stride] = DCTSub(z13, z2);
+	d[1 * stride] = DCTAdd(z11, z4);
+	d[7 * stride] = DCTSub(z11, z4);
+}
+
+static int16_t QuantizeCoefficient(float v) {
+	return int16_t(int(v + (v < 0.0f ? -0.5f : 0.5f)));
+}
+
+static void ForwardDCT8x8_Scalar(const float* src, uint64 stride, uint64 numBlocks, const float* scales, int16_t* dst) {
+	for ( uint64 block = 0; block < numBlocks; ++block ) {
+		float d[64];
+		for ( uint32 row = 0; row < 8; ++row ) {
+			for ( uint32 col = 0; col < 8; ++col )
+				d[row * 8 + col] = src[block * 8 + row * stride + col];
+		}
+
+		for ( uint32 row = 0; row < 8; ++row )
+			ForwardDCT1D(d + row * 8, 1);
+		for ( uint32 col = 0; col < 8; ++col )
+			ForwardDCT1D(d + col, 8);
+
+		for ( uint32 i = 0; i < 64; ++i )
+			dst[block * 64 + i] = QuantizeCoefficient(d[i] * scales[i]);
+	}
+}
+
+// v + copysign(0.5, v), truncated
+static __m128i QuantizeCoefficientsx4(__m128 v) {
+	__m128 half = _mm_or_ps(_mm_set1_ps(0.5f), _mm_and_ps(v, _mm_set1_ps(-0.0f)));
+	return _mm_cvttps_epi32(_mm_add_ps(v, half));
+}
+
+// Transposes an 8x8 block held as rows of a low (columns 0-3) and a high (columns 4-7) half
+static void Transpose8x8(__m128* lo, __m128* hi) {
+	_MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+	_MM_TRANSPOSE4_PS(hi[4], hi[5], hi[6], hi[7]);
+	_MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+	_MM_TRANSPOSE4_PS(lo[4], lo[5], lo[6], lo[7]);
+	for ( uint32 i = 0; i < 4; ++i )
+		std::swap(hi[i], lo[i + 4]);
+}
+
+static void ForwardDCT8x8_SSE2(const float* src, uint64 stride, uint64 numBlocks, const float* scales, int16_t* dst) {
+	for ( uint64 block = 0; block < numBlocks; ++block ) {
+		const float* pBlock = src + block * 8;
+		__m128 lo[8];
+		__m128 hi[8];
+		for ( uint32 row = 0; row < 8; ++row ) {
+			lo[row] = _mm_loadu_ps(pBlock + row * stride);
+			hi[row] = _mm_loadu_ps(pBlock + row * stride + 4);
+		}
+
+		// Columns in registers, the 1D transforms run over the rows 0-3 and 4-7
+		Transpose8x8(lo, hi);
+		ForwardDCT1D(lo, 1);
+		ForwardDCT1D(hi, 1);
+		Transpose8x8(lo, hi);
+		ForwardDCT1D(lo, 1);
+		ForwardDCT1D(hi, 1);
+
+		int16_t* pOut = dst + block * 64;
+		for ( uint32 row = 0; row < 8; ++row ) {
+			__m128i a = QuantizeCoefficientsx4(_mm_mul_ps(lo[row], _mm_loadu_ps(scales + row * 8)));
+			__m128i b = QuantizeCoefficientsx4(_mm_mul_ps(hi[row], _mm_loadu_ps(scales + row * 8 + 4)));
+			_mm_storeu_si128((__m128i*)(pOut + row * 8), _mm_packs_epi32(a, b));
+		}
+	}
+}
+
+static __m256i QuantizeCoefficientsx8(__m256 v) {
+	__m256 half = _mm256_or_ps(_mm256_set1_ps(0.5f), _mm256_and_ps(v, _mm256_set1_ps(-0.0f)));
+	return _mm256_cvttps_epi32(_mm256_add_ps(v, half));
+}
+
+static void Transpose8x8(__m256* r) {
+	__m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+	__m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+	__m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+	__m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+	__m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+	__m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+	__m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+	__m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+	__m256 s0 = _mm256_shuffle_ps(t0, t2, 0x44);
+	__m256 s1 = _mm256_shuffle_ps(t0, t2, 0xEE);
+	__m256 s2 = _mm256_shuffle_ps(t1, t3, 0x44);
+	__m256 s3 = _mm256_shuffle_ps(t1, t3, 0xEE);
+	__m256 s4 = _mm256_shuffle_ps(t4, t6, 0x44);
+	__m256 s5 = _mm256_shuffle_ps(t4, t6, 0xEE);
+	__m256 s6 = _mm256_shuffle_ps(t5, t7, 0x44);
+	__m256 s7 = _mm256_shuffle_ps(t5, t7, 0xEE);
+	r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+	r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+	r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+	r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+	r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+	r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+	r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+	r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+static void ForwardDCT8x8_AVX2(const float* src, uint64 stride, uint64 numBlocks, const float* scales, int16_t* dst) {
+	for ( uint64 block = 0; block < numBlocks; ++block ) {
+		const float* pBlock = src + block * 8;
+		__m256 r[8];
+		for ( uint32 row = 0; row < 8; ++row )
+			r[row] = _mm256_loadu_ps(pBlock + row * stride);
+
+		Transpose8x8(r);
+		ForwardDCT1D(r, 1);
+		Transpose8x8(r);
+		ForwardDCT1D(r, 1);
+
+		int16_t* pOut = dst + block * 64;
+		for ( uint32 row = 0; row < 8; ++row ) {
+			__m256i q = QuantizeCoefficientsx8(_mm256_mul_ps(r[row], _mm256_loadu_ps(scales + row * 8)));
+			_mm_storeu_si128((__m128i*)(pOut + row * 8), _mm_packs_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1)));
+		}
+	}
+}
+
+
+void BindKernels(CpuLevel level) {
+	gKernels.Narrow16To8 = Narrow16To8_Scalar;
+	if ( level >= CpuLevel::SSE2 )
+		gKernels.Narrow16To8 = Narrow16To8_SSE2;
+	if ( level >= CpuLevel::AVX2 )
+		gKernels.Narrow16To8 = Narrow16To8_AVX2;
+	if ( level >= CpuLevel::AVX512 )
+		gKernels.Narrow16To8 = Narrow16To8_AVX512;
+
+	gKernels.UnpackR11G11B10 = UnpackR11G11B10_Scalar;
+	gKernels.TonemapR11G11B10 = TonemapR11G11B10_Scalar;
+	gKernels.TonemapRGBAFloat = TonemapRGBAFloat_Scalar;
+	if ( level >= CpuLevel::SSE2 ) {
+		gKernels.UnpackR11G11B10 = UnpackR11G11B10_SSE2;
+		gKernels.TonemapR11G11B10 = TonemapR11G11B10_SSE2;
+		gKernels.TonemapRGBAFloat = TonemapRGBAFloat_SSE2;
+	}
+	if ( level >= CpuLevel::AVX2 ) {
+		gKernels.UnpackR11G11B10 = UnpackR11G11B10_AVX2;
+		gKernels.TonemapR11G11B10 = TonemapR11G11B10_AVX2;
+		gKernels.TonemapRGBAFloat = TonemapRGBAFloat_AVX2;
+	}
+
+	gKernels.RGBAToYCbCr = RGBAToYCbCr_Scalar;
+	gKernels.ForwardDCT8x8 = ForwardDCT8x8_Scalar;
+	if ( level >= CpuLevel::SSE2 ) {
+		gKernels.RGBAToYCbCr = RGBAToYCbCr_SSE2;
+		gKernels.ForwardDCT8x8 = ForwardDCT8x8_SSE2;
+	}
+	if ( level >= CpuLevel::AVX2 ) {
+		gKernels.RGBAToYCbCr = RGBAToYCbCr_AVX2;
+		gKernels.ForwardDCT8x8 = ForwardDCT8x8_AVX2;
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Common.h"
+#include "CpuDispatch.h"
+
+// Function pointers for every SIMD hot path, bound once by BindKernels()
+struct KernelTable {
+	// Scales `count` 16 bit UNORM values to 8 bit UNORM (truncating, i.e. v / 257).
+	// Reads every `srcStride`th value starting at `src` and writes them densely to `dst`.
+	void (*Narrow16To8)(const uint16* src, uint8* dst, uint64 count, uint32 srcStride);
+
+	// Unpacks `count` R11G11B10_FLOAT pixels to RGBA float, alpha is 1
+	void (*UnpackR11G11B10)(const uint32* src, float* dst, uint64 count);
+
+	// Unpacks `count` R11G11B10_FLOAT pixels straight to RGBA8, alpha is 255.
+	// Every channel is scaled by `exposure`, Reinhard tone-mapped (c / (1 + c)) and gamma 2 encoded (sqrt).
+	void (*TonemapR11G11B10)(const uint32* src, uint8* dst, uint64 count, float exposure);
+
+	// Tone-maps `count` RGBA float pixels to RGBA8 like TonemapR11G11B10, alpha is 255
+	void (*TonemapRGBAFloat)(const float* src, uint8* dst, uint64 count, float exposure);
+
+	// Converts `count` RGBA8 pixels to JPEG's Y, Cb and Cr planes, alpha is ignored.
+	// Y is shifted down by 128, so all three are centred on 0 like the input of the DCT.
+	void (*RGBAToYCbCr)(const uint8* src, float* y, float* cb, float* cr, uint64 count);
+
+	// Forward DCT and quantization of `numBlocks` 8x8 blocks side by side, block b starting at src + 8 * b with
+	// rows `stride` floats apart. `scales` holds the 64 reciprocal quantizer steps including the DCT's scale factors.
+	// Writes 64 coefficients per block, in row order and rounded half away from zero.
+	void (*ForwardDCT8x8)(const float* src, uint64 stride, uint64 numBlocks, const float* scales, int16_t* dst);
+};
+
+extern KernelTable gKernels;
+
+// Binds every kernel to its best implementation at or below `level`
+void BindKernels(CpuLevel level);
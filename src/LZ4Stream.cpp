@@ -0,0 +1,103 @@
+#include "LZ4Stream.h"
+
+#include <algorithm>
+#include <cstring>
+
+LZ4BlockStream::LZ4BlockStream(const char* src, uint64 srcSize, uint64 dstSize, uint64 chunkSize)
+	: m_pSrc((const uint8*)src), m_pSrcEnd((const uint8*)src + srcSize), m_dstSize(dstSize), m_chunkSize(chunkSize) {
+	m_vecBuffer.resize(WindowSize + chunkSize);
+}
+
+bool LZ4BlockStream::Next(const uint8*& pChunk, uint64& size) {
+	uint8* pBuf = m_vecBuffer.data();
+
+	// Keep the last WindowSize bytes as history for matches, the new chunk goes after them
+	if ( m_fill > WindowSize ) {
+		memmove(pBuf, pBuf + m_fill - WindowSize, WindowSize);
+		m_fill = WindowSize;
+	}
+
+	uint64 start = m_fill;
+	uint64 limit = m_fill + std::min(m_chunkSize, m_dstSize - m_produced);
+
+	// Reads an LZ4 length continuation: bytes of 255 are summed until one is smaller
+	auto readLength = [this](uint64& length) {
+		uint8 b;
+		do {
+			if ( m_pSrc == m_pSrcEnd )
+				return false;
+			b = *m_pSrc++;
+			length += b;
+		} while ( b == 255 );
+		return true;
+	};
+
+	while ( m_fill < limit ) {
+		if ( m_literalsLeft != 0 ) {
+			uint64 n = std::min(m_literalsLeft, limit - m_fill);
+			if ( uint64(m_pSrcEnd - m_pSrc) < n )
+				return false;
+			memcpy(pBuf + m_fill, m_pSrc, n);
+			m_pSrc += n;
+			m_fill += n;
+			m_literalsLeft -= n;
+			continue;
+		}
+
+		if ( m_matchLeft != 0 ) {
+			uint64 n = std::min(m_matchLeft, limit - m_fill);
+			uint8* pDst = pBuf + m_fill;
+			const uint8* pMatch = pDst - m_matchOffset;
+			if ( m_matchOffset >= 8 ) {
+				// Forward 8 byte copies are safe as long as source and destination are 8 bytes apart
+				uint64 i = 0;
+				for ( ; i + 8 <= n; i += 8 )
+					memcpy(pDst + i, pMatch + i, 8);
+				for ( ; i < n; ++i )
+					pDst[i] = pMatch[i];
+			} else {
+				for ( uint64 i = 0; i < n; ++i )
+					pDst[i] = pMatch[i];
+			}
+			m_fill += n;
+			m_matchLeft -= n;
+			continue;
+		}
+
+		if ( m_needOffset ) {
+			if ( m_pSrcEnd - m_pSrc < 2 )
+				return false;
+			m_matchOffset = uint64(m_pSrc[0]) | (uint64(m_pSrc[1]) << 8);
+			m_pSrc += 2;
+
+			uint64 matchLength = m_tokenMatchLength;
+			if ( matchLength == 15 && !readLength(matchLength) )
+				return false;
+
+			// The offset may reach back into the window, but not before the start of the output
+			if ( m_matchOffset == 0 || m_matchOffset > m_fill || m_matchOffset > m_produced + (m_fill - start) )
+				return false;
+
+			m_matchLeft = matchLength + 4;
+			m_needOffset = false;
+			continue;
+		}
+
+		// New sequence
+		if ( m_pSrc == m_pSrcEnd )
+			return false;
+		uint8 token = *m_pSrc++;
+		uint64 literalLength = token >> 4;
+		if ( literalLength == 15 && !readLength(literalLength) )
+			return false;
+
+		m_literalsLeft = literalLength;
+		m_tokenMatchLength = token & 0xF;
+		m_needOffset = true;
+	}
+
+	pChunk = pBuf + start;
+	size = m_fill - start;
+	m_produced += size;
+	return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Common.h"
+
+// Decodes one raw LZ4 block in pieces of a fixed size, keeping only the last 64 KB of output as match window.
+// The TCO payload is a single LZ4 block, which the LZ4 streaming API (built for chains of separately
+// compressed blocks) cannot resume in the middle of, hence this small decoder.
+class LZ4BlockStream {
+public:
+	static constexpr uint64 WindowSize = 64 * 1024;
+
+	LZ4BlockStream(const char* src, uint64 srcSize, uint64 dstSize, uint64 chunkSize);
+
+	// Decodes the next chunkSize bytes (fewer at the end of the block).
+	// The returned bytes stay valid until the next call. Returns false on malformed input.
+	bool Next(const uint8*& pChunk, uint64& size);
+
+	bool IsDone() const { return m_produced == m_dstSize; }
+	uint64 GetProduced() const { return m_produced; }
+
+private:
+	const uint8* m_pSrc;
+	const uint8* m_pSrcEnd;
+	uint64 m_dstSize;
+	uint64 m_chunkSize;
+	uint64 m_produced = 0;
+
+	// [window | chunk], m_fill bytes of which are valid
+	std::vector<uint8> m_vecBuffer;
+	uint64 m_fill = 0;
+
+	// State of the sequence that was interrupted by the end of the previous chunk
+	uint64 m_literalsLeft = 0;
+	uint64 m_matchLeft = 0;
+	uint64 m_matchOffset = 0;
+	uint32 m_tokenMatchLength = 0;
+	bool m_needOffset = false;
+};
@@ -0,0 +1,230 @@
+#include "Metrics.h"
+#include "Options.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+#include "Psapi.h"
+
+// Upper bounds in seconds, the last bucket is +Inf
+static constexpr double HistogramBounds[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0};
+static constexpr uint32 NumHistogramBuckets = uint32(std::size(HistogramBounds)) + 1;
+
+struct Histogram {
+	// Not cumulative, summed up when written
+	std::atomic<uint64> counts[NumHistogramBuckets] = {};
+	std::atomic<uint64> nanoseconds = 0;
+
+	void Add(uint64 ns) {
+		double seconds = ns / 1e9;
+		uint64 bucket = std::lower_bound(std::begin(HistogramBounds), std::end(HistogramBounds), seconds) - std::begin(HistogramBounds);
+		counts[bucket].fetch_add(1, std::memory_order_relaxed);
+		nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+	}
+};
+
+static std::atomic<uint64> gNumQueuedFiles = 0;
+static std::atomic<uint64> gFilesStarted = 0;
+static std::atomic<uint64> gFilesOk = 0;
+static std::atomic<uint64> gFilesFailed = 0;
+static std::atomic<uint64> gStageBytes[int(FileStage::Count)] = {};
+static std::atomic<uint64> gErrors[int(ErrorType::Count)] = {};
+static Histogram gStageHistograms[int(FileStage::Count)];
+static Histogram gFileHistogram;
+
+static std::thread gMetricsThread;
+static std::mutex gMetricsMutex;
+static std::condition_variable gMetricsCV;
+static bool gStopMetrics = false;
+static bool gMetricsRunning = false;
+static uint64 gStartTime = 0;
+
+const char* ToString(ErrorType type) {
+	switch(type) {
+		case ErrorType::Read:
+			return "read";
+		case ErrorType::Header:
+			return "header";
+		case ErrorType::Decode:
+			return "decode";
+		case ErrorType::Encode:
+			return "encode";
+		case ErrorType::Write:
+			return "write";
+		case ErrorType::Worker:
+			return "worker";
+		case ErrorType::Crash:
+			return "crash";
+		default:
+			return "ERROR";
+	}
+}
+
+void RecordFilesQueued(uint64 count) {
+	gNumQueuedFiles.fetch_add(count, std::memory_order_relaxed);
+}
+
+void RecordFileStarted() {
+	gFilesStarted.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RecordFileDone(bool success, std::chrono::steady_clock::duration elapsed, const FileStageTimes* pTimes) {
+	(success ? gFilesOk : gFilesFailed).fetch_add(1, std::memory_order_relaxed);
+	gFileHistogram.Add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+	if ( !pTimes )
+		return;
+
+	// Stages a file never reached are left out, instead of counting as instant
+	for ( int i = 0; i < int(FileStage::Count); ++i ) {
+		uint64 ns = pTimes->nanoseconds[i];
+		if ( ns != 0 )
+			gStageHistograms[i].Add(ns);
+	}
+}
+
+void RecordStageBytes(FileStage stage, uint64 bytes) {
+	gStageBytes[int(stage)].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+uint64 GetStageBytes(FileStage stage) {
+	return gStageBytes[int(stage)].load(std::memory_order_relaxed);
+}
+
+void RecordError(ErrorType type) {
+	gErrors[int(type)].fetch_add(1, std::memory_order_relaxed);
+}
+
+static void AppendHeader(std::string& text, const char* name, const char* type, const char* help) {
+	text += std::format("# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+}
+
+static void AppendHistogram(std::string& text, const char* name, const std::string& labels, const Histogram& histogram) {
+	std::string prefix = labels.empty() ? "" : labels + ",";
+	uint64 cumulative = 0;
+	for ( uint32 i = 0; i < NumHistogramBuckets; ++i ) {
+		cumulative += histogram.counts[i].load(std::memory_order_relaxed);
+		std::string bound = i < std::size(HistogramBounds) ? std::format("{}", HistogramBounds[i]) : "+Inf";
+		text += std::format("{}_bucket{{{}le=\"{}\"}} {}\n", name, prefix, bound, cumulative);
+	}
+	std::string braces = labels.empty() ? "" : std::format("{{{}}}", labels);
+	text += std::format("{}_sum{} {}\n", name, braces, histogram.nanoseconds.load(std::memory_order_relaxed) / 1e9);
+	text += std::format("{}_count{} {}\n", name, braces, cumulative);
+}
+
+// The counters are read one by one while workers keep going, so they can be off by the files in flight
+static std::string FormatMetrics(bool running) {
+	std::string text;
+
+	uint64 numFiles = gNumQueuedFiles.load(std::memory_order_relaxed);
+	uint64 started = gFilesStarted.load(std::memory_order_relaxed);
+	uint64 ok = gFilesOk.load(std::memory_order_relaxed);
+	uint64 failed = gFilesFailed.load(std::memory_order_relaxed);
+
+	AppendHeader(text, "cachedumper_files_total", "counter", "Files processed, by result.");
+	text += std::format("cachedumper_files_total{{result=\"ok\"}} {}\n", ok);
+	text += std::format("cachedumper_files_total{{result=\"failed\"}} {}\n", failed);
+
+	AppendHeader(text, "cachedumper_files_queued", "gauge", "Files not started yet.");
+	text += std::format("cachedumper_files_queued {}\n", numFiles - std::min(started, numFiles));
+
+	AppendHeader(text, "cachedumper_files_in_flight", "gauge", "Files being processed.");
+	text += std::format("cachedumper_files_in_flight {}\n", started - std::min(started, ok + failed));
+
+	AppendHeader(text, "cachedumper_bytes_total", "counter", "Bytes read and decoded, or encoded and written, by stage.");
+	for ( int i = 0; i < int(FileStage::Count); ++i )
+		text += std::format("cachedumper_bytes_total{{stage=\"{}\"}} {}\n", ToString(FileStage(i)), gStageBytes[i].load(std::memory_order_relaxed));
+
+	AppendHeader(text, "cachedumper_errors_total", "counter", "Errors, by type.");
+	for ( int i = 0; i < int(ErrorType::Count); ++i )
+		text += std::format("cachedumper_errors_total{{type=\"{}\"}} {}\n", ToString(ErrorType(i)), gErrors[i].load(std::memory_order_relaxed));
+
+	AppendHeader(text, "cachedumper_stage_duration_seconds", "histogram", "Time one file spent in a stage.");
+	for ( int i = 0; i < int(FileStage::Count); ++i )
+		AppendHistogram(text, "cachedumper_stage_duration_seconds", std::format("stage=\"{}\"", ToString(FileStage(i))), gStageHistograms[i]);
+
+	AppendHeader(text, "cachedumper_file_duration_seconds", "histogram", "Time to process one file.");
+	AppendHistogram(text, "cachedumper_file_duration_seconds", "", gFileHistogram);
+
+	PROCESS_MEMORY_COUNTERS_EX memCounters = {};
+	if ( GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&memCounters), sizeof(memCounters)) ) {
+		AppendHeader(text, "cachedumper_memory_bytes", "gauge", "Memory in use by the process.");
+		text += std::format("cachedumper_memory_bytes{{kind=\"working_set\"}} {}\n", memCounters.WorkingSetSize);
+		text += std::format("cachedumper_memory_bytes{{kind=\"private\"}} {}\n", memCounters.PrivateUsage);
+	}
+
+	AppendHeader(text, "cachedumper_running", "gauge", "1 while the dump is running, 0 once it finished.");
+	text += std::format("cachedumper_running {}\n", running ? 1 : 0);
+
+	AppendHeader(text, "cachedumper_start_time_seconds", "gauge", "Unix time the dump started at.");
+	text += std::format("cachedumper_start_time_seconds {}\n", gStartTime);
+
+	return text;
+}
+
+static void WriteMetricsFile(bool running) {
+	std::string text = FormatMetrics(running);
+
+	std::filesystem::path path = gOptions.metricsPath;
+	std::filesystem::path tmpPath = path;
+	tmpPath += ".tmp";
+
+	std::error_code ec;
+	{
+		// Binary, the format wants plain '\n' line ends
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		out.write(text.data(), text.size());
+		if ( !out )
+			ec = std::make_error_code(std::errc::io_error);
+	}
+	if ( !ec )
+		std::filesystem::rename(tmpPath, path, ec);
+
+	// Reported once, a monitoring problem must not flood the dump's output
+	static bool reported = false;
+	if ( ec && !reported ) {
+		reported = true;
+		Print(std::format("Failed to write metrics to '{}': {}", gOptions.metricsPath, ec.message()));
+	}
+}
+
+void StartMetrics(uint64 numFiles) {
+	gNumQueuedFiles = numFiles;
+	if ( gOptions.metricsPath.empty() )
+		return;
+
+	gStartTime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	gMetricsRunning = true;
+	gMetricsThread = std::thread([]() {
+		std::unique_lock l(gMetricsMutex);
+		while ( !gStopMetrics ) {
+			l.unlock();
+			WriteMetricsFile(true);
+			l.lock();
+			gMetricsCV.wait_for(l, std::chrono::seconds(gOptions.metricsIntervalSeconds), []() { return gStopMetrics; });
+		}
+	});
+}
+
+void StopMetrics() {
+	if ( !gMetricsRunning )
+		return;
+
+	{
+		std::scoped_lock l(gMetricsMutex);
+		gStopMetrics = true;
+	}
+	gMetricsCV.notify_all();
+	gMetricsThread.join();
+	gMetricsRunning = false;
+
+	WriteMetricsFile(false);
+}
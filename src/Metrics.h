@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+
+#include "Common.h"
+#include "SlowLog.h"
+
+enum class ErrorType {
+	Read,
+	Header,
+	Decode,
+	Encode,
+	Write,
+	// A worker process reported the file as failed, the stage is not known
+	Worker,
+	// A worker process crashed on the file
+	Crash,
+	Count
+};
+
+const char* ToString(ErrorType type);
+
+/*
+	Counters of a running dump, written every --metrics-interval seconds to the --metrics path in the
+	Prometheus text format, for a node_exporter textfile collector to pick up. The file is written next to
+	the path and renamed over it, so the collector never reads a partial file.
+	Recording is a few relaxed atomic increments per file, so it is always on, the file is only written with --metrics.
+*/
+
+// Starts the writer thread if --metrics is given, `numFiles` is the length of the work queue
+void StartMetrics(uint64 numFiles);
+// Writes the file a last time with the final counters and stops the writer thread
+void StopMetrics();
+
+// Files added to the work queue after StartMetrics(), e.g. as a --files-from list arrives
+void RecordFilesQueued(uint64 count);
+void RecordFileStarted();
+// `pTimes` may be nullptr where no stage breakdown was measured (worker processes)
+void RecordFileDone(bool success, std::chrono::steady_clock::duration elapsed, const FileStageTimes* pTimes);
+// Bytes that went into the read and decode stages, or came out of the encode and write stages
+void RecordStageBytes(FileStage stage, uint64 bytes);
+// Bytes recorded for a stage so far, worker processes hand the difference per file to the supervisor
+uint64 GetStageBytes(FileStage stage);
+void RecordError(ErrorType type);
@@ -0,0 +1,585 @@
+#include "Options.h"
+#include "Durability.h"
+
+#include <algorithm>
+#include <charconv>
+#include <format>
+#include <string_view>
+
+Options gOptions;
+
+static bool ParseUInt(std::string_view str, uint32& res) {
+	auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), res);
+	return ec == std::errc() && ptr == str.data() + str.size();
+}
+
+static bool ParseFloat(std::string_view str, float& res) {
+	auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), res);
+	return ec == std::errc() && ptr == str.data() + str.size();
+}
+
+// Splits a comma-separated list, skipping empty entries
+static std::vector<std::string_view> SplitList(std::string_view list) {
+	std::vector<std::string_view> vecItems;
+	for ( std::string_view rest = list; !rest.empty(); ) {
+		uint64 comma = std::min(rest.find(','), rest.size());
+		if ( comma != 0 )
+			vecItems.push_back(rest.substr(0, comma));
+		rest.remove_prefix(std::min(comma + 1, rest.size()));
+	}
+	return vecItems;
+}
+
+// Parses a list of which both, one or none of two words may be part of
+static bool ParsePair(std::string_view list, std::string_view first, std::string_view second, bool& hasFirst, bool& hasSecond) {
+	hasFirst = hasSecond = false;
+	for ( std::string_view item : SplitList(list) ) {
+		if ( item == first )
+			hasFirst = true;
+		else if ( item == second )
+			hasSecond = true;
+		else
+			return false;
+	}
+	return hasFirst || hasSecond;
+}
+
+void PrintUsage() {
+	Print(
+		"Usage: CacheDumper.exe [command] [options]\n"
+		"\n"
+		"Commands:\n"
+		"  dump                 Dump all textures from ./Textures/ to ./Textures_OUT/ (default)\n"
+		"  bench-kernels        Benchmark and cross-check every SIMD kernel at every supported CPU level\n"
+		"  bench-async          Benchmark and self-check the embeddable AsyncDecoder: backpressure, cancellation and chaining\n"
+		"  analyze              Compare the shipped LZ4 payloads against LZ4HC and raw storage, writes a CSV/JSON report\n"
+		"  pack                 Pack all files from ./Textures/ into one indexed file given by --pack\n"
+		"  estimate             Predict time, peak memory and output size of a dump with the given options\n"
+		"  sweep                Time dumps across thread counts, I/O backends, formats and warm/cold caches, writes a CSV\n"
+		"  prune                Trim ./Textures/ to --budget-mb, least recently used first, reports what it would reclaim\n"
+		"  mount                Mount a read-only view of ./Textures/ with every entry as a decoded image (FUSE builds only)\n"
+		"\n"
+		"Options:\n"
+		"  --cpu=<level>        Force kernels to a CPU level: scalar, sse2, sse41, avx2, avx512\n"
+		"  --threads=<n>        Number of worker threads (default: one per hardware thread, at most that on hybrid CPUs)\n"
+		"  --hc-levels=<a,b,..> analyze: LZ4HC levels to trial (default: 4,9,12)\n"
+		"  --report=<path>      analyze, sweep, prune: report path without extension (default: ./<command>_report)\n"
+		"  --sweep-threads=<a,b,..>\n"
+		"                       sweep: thread counts (default: powers of two up to the hardware threads)\n"
+		"  --sweep-io=<a,b,..>  sweep: I/O backends: normal, batch, unbuffered (default: all)\n"
+		"  --sweep-formats=<a,b,..>\n"
+		"                       sweep: --formats values, with '+' joining formats of one run (default: tga)\n"
+		"  --sweep-cache=<a,b>  sweep: warm, cold (default: both)\n"
+		"  --sweep-scaling=<a,b>\n"
+		"                       sweep: strong, weak (default: both)\n"
+		"  --sweep-repeat=<n>   sweep: runs per point, the fastest is kept (default: 1)\n"
+		"  --budget-mb=<n>      prune: size in MB to trim the cache to\n"
+		"  --keep-dumped        prune: never prune entries listed in ./Textures_OUT/manifest.txt\n"
+		"  --move-to=<path>     prune: move pruned files here instead of deleting them\n"
+		"  --apply              prune: delete or move the files, instead of only reporting them\n"
+		"  --pack=<file>        pack: file to write, dump: read entries from this pack instead of ./Textures/\n"
+		"  --priority=<a,b,..>  dump: process matching files first, by name glob (e.g. *rock*) or layout:<name>\n"
+		"  --r11g11b10=<enc>    Treat R11G11B10 payloads as rgba8 or float instead of detecting it per texture\n"
+		"  --exposure=<f>       Exposure applied when tone-mapping HDR textures to 8 bits (default: 1.0)\n"
+		"  --bc6h-layout=<n>    Raw TCO layout id to decode as BC6H, 14 or above (default: 14)\n"
+		"  --bc7-layout=<n>     Raw TCO layout id to decode as BC7, 14 or above (default: 15)\n"
+		"  --fused              Decode BC textures in cache-sized chunks straight out of the LZ4 stream\n"
+		"  --no-batching        dump: hand out files one by one instead of in same-layout batches\n"
+		"  --batch-io           dump: issue all reads of a batch at once with overlapped I/O\n"
+		"  --unbuffered         dump: like --batch-io, bypassing the file cache (for cold caches larger than RAM)\n"
+		"  --isolate[=<n>]      dump: decode in <n> worker processes (default: one per thread), so a crashing file\n"
+		"                       is quarantined instead of ending the dump\n"
+		"  --no-hybrid          dump: do not split work by P-cores and E-cores on hybrid CPUs\n"
+		"  --max-files=<n>      dump: only dump <n> files picked evenly from the cache\n"
+		"  --files-from=<file>  dump: dump the NUL- or newline-separated paths in <file> (- = stdin) as they arrive\n"
+		"  --durability=<a,b,..> dump: none, or any of rename, batch, large (default: none):\n"
+		"                       rename: write outputs as .partial and rename them once complete\n"
+		"                       batch: flush outputs to the device every --sync-files=256 files or --sync-mb=256 MB\n"
+		"                       large: flush outputs of at least --sync-large-mb=16 MB on their own\n"
+		"  --slow-ms=<n>        dump: log files taking longer than this with their stage times to slow_files.txt\n"
+		"  --repro-dir=<path>   dump: copy every slow file with the command line into a replayable bundle here\n"
+		"  --metrics=<path>     dump: write Prometheus textfile metrics here while running\n"
+		"  --metrics-interval=<s>\n"
+		"                       dump: seconds between metrics updates (default: 15)\n"
+		"  --io-retries=<n>     Retries of a failed file read or write, with backoff (default: 2)\n"
+		"  --sim-latency=<ms>   Simulate slow storage: latency added to every file operation\n"
+		"  --sim-jitter=<ms>    Simulate slow storage: random extra latency of up to this much\n"
+		"  --sim-bandwidth=<n>  Simulate slow storage: MB/s shared by all transfers\n"
+		"  --sim-errors=<f>     Simulate slow storage: fraction of operations failing transiently\n"
+		"  --sim-seed=<n>       Simulate slow storage: seed of the jitter and errors (default: 1)\n"
+		"  --formats=<a,b,..>   Output formats: tga, png, dds, thumb, hdr, jpg (dump default: tga, mount default: tga,png,dds)\n"
+		"  --thumb-size=<n>     Longer edge of thumb outputs in pixels (default: 256)\n"
+		"  --jpeg-quality=<n>   Quality of jpg outputs from 1 to 100 (default: 85)\n"
+		"  --mountpoint=<path>  mount: where to mount the view (a drive letter or directory)\n"
+		"  --cache-mb=<n>       mount: memory budget for encoded files (default: 512)\n"
+		"  --readahead=<n>      mount: sibling files to encode in the background on open (default: 4)\n"
+		"  --help               Show this text"
+	);
+}
+
+bool ParseArgs(int argc, char** argv, Options& opts) {
+	opts.vecArgs.assign(argv + 1, argv + argc);
+
+	for ( int i = 1; i < argc; ++i ) {
+		std::string_view arg = argv[i];
+
+		if ( arg == "--help" || arg == "-h" || arg == "/?" ) {
+			PrintUsage();
+			return false;
+		}
+
+		if ( i == 1 && !arg.starts_with("-") ) {
+			if ( arg == "dump" )
+				opts.command = Command::Dump;
+			else if ( arg == "bench-kernels" )
+				opts.command = Command::BenchKernels;
+			else if ( arg == "bench-async" )
+				opts.command = Command::BenchAsync;
+			else if ( arg == "analyze" )
+				opts.command = Command::Analyze;
+			else if ( arg == "mount" )
+				opts.command = Command::Mount;
+			else if ( arg == "pack" )
+				opts.command = Command::Pack;
+			else if ( arg == "estimate" )
+				opts.command = Command::Estimate;
+			else if ( arg == "sweep" )
+				opts.command = Command::Sweep;
+			else if ( arg == "prune" )
+				opts.command = Command::Prune;
+			else {
+				Print(std::format("Unknown command '{}'", arg));
+				PrintUsage();
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--cpu=") ) {
+			if ( !ParseCpuLevel(arg.substr(6), opts.cpuLevel) ) {
+				Print(std::format("Unknown CPU level '{}'", arg.substr(6)));
+				return false;
+			}
+			opts.forceCpuLevel = true;
+			continue;
+		}
+
+		if ( arg.starts_with("--threads=") ) {
+			if ( !ParseUInt(arg.substr(10), opts.numThreads) ) {
+				Print(std::format("Invalid thread count '{}'", arg.substr(10)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--hc-levels=") ) {
+			opts.vecHCLevels.clear();
+			for ( std::string_view rest = arg.substr(12); !rest.empty(); ) {
+				uint64 comma = std::min(rest.find(','), rest.size());
+				uint32 level = 0;
+				if ( !ParseUInt(rest.substr(0, comma), level) || level < 1 || level > 12 ) {
+					Print(std::format("Invalid LZ4HC level list '{}'", arg.substr(12)));
+					return false;
+				}
+				opts.vecHCLevels.push_back(int(level));
+				rest.remove_prefix(std::min(comma + 1, rest.size()));
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--r11g11b10=") ) {
+			if ( !ParseR11G11B10Encoding(arg.substr(12), opts.r11g11b10Encoding) ) {
+				Print(std::format("Unknown R11G11B10 encoding '{}'", arg.substr(12)));
+				return false;
+			}
+			opts.forceR11G11B10 = true;
+			continue;
+		}
+
+		if ( arg.starts_with("--exposure=") ) {
+			if ( !ParseFloat(arg.substr(11), opts.exposure) || !(opts.exposure > 0.0f) ) {
+				Print(std::format("Invalid exposure '{}'", arg.substr(11)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--bc6h-layout=") ) {
+			if ( !ParseUInt(arg.substr(14), opts.bc6hLayoutId) ) {
+				Print(std::format("Invalid layout id '{}'", arg.substr(14)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--bc7-layout=") ) {
+			if ( !ParseUInt(arg.substr(13), opts.bc7LayoutId) ) {
+				Print(std::format("Invalid layout id '{}'", arg.substr(13)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--slow-ms=") ) {
+			if ( !ParseUInt(arg.substr(10), opts.slowFileMs) ) {
+				Print(std::format("Invalid slow file threshold '{}'", arg.substr(10)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--repro-dir=") ) {
+			opts.reproDir = arg.substr(12);
+			continue;
+		}
+
+		if ( arg.starts_with("--metrics=") ) {
+			opts.metricsPath = arg.substr(10);
+			continue;
+		}
+
+		if ( arg.starts_with("--metrics-interval=") ) {
+			if ( !ParseUInt(arg.substr(19), opts.metricsIntervalSeconds) || opts.metricsIntervalSeconds == 0 ) {
+				Print(std::format("Invalid metrics interval '{}'", arg.substr(19)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--io-retries=") ) {
+			if ( !ParseUInt(arg.substr(13), opts.ioRetries) ) {
+				Print(std::format("Invalid retry count '{}'", arg.substr(13)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--sim-") ) {
+			uint64 eq = arg.find('=');
+			std::string_view name = arg.substr(0, eq);
+			std::string_view value = eq == std::string_view::npos ? std::string_view() : arg.substr(eq + 1);
+
+			bool valid;
+			SimStorageOptions& sim = opts.simStorage;
+			if ( name == "--sim-latency" )
+				valid = ParseFloat(value, sim.latencyMs) && sim.latencyMs >= 0.0f;
+			else if ( name == "--sim-jitter" )
+				valid = ParseFloat(value, sim.jitterMs) && sim.jitterMs >= 0.0f;
+			else if ( name == "--sim-bandwidth" )
+				valid = ParseFloat(value, sim.bandwidthMBps) && sim.bandwidthMBps >= 0.0f;
+			else if ( name == "--sim-errors" )
+				valid = ParseFloat(value, sim.errorRate) && sim.errorRate >= 0.0f && sim.errorRate <= 1.0f;
+			else if ( name == "--sim-seed" ) {
+				auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), sim.seed);
+				valid = ec == std::errc() && ptr == value.data() + value.size();
+			} else {
+				Print(std::format("Unknown option '{}'", arg));
+				PrintUsage();
+				return false;
+			}
+
+			if ( !valid ) {
+				Print(std::format("Invalid value for {} '{}'", name, value));
+				return false;
+			}
+			sim.enabled = true;
+			continue;
+		}
+
+		if ( arg == "--fused" ) {
+			opts.fusedDecode = true;
+			continue;
+		}
+
+		if ( arg == "--isolate" ) {
+			opts.isolate = true;
+			continue;
+		}
+
+		if ( arg.starts_with("--isolate=") ) {
+			if ( !ParseUInt(arg.substr(10), opts.numWorkerProcesses) || opts.numWorkerProcesses == 0 ) {
+				Print(std::format("Invalid worker process count '{}'", arg.substr(10)));
+				return false;
+			}
+			opts.isolate = true;
+			continue;
+		}
+
+		if ( arg.starts_with("--worker=") ) {
+			opts.workerArg = arg.substr(9);
+			continue;
+		}
+
+		if ( arg == "--no-hybrid" ) {
+			opts.hybridScheduling = false;
+			continue;
+		}
+
+		if ( arg == "--batch-io" ) {
+			opts.batchIO = true;
+			continue;
+		}
+
+		if ( arg == "--unbuffered" ) {
+			opts.batchIO = true;
+			opts.unbufferedIO = true;
+			continue;
+		}
+
+		if ( arg == "--no-batching" ) {
+			opts.layoutBatching = false;
+			continue;
+		}
+
+		if ( arg.starts_with("--priority=") ) {
+			for ( std::string_view rest = arg.substr(11); !rest.empty(); ) {
+				uint64 comma = std::min(rest.find(','), rest.size());
+				if ( comma != 0 )
+					opts.vecPriority.emplace_back(rest.substr(0, comma));
+				rest.remove_prefix(std::min(comma + 1, rest.size()));
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--formats=") ) {
+			opts.vecFormats.clear();
+			for ( std::string_view rest = arg.substr(10); !rest.empty(); ) {
+				uint64 comma = std::min(rest.find(','), rest.size());
+				OutputFormat format;
+				if ( !ParseOutputFormat(rest.substr(0, comma), format) ) {
+					Print(std::format("Unknown output format '{}'", rest.substr(0, comma)));
+					return false;
+				}
+				opts.vecFormats.push_back(format);
+				rest.remove_prefix(std::min(comma + 1, rest.size()));
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--pack=") ) {
+			opts.packPath = arg.substr(7);
+			continue;
+		}
+
+		if ( arg.starts_with("--mountpoint=") ) {
+			opts.mountPoint = arg.substr(13);
+			continue;
+		}
+
+		if ( arg.starts_with("--thumb-size=") ) {
+			if ( !ParseUInt(arg.substr(13), opts.thumbSize) || opts.thumbSize == 0 ) {
+				Print(std::format("Invalid thumbnail size '{}'", arg.substr(13)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--jpeg-quality=") ) {
+			if ( !ParseUInt(arg.substr(15), opts.jpegQuality) || opts.jpegQuality == 0 || opts.jpegQuality > 100 ) {
+				Print(std::format("Invalid JPEG quality '{}'", arg.substr(15)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--cache-mb=") ) {
+			uint32 cacheMB = 0;
+			if ( !ParseUInt(arg.substr(11), cacheMB) ) {
+				Print(std::format("Invalid cache size '{}'", arg.substr(11)));
+				return false;
+			}
+			opts.cacheMB = cacheMB;
+			continue;
+		}
+
+		if ( arg.starts_with("--readahead=") ) {
+			if ( !ParseUInt(arg.substr(12), opts.readahead) ) {
+				Print(std::format("Invalid readahead count '{}'", arg.substr(12)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--report=") ) {
+			opts.reportPath = arg.substr(9);
+			continue;
+		}
+
+		if ( arg.starts_with("--sweep-threads=") ) {
+			opts.vecSweepThreads.clear();
+			for ( std::string_view item : SplitList(arg.substr(16)) ) {
+				uint32 numThreads = 0;
+				if ( !ParseUInt(item, numThreads) || numThreads == 0 ) {
+					Print(std::format("Invalid thread count list '{}'", arg.substr(16)));
+					return false;
+				}
+				opts.vecSweepThreads.push_back(numThreads);
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--sweep-io=") ) {
+			opts.vecSweepIO.clear();
+			for ( std::string_view item : SplitList(arg.substr(11)) ) {
+				if ( item != "normal" && item != "batch" && item != "unbuffered" ) {
+					Print(std::format("Unknown I/O backend '{}'", item));
+					return false;
+				}
+				opts.vecSweepIO.emplace_back(item);
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--sweep-formats=") ) {
+			opts.vecSweepFormats.clear();
+			for ( std::string_view item : SplitList(arg.substr(16)) ) {
+				for ( std::string_view rest = item; !rest.empty(); ) {
+					uint64 plus = std::min(rest.find('+'), rest.size());
+					OutputFormat format;
+					if ( !ParseOutputFormat(rest.substr(0, plus), format) ) {
+						Print(std::format("Unknown output format '{}'", rest.substr(0, plus)));
+						return false;
+					}
+					rest.remove_prefix(std::min(plus + 1, rest.size()));
+				}
+				opts.vecSweepFormats.emplace_back(item);
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--sweep-cache=") ) {
+			if ( !ParsePair(arg.substr(14), "warm", "cold", opts.sweepWarm, opts.sweepCold) ) {
+				Print(std::format("Invalid cache states '{}', expected warm and/or cold", arg.substr(14)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--sweep-scaling=") ) {
+			if ( !ParsePair(arg.substr(16), "strong", "weak", opts.sweepStrong, opts.sweepWeak) ) {
+				Print(std::format("Invalid scaling modes '{}', expected strong and/or weak", arg.substr(16)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--sweep-repeat=") ) {
+			if ( !ParseUInt(arg.substr(15), opts.sweepRepeat) || opts.sweepRepeat == 0 ) {
+				Print(std::format("Invalid repeat count '{}'", arg.substr(15)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--budget-mb=") ) {
+			uint32 budgetMB = 0;
+			if ( !ParseUInt(arg.substr(12), budgetMB) ) {
+				Print(std::format("Invalid budget '{}'", arg.substr(12)));
+				return false;
+			}
+			opts.pruneBudgetMB = budgetMB;
+			continue;
+		}
+
+		if ( arg == "--apply" ) {
+			opts.pruneApply = true;
+			continue;
+		}
+
+		if ( arg == "--keep-dumped" ) {
+			opts.keepDumped = true;
+			continue;
+		}
+
+		if ( arg.starts_with("--move-to=") ) {
+			opts.pruneMoveTo = arg.substr(10);
+			continue;
+		}
+
+		// Also accepted as two arguments, for the common "--files-from -"
+		if ( arg.starts_with("--files-from=") || (arg == "--files-from" && i + 1 < argc) ) {
+			opts.filesFrom = arg == "--files-from" ? argv[++i] : arg.substr(13);
+			if ( opts.filesFrom.empty() ) {
+				Print("--files-from requires a file, or - for stdin");
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--durability=") ) {
+			opts.durability = 0;
+			for ( std::string_view item : SplitList(arg.substr(13)) ) {
+				if ( item == "rename" )
+					opts.durability |= DurabilityRename;
+				else if ( item == "batch" )
+					opts.durability |= DurabilityBatch;
+				else if ( item == "large" )
+					opts.durability |= DurabilityLarge;
+				else if ( item != "none" ) {
+					Print(std::format("Unknown durability mode '{}'", item));
+					return false;
+				}
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--sync-files=") ) {
+			if ( !ParseUInt(arg.substr(13), opts.syncFiles) || opts.syncFiles == 0 ) {
+				Print(std::format("Invalid file count '{}'", arg.substr(13)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--sync-mb=") ) {
+			if ( !ParseUInt(arg.substr(10), opts.syncMB) || opts.syncMB == 0 ) {
+				Print(std::format("Invalid size '{}'", arg.substr(10)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--sync-large-mb=") ) {
+			if ( !ParseUInt(arg.substr(16), opts.syncLargeMB) ) {
+				Print(std::format("Invalid size '{}'", arg.substr(16)));
+				return false;
+			}
+			continue;
+		}
+
+		if ( arg.starts_with("--max-files=") ) {
+			if ( !ParseUInt(arg.substr(12), opts.maxFiles) || opts.maxFiles == 0 ) {
+				Print(std::format("Invalid file count '{}'", arg.substr(12)));
+				return false;
+			}
+			continue;
+		}
+
+		Print(std::format("Unknown option '{}'", arg));
+		PrintUsage();
+		return false;
+	}
+
+	if ( !opts.filesFrom.empty() && (opts.isolate || !opts.packPath.empty() || opts.maxFiles != 0) ) {
+		Print("--files-from cannot be combined with --isolate, --pack or --max-files");
+		return false;
+	}
+
+	if ( !opts.reproDir.empty() && opts.slowFileMs == 0 ) {
+		Print("--repro-dir requires --slow-ms");
+		return false;
+	}
+
+	// Ids below BC6H are the layouts the cache is known to use, taking one over would decode all of its textures wrongly
+	if ( opts.bc6hLayoutId < uint32(TCOLayout::BC6H) || opts.bc7LayoutId < uint32(TCOLayout::BC6H) ) {
+		Print(std::format("--bc6h-layout and --bc7-layout must not use the id of a known layout (0-{})", uint32(TCOLayout::BC6H) - 1));
+		return false;
+	}
+
+	if ( opts.bc6hLayoutId == opts.bc7LayoutId ) {
+		Print(std::format("--bc6h-layout and --bc7-layout cannot both be {}", opts.bc6hLayoutId));
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "Common.h"
+#include "CpuDispatch.h"
+#include "Output.h"
+
+enum class Command {
+	Dump,
+	BenchKernels,
+	BenchAsync,
+	Analyze,
+	Mount,
+	Pack,
+	Estimate,
+	Sweep,
+	Prune
+};
+
+// Injected behaviour of the simulated storage backend, see Storage.h
+struct SimStorageOptions {
+	bool enabled = false;
+	float latencyMs = 0.0f;
+	float jitterMs = 0.0f;
+	// 0 = unlimited
+	float bandwidthMBps = 0.0f;
+	// Fraction of operations that fail
+	float errorRate = 0.0f;
+	uint64 seed = 1;
+};
+
+struct Options {
+	Command command = Command::Dump;
+	// The arguments as given, without the program name
+	std::vector<std::string> vecArgs;
+
+	bool forceCpuLevel = false;
+	CpuLevel cpuLevel = CpuLevel::Scalar;
+
+	// 0 = one per hardware thread
+	uint32 numThreads = 0;
+
+	// analyze
+	std::vector<int> vecHCLevels = {4, 9, 12};
+	// analyze, sweep, prune: report path without extension, empty = ./<command>_report
+	std::string reportPath;
+
+	// sweep: the points to run, see Sweep.h. No thread counts = powers of two up to the hardware threads.
+	std::vector<uint32> vecSweepThreads;
+	std::vector<std::string> vecSweepIO = {"normal", "batch", "unbuffered"};
+	// Each entry is one --formats value, with '+' between formats written together
+	std::vector<std::string> vecSweepFormats = {"tga"};
+	bool sweepWarm = true;
+	bool sweepCold = true;
+	bool sweepStrong = true;
+	bool sweepWeak = true;
+	// Runs per point, the fastest one is kept
+	uint32 sweepRepeat = 1;
+
+	// prune: size to trim the cache to, UINT64_MAX = not given. Files are only touched with pruneApply.
+	uint64 pruneBudgetMB = UINT64_MAX;
+	bool pruneApply = false;
+	// prune: keep entries the dump manifest lists, see Durability.h
+	bool keepDumped = false;
+	// prune: move pruned files here instead of deleting them
+	std::string pruneMoveTo;
+
+	// Overrides the detected encoding of R11G11B10 payloads
+	bool forceR11G11B10 = false;
+	R11G11B10Encoding r11g11b10Encoding = R11G11B10Encoding::RGBA8;
+	// Scale applied before tone-mapping HDR sources to 8 bits
+	float exposure = 1.0f;
+	// Raw layout ids read as BC6H / BC7, which are not confirmed yet
+	uint32 bc6hLayoutId = uint32(TCOLayout::BC6H);
+	uint32 bc7LayoutId = uint32(TCOLayout::BC7);
+
+	// Decode BC textures chunk by chunk straight out of the LZ4 stream
+	bool fusedDecode = false;
+
+	// dump: file name globs or "layout:<name>" to process first
+	std::vector<std::string> vecPriority;
+	// dump: hand out files in batches of the same layout and size class
+	bool layoutBatching = true;
+	// dump: read each batch with overlapped I/O issued at once, optionally bypassing the file cache
+	bool batchIO = false;
+	bool unbufferedIO = false;
+	// dump: decode in crash-isolated worker processes instead of threads, 0 = one per thread
+	bool isolate = false;
+	uint32 numWorkerProcesses = 0;
+	// Set on worker processes by the supervisor: "<section name>,<slot>"
+	std::string workerArg;
+	// dump: send large batches to P-cores and small ones to E-cores on hybrid CPUs
+	bool hybridScheduling = true;
+
+	// dump: only dump this many files, picked evenly from the cache, 0 = all
+	uint32 maxFiles = 0;
+	// dump: file with the paths to dump instead of ./Textures/, "-" = stdin
+	std::string filesFrom;
+
+	// dump: DurabilityFlags of the outputs, and when they are flushed, see Durability.h
+	uint32 durability = 0;
+	uint32 syncFiles = 256;
+	uint32 syncMB = 256;
+	uint32 syncLargeMB = 16;
+
+	// dump: files taking longer than this are logged with their stage times, 0 = off
+	uint32 slowFileMs = 0;
+	// dump: copy every slow file and the command line into a replayable bundle here
+	std::string reproDir;
+	// dump: Prometheus textfile written every metricsIntervalSeconds, empty = off
+	std::string metricsPath;
+	uint32 metricsIntervalSeconds = 15;
+
+	// Retries of failed reads and writes
+	uint32 ioRetries = 2;
+	SimStorageOptions simStorage;
+
+	// pack: file to write, dump: pack to read instead of ./Textures/
+	std::string packPath;
+
+	// Output formats, empty = the command's default
+	std::vector<OutputFormat> vecFormats;
+	// Longer edge of "thumb" outputs
+	uint32 thumbSize = 256;
+	// 1-100, of "jpg" outputs
+	uint32 jpegQuality = 85;
+
+	// mount
+	std::string mountPoint;
+	uint64 cacheMB = 512;
+	uint32 readahead = 4;
+};
+
+extern Options gOptions;
+
+bool ParseArgs(int argc, char** argv, Options& opts);
+void PrintUsage();
@@ -0,0 +1,343 @@
+#include "Output.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+
+#include "stb_image_write.h"
+#include "DirectXTex.h"
+
+#include "BCDecode.h"
+#include "JPEGEncode.h"
+#include "Options.h"
+
+const char* ToString(OutputFormat format) {
+	switch(format) {
+		case OutputFormat::TGA:
+			return "tga";
+		case OutputFormat::PNG:
+			return "png";
+		case OutputFormat::DDS:
+			return "dds";
+		case OutputFormat::Thumb:
+			return "thumb";
+		case OutputFormat::HDR:
+			return "hdr";
+		case OutputFormat::JPEG:
+			return "jpg";
+		default:
+			return "ERROR";
+	}
+}
+
+const char* GetExtension(OutputFormat format) {
+	if ( format == OutputFormat::Thumb )
+		return "thumb.png";
+	return ToString(format);
+}
+
+bool ParseOutputFormat(std::string_view str, OutputFormat& format) {
+	for ( int i = 0; i < int(OutputFormat::Count); ++i ) {
+		if ( str == ToString(OutputFormat(i)) ) {
+			format = OutputFormat(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+uint32 GetNumChannels(TCOLayout layout) {
+	switch(layout) {
+		case TCOLayout::BC1:
+		case TCOLayout::BC2:
+		case TCOLayout::BC3:
+		case TCOLayout::BC6H:
+		case TCOLayout::BC7:
+		case TCOLayout::R11G11B10:
+		case TCOLayout::RGBA8:
+			return 4;
+		case TCOLayout::BC5:
+		case TCOLayout::RG16:
+		case TCOLayout::R32G8:
+		case TCOLayout::R24G8:
+			return 2;
+		case TCOLayout::BC4:
+		case TCOLayout::R16:
+		case TCOLayout::R32:
+		case TCOLayout::R8:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+void FlipRowsInPlace(uint8* pixels, uint64 rowBytes, uint32 numRows) {
+	std::vector<uint8> vecTemp(rowBytes);
+	uint8* pTop = pixels;
+	uint8* pBottom = pixels + (numRows - 1) * rowBytes;
+	for ( uint32 i = 0; i < numRows / 2; ++i ) {
+		memcpy(vecTemp.data(), pTop, rowBytes);
+		memcpy(pTop, pBottom, rowBytes);
+		memcpy(pBottom, vecTemp.data(), rowBytes);
+		pTop += rowBytes;
+		pBottom -= rowBytes;
+	}
+}
+
+void OrientForOutput(DecodedImage& img) {
+	if ( !img.flipV && img.height > 1 ) {
+		FlipRowsInPlace(img.pPixels.get(), uint64(img.width) * img.numChannels, img.height);
+		if ( img.pHDR )
+			FlipRowsInPlace((uint8*)img.pHDR.get(), uint64(img.width) * 4 * sizeof(float), img.height);
+	}
+	// Flipped once, further calls must not flip it back
+	img.flipV = true;
+}
+
+uint64 GetTGASize(const TCOHeader& tcoHeader) {
+	constexpr uint64 tgaHeaderSize = 18;
+	return tgaHeaderSize + uint64(tcoHeader.width) * tcoHeader.height * GetNumChannels(tcoHeader.layout);
+}
+
+static void AppendToVector(void* context, void* data, int size) {
+	std::vector<uint8>& out = *(std::vector<uint8>*)context;
+	out.insert(out.end(), (uint8*)data, (uint8*)data + size);
+}
+
+bool EncodeTGA(const DecodedImage& img, std::vector<uint8>& out) {
+	out.clear();
+	return stbi_write_tga_to_func(AppendToVector, &out, img.width, img.height, img.numChannels, img.pPixels.get()) != 0;
+}
+
+bool EncodePNG(const DecodedImage& img, std::vector<uint8>& out) {
+	out.clear();
+	int stride = int(img.width * img.numChannels);
+	return stbi_write_png_to_func(AppendToVector, &out, img.width, img.height, img.numChannels, img.pPixels.get(), stride) != 0;
+}
+
+uint64 GetPNGSizeBound(uint32 width, uint32 height, uint32 numChannels) {
+	// Signature, IHDR, IEND and the IDAT chunk header and CRC
+	constexpr uint64 pngOverhead = 8 + 25 + 12 + 12;
+	// Every row is prefixed by its filter type. stb's fixed Huffman deflate falls back to stored blocks of at most
+	// 32767 bytes with a 5 byte header each when it does not pay off, framed by the 2 byte zlib header and Adler-32.
+	uint64 filteredSize = uint64(height) * (uint64(width) * numChannels + 1);
+	uint64 zlibSize = 2 + filteredSize + (filteredSize + 32766) / 32767 * 5 + 4;
+	return pngOverhead + zlibSize;
+}
+
+void GetDownscaledSize(uint32 width, uint32 height, uint32 maxEdge, uint32& dstW, uint32& dstH) {
+	uint32 longEdge = std::max(width, height);
+	dstW = width;
+	dstH = height;
+	if ( longEdge > maxEdge ) {
+		dstW = std::max(uint32(uint64(width) * maxEdge / longEdge), 1u);
+		dstH = std::max(uint32(uint64(height) * maxEdge / longEdge), 1u);
+	}
+}
+
+void Downscale(const DecodedImage& src, uint32 maxEdge, DecodedImage& dst) {
+	uint32 dstW = 0;
+	uint32 dstH = 0;
+	GetDownscaledSize(src.width, src.height, maxEdge, dstW, dstH);
+
+	uint32 c = src.numChannels;
+	dst.width = dstW;
+	dst.height = dstH;
+	dst.numChannels = c;
+	dst.flipV = src.flipV;
+	dst.pPixels.reset(new uint8[uint64(dstW) * dstH * c]);
+
+	// Every destination pixel averages the source pixels it covers, at least one
+	for ( uint32 y = 0; y < dstH; ++y ) {
+		uint32 y0 = uint32(uint64(y) * src.height / dstH);
+		uint32 y1 = std::max(uint32(uint64(y + 1) * src.height / dstH), y0 + 1);
+		for ( uint32 x = 0; x < dstW; ++x ) {
+			uint32 x0 = uint32(uint64(x) * src.width / dstW);
+			uint32 x1 = std::max(uint32(uint64(x + 1) * src.width / dstW), x0 + 1);
+
+			uint32 sums[4] = {};
+			for ( uint32 sy = y0; sy < y1; ++sy ) {
+				const uint8* pRow = src.pPixels.get() + (uint64(sy) * src.width + x0) * c;
+				for ( uint32 sx = x0; sx < x1; ++sx, pRow += c ) {
+					for ( uint32 ch = 0; ch < c; ++ch )
+						sums[ch] += pRow[ch];
+				}
+			}
+
+			uint32 count = (x1 - x0) * (y1 - y0);
+			uint8* pDst = dst.pPixels.get() + (uint64(y) * dstW + x) * c;
+			for ( uint32 ch = 0; ch < c; ++ch )
+				pDst[ch] = uint8((sums[ch] + count / 2) / count);
+		}
+	}
+}
+
+bool EncodeHDR(const DecodedImage& img, std::vector<uint8>& out) {
+	out.clear();
+	if ( img.pHDR )
+		return stbi_write_hdr_to_func(AppendToVector, &out, img.width, img.height, 4, img.pHDR.get()) != 0;
+
+	uint64 numValues = uint64(img.width) * img.height * img.numChannels;
+	std::vector<float> vecValues(numValues);
+	for ( uint64 i = 0; i < numValues; ++i )
+		vecValues[i] = img.pPixels[i] / 255.0f;
+	return stbi_write_hdr_to_func(AppendToVector, &out, img.width, img.height, img.numChannels, vecValues.data()) != 0;
+}
+
+bool EncodeImage(OutputFormat format, const DecodedImage& img, std::vector<uint8>& out) {
+	switch(format) {
+		case OutputFormat::TGA:
+			return EncodeTGA(img, out);
+		case OutputFormat::PNG:
+			return EncodePNG(img, out);
+		case OutputFormat::Thumb: {
+			DecodedImage thumb;
+			Downscale(img, gOptions.thumbSize, thumb);
+			return EncodePNG(thumb, out);
+		}
+		case OutputFormat::HDR:
+			return EncodeHDR(img, out);
+		case OutputFormat::JPEG:
+			return EncodeJPEG(img, gOptions.jpegQuality, out);
+		default:
+			return false;
+	}
+}
+
+
+// DDS file layout, see the DirectX documentation for DDS_HEADER and DDS_HEADER_DXT10
+struct DDSPixelFormat {
+	uint32 size;
+	uint32 flags;
+	uint32 fourCC;
+	uint32 rgbBitCount;
+	uint32 rBitMask;
+	uint32 gBitMask;
+	uint32 bBitMask;
+	uint32 aBitMask;
+};
+CHECKSZ(DDSPixelFormat, 0x20);
+
+struct DDSHeader {
+	uint32 size;
+	uint32 flags;
+	uint32 height;
+	uint32 width;
+	uint32 pitchOrLinearSize;
+	uint32 depth;
+	uint32 mipMapCount;
+	uint32 _reserved1[11];
+	DDSPixelFormat pixelFormat;
+	uint32 caps;
+	uint32 caps2;
+	uint32 caps3;
+	uint32 caps4;
+	uint32 _reserved2;
+};
+CHECKSZ(DDSHeader, 0x7C);
+
+struct DDSHeaderDX10 {
+	uint32 dxgiFormat;
+	uint32 resourceDimension;
+	uint32 miscFlag;
+	uint32 arraySize;
+	uint32 miscFlags2;
+};
+CHECKSZ(DDSHeaderDX10, 0x14);
+
+constexpr uint32 DDSMagic = 0x20534444; // "DDS "
+constexpr uint64 DDSFileHeaderSize = sizeof(uint32) + sizeof(DDSHeader) + sizeof(DDSHeaderDX10);
+
+static bool GetDXGIFormat(TCOLayout layout, DXGI_FORMAT& format) {
+	switch(layout) {
+		case TCOLayout::BC1:
+			format = DXGI_FORMAT_BC1_UNORM;
+			return true;
+		case TCOLayout::BC2:
+			format = DXGI_FORMAT_BC2_UNORM;
+			return true;
+		case TCOLayout::BC3:
+			format = DXGI_FORMAT_BC3_UNORM;
+			return true;
+		case TCOLayout::BC4:
+			format = DXGI_FORMAT_BC4_UNORM;
+			return true;
+		case TCOLayout::BC5:
+			format = DXGI_FORMAT_BC5_UNORM;
+			return true;
+		case TCOLayout::BC6H:
+			format = DXGI_FORMAT_BC6H_UF16;
+			return true;
+		case TCOLayout::BC7:
+			format = DXGI_FORMAT_BC7_UNORM;
+			return true;
+		case TCOLayout::R11G11B10: // Mostly really RGBA8, EncodeDDS() checks the payload
+		case TCOLayout::RGBA8:
+			format = DXGI_FORMAT_R8G8B8A8_UNORM;
+			return true;
+		case TCOLayout::RG16:
+			format = DXGI_FORMAT_R16G16_UNORM;
+			return true;
+		case TCOLayout::R8:
+			format = DXGI_FORMAT_R8_UNORM;
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool GetDDSSize(const TCOHeader& tcoHeader, const CompressedDataHeader& compHeader, uint64& size) {
+	DXGI_FORMAT format;
+	if ( !GetDXGIFormat(tcoHeader.layout, format) )
+		return false;
+	size = DDSFileHeaderSize + compHeader.decompressedSize;
+	return true;
+}
+
+bool EncodeDDS(const TCOHeader& tcoHeader, const char* payload, uint64 payloadSize, std::vector<uint8>& out) {
+	DXGI_FORMAT format;
+	if ( !GetDXGIFormat(tcoHeader.layout, format) )
+		return false;
+
+	if ( tcoHeader.layout == TCOLayout::R11G11B10 && DetectR11G11B10Encoding(payload, payloadSize, tcoHeader) == R11G11B10Encoding::PackedFloat )
+		format = DXGI_FORMAT_R11G11B10_FLOAT;
+
+	size_t rowPitch = 0;
+	size_t slicePitch = 0;
+	if ( FAILED(DirectX::ComputePitch(format, tcoHeader.width, tcoHeader.height, rowPitch, slicePitch)) )
+		return false;
+
+	bool compressed = IsBCLayout(tcoHeader.layout);
+	uint32 numMips = std::max(tcoHeader.numMips, 1u);
+
+	DDSHeader header = {};
+	header.size = sizeof(DDSHeader);
+	header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000; // CAPS | HEIGHT | WIDTH | PIXELFORMAT | MIPMAPCOUNT
+	header.flags |= compressed ? 0x80000 : 0x8; // LINEARSIZE : PITCH
+	header.height = tcoHeader.height;
+	header.width = tcoHeader.width;
+	header.pitchOrLinearSize = uint32(compressed ? slicePitch : rowPitch);
+	header.mipMapCount = numMips;
+	header.pixelFormat.size = sizeof(DDSPixelFormat);
+	header.pixelFormat.flags = 0x4; // FOURCC
+	header.pixelFormat.fourCC = 0x30315844; // "DX10"
+	header.caps = 0x1000; // TEXTURE
+	if ( numMips > 1 )
+		header.caps |= 0x8 | 0x400000; // COMPLEX | MIPMAP
+
+	DDSHeaderDX10 headerDX10 = {};
+	headerDX10.dxgiFormat = uint32(format);
+	headerDX10.resourceDimension = 3; // TEXTURE2D
+	headerDX10.arraySize = 1;
+
+	out.resize(DDSFileHeaderSize + payloadSize);
+	uint8* p = out.data();
+	memcpy(p, &DDSMagic, sizeof(DDSMagic));
+	memcpy(p + sizeof(DDSMagic), &header, sizeof(header));
+	memcpy(p + sizeof(DDSMagic) + sizeof(header), &headerDX10, sizeof(headerDX10));
+	memcpy(p + DDSFileHeaderSize, payload, payloadSize);
+	return true;
+}
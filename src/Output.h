@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string_view>
+
+#include "Common.h"
+#include "TCO.h"
+#include "Decoder.h"
+
+enum class OutputFormat {
+	TGA, PNG, DDS, Thumb, HDR, JPEG,
+	// Number of formats, for tables indexed by OutputFormat
+	Count
+};
+
+// Name used by --formats
+const char* ToString(OutputFormat format);
+const char* GetExtension(OutputFormat format);
+bool ParseOutputFormat(std::string_view str, OutputFormat& format);
+
+// Channel count of a decoded image for the given layout, 0 if the layout is unsupported
+uint32 GetNumChannels(TCOLayout layout);
+
+// Reverses the row order of a pixel buffer in place
+void FlipRowsInPlace(uint8* pixels, uint64 rowBytes, uint32 numRows);
+
+// Puts the rows of a freshly decoded image into the top-down order the encoders write.
+// Done on the pixels instead of via stbi_flip_vertically_on_write(), which is a global shared by all threads.
+void OrientForOutput(DecodedImage& img);
+
+// Size of an uncompressed (non-RLE) TGA of mip 0, known from the headers alone
+uint64 GetTGASize(const TCOHeader& tcoHeader);
+bool EncodeTGA(const DecodedImage& img, std::vector<uint8>& out);
+bool EncodePNG(const DecodedImage& img, std::vector<uint8>& out);
+// Largest PNG EncodePNG() can write for an image of this size, whatever its pixels
+uint64 GetPNGSizeBound(uint32 width, uint32 height, uint32 numChannels);
+
+// Area-averaged downscale so that the longer edge is at most `maxEdge`, smaller images are copied as is.
+// GetDownscaledSize() gives the size of the result without any pixels.
+void GetDownscaledSize(uint32 width, uint32 height, uint32 maxEdge, uint32& dstW, uint32& dstH);
+void Downscale(const DecodedImage& src, uint32 maxEdge, DecodedImage& dst);
+
+// Radiance .hdr of the float pixels, or of the 8 bit ones scaled to [0, 1] for sources without them
+bool EncodeHDR(const DecodedImage& img, std::vector<uint8>& out);
+
+// Encodes a decoded image to any format but DDS. Thumbnails are PNGs of at most --thumb-size pixels,
+// JPEGs use --jpeg-quality, see JPEGEncode.h.
+bool EncodeImage(OutputFormat format, const DecodedImage& img, std::vector<uint8>& out);
+
+// DDS output stores the untouched decompressed payload including all mips, so it needs no decoding.
+// Returns false if the layout has no matching DXGI format.
+bool GetDDSSize(const TCOHeader& tcoHeader, const CompressedDataHeader& compHeader, uint64& size);
+bool EncodeDDS(const TCOHeader& tcoHeader, const char* payload, uint64 payloadSize, std::vector<uint8>& out);
@@ -0,0 +1,238 @@
+#include "Pack.h"
+
+#include <algorithm>
+#include <format>
+#include <fstream>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+
+uint64 HashPackName(std::string_view name) {
+	uint64 hash = 0xCBF29CE484222325ull;
+	for ( char c : name ) {
+		if ( c >= 'A' && c <= 'Z' )
+			c = char(c - 'A' + 'a');
+		hash ^= uint8(c);
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+static int CompareNames(std::string_view a, std::string_view b) {
+	uint64 len = std::min(a.size(), b.size());
+	for ( uint64 i = 0; i < len; ++i ) {
+		char ca = (a[i] >= 'A' && a[i] <= 'Z') ? char(a[i] - 'A' + 'a') : a[i];
+		char cb = (b[i] >= 'A' && b[i] <= 'Z') ? char(b[i] - 'A' + 'a') : b[i];
+		if ( ca != cb )
+			return ca < cb ? -1 : 1;
+	}
+	return a.size() == b.size() ? 0 : (a.size() < b.size() ? -1 : 1);
+}
+
+static void WritePadding(std::ofstream& file, uint64& offset) {
+	static const char zeros[PackAlignment] = {};
+	uint64 padding = (PackAlignment - offset % PackAlignment) % PackAlignment;
+	file.write(zeros, padding);
+	offset += padding;
+}
+
+int RunPack(const std::filesystem::path& dir, const std::filesystem::path& packPath) {
+	std::vector<TCOFileInfo> vecInfos = PrescanFiles(CollectTCOFiles(dir));
+	Print(std::format("Packing {} TCO files into '{}'", vecInfos.size(), packPath.string()));
+
+	struct PendingEntry {
+		const TCOFileInfo* pInfo;
+		std::string name;
+		uint64 hash;
+	};
+	std::vector<PendingEntry> vecPending;
+	for ( const TCOFileInfo& info : vecInfos ) {
+		std::string name = info.path.filename().string();
+		uint64 hash = HashPackName(name);
+		vecPending.push_back({&info, std::move(name), hash});
+	}
+	std::sort(vecPending.begin(), vecPending.end(), [](const PendingEntry& a, const PendingEntry& b) {
+		if ( a.hash != b.hash )
+			return a.hash < b.hash;
+		return CompareNames(a.name, b.name) < 0;
+	});
+
+	std::filesystem::path tmpPath = packPath;
+	tmpPath += ".tmp";
+	std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+	if ( !file ) {
+		Print(std::format("Failed to create '{}'", tmpPath.string()));
+		return 1;
+	}
+
+	PackHeader header = {};
+	header.magic = PackMagic;
+	header.version = PackVersion;
+	file.write((const char*)&header, sizeof(header));
+	uint64 offset = sizeof(header);
+
+	std::vector<PackEntry> vecEntries;
+	std::string names;
+	for ( const PendingEntry& pending : vecPending ) {
+		std::string data = ReadFile(pending.pInfo->path);
+		if ( data.size() != pending.pInfo->fileSize ) {
+			LogError(pending.name, "File changed or could not be read while packing, skipped");
+			continue;
+		}
+
+		WritePadding(file, offset);
+
+		PackEntry& entry = vecEntries.emplace_back();
+		entry.nameHash = pending.hash;
+		entry.offset = offset;
+		entry.size = data.size();
+		entry.nameOffset = uint32(names.size());
+		entry.nameLength = uint32(pending.name.size());
+		entry.compHeader = pending.pInfo->compHeader;
+		entry.tcoHeader = pending.pInfo->tcoHeader;
+		names += pending.name;
+
+		file.write(data.data(), data.size());
+		offset += data.size();
+	}
+
+	WritePadding(file, offset);
+	header.numEntries = vecEntries.size();
+	header.entriesOffset = offset;
+	file.write((const char*)vecEntries.data(), vecEntries.size() * sizeof(PackEntry));
+	offset += vecEntries.size() * sizeof(PackEntry);
+
+	header.namesOffset = offset;
+	header.namesSize = names.size();
+	file.write(names.data(), names.size());
+
+	file.seekp(0);
+	file.write((const char*)&header, sizeof(header));
+	file.close();
+	if ( !file ) {
+		Print(std::format("Failed to write '{}'", tmpPath.string()));
+		return 1;
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(tmpPath, packPath, ec);
+	if ( ec ) {
+		Print(std::format("Failed to rename '{}' to '{}': {}", tmpPath.string(), packPath.string(), ec.message()));
+		return 1;
+	}
+
+	Print(std::format("Wrote {} entries, {} bytes", vecEntries.size(), offset + names.size()));
+	return 0;
+}
+
+
+PackReader::~PackReader() {
+	Close();
+}
+
+std::string PackReader::Open(const std::filesystem::path& path) {
+	Close();
+
+	HANDLE hFile = CreateFileW(
+		path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr
+	);
+	if ( hFile == INVALID_HANDLE_VALUE )
+		return std::format("Failed to open pack file (error {})", GetLastError());
+	m_hFile = hFile;
+
+	LARGE_INTEGER size;
+	if ( !GetFileSizeEx(hFile, &size) || size.QuadPart < LONGLONG(sizeof(PackHeader)) ) {
+		Close();
+		return "Pack file is too small";
+	}
+	m_size = uint64(size.QuadPart);
+
+	m_hMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if ( m_hMapping == nullptr ) {
+		Close();
+		return std::format("Failed to map pack file (error {})", GetLastError());
+	}
+
+	m_pBase = (const char*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+	if ( m_pBase == nullptr ) {
+		Close();
+		return std::format("Failed to map pack file (error {})", GetLastError());
+	}
+
+	const PackHeader& header = *(const PackHeader*)m_pBase;
+	if ( header.magic != PackMagic || header.version != PackVersion ) {
+		Close();
+		return "Not a pack file, or an unsupported version";
+	}
+
+	if ( header.entriesOffset + header.numEntries * sizeof(PackEntry) > m_size || header.namesOffset + header.namesSize > m_size ) {
+		Close();
+		return "Pack file is truncated";
+	}
+
+	m_pEntries = (const PackEntry*)(m_pBase + header.entriesOffset);
+	m_numEntries = header.numEntries;
+	m_pNames = m_pBase + header.namesOffset;
+	m_namesSize = header.namesSize;
+
+	for ( uint64 i = 0; i < m_numEntries; ++i ) {
+		const PackEntry& entry = m_pEntries[i];
+		if ( entry.offset + entry.size > m_size || uint64(entry.nameOffset) + entry.nameLength > m_namesSize ) {
+			Close();
+			return std::format("Pack entry {} points outside of the file", i);
+		}
+	}
+	return {};
+}
+
+void PackReader::Close() {
+	if ( m_pBase != nullptr )
+		UnmapViewOfFile(m_pBase);
+	if ( m_hMapping != nullptr )
+		CloseHandle(m_hMapping);
+	if ( m_hFile != nullptr )
+		CloseHandle(m_hFile);
+
+	m_hFile = nullptr;
+	m_hMapping = nullptr;
+	m_pBase = nullptr;
+	m_size = 0;
+	m_pEntries = nullptr;
+	m_numEntries = 0;
+	m_pNames = nullptr;
+	m_namesSize = 0;
+}
+
+std::string_view PackReader::GetName(const PackEntry& entry) const {
+	return std::string_view(m_pNames + entry.nameOffset, entry.nameLength);
+}
+
+const PackEntry* PackReader::Find(std::string_view name) const {
+	uint64 hash = HashPackName(name);
+	const PackEntry* pEnd = m_pEntries + m_numEntries;
+	const PackEntry* pEntry = std::lower_bound(m_pEntries, pEnd, hash, [](const PackEntry& entry, uint64 h) {
+		return entry.nameHash < h;
+	});
+
+	// Entries sharing a hash are adjacent
+	for ( ; pEntry != pEnd && pEntry->nameHash == hash; ++pEntry ) {
+		if ( CompareNames(GetName(*pEntry), name) == 0 )
+			return pEntry;
+	}
+	return nullptr;
+}
+
+std::vector<TCOFileInfo> PackReader::GetFileInfos() const {
+	std::vector<TCOFileInfo> vecInfos(m_numEntries);
+	for ( uint64 i = 0; i < m_numEntries; ++i ) {
+		const PackEntry& entry = m_pEntries[i];
+		TCOFileInfo& info = vecInfos[i];
+		info.path = GetName(entry);
+		info.fileSize = entry.size;
+		info.compHeader = entry.compHeader;
+		info.tcoHeader = entry.tcoHeader;
+		info.pData = GetData(entry);
+	}
+	return vecInfos;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string_view>
+
+#include "Common.h"
+#include "TCO.h"
+
+/*
+	Pack file layout:
+	PackHeader | entry data (each .tco file unchanged, aligned to PackAlignment) | PackEntry[numEntries] | names
+
+	The entry table is sorted by (nameHash, name), so lookups are a binary search and the
+	prescanned headers of every entry are available without touching the entry data.
+*/
+
+constexpr uint32 PackMagic = 0x504F4354; // "TCOP"
+constexpr uint32 PackVersion = 1;
+constexpr uint64 PackAlignment = 64;
+
+struct PackHeader {
+	uint32 magic;
+	uint32 version;
+	uint64 numEntries;
+	uint64 entriesOffset;
+	uint64 namesOffset;
+	uint64 namesSize;
+};
+CHECKSZ(PackHeader, 0x28);
+
+struct PackEntry {
+	uint64 nameHash;
+	uint64 offset;
+	uint64 size;
+	uint32 nameOffset;
+	uint32 nameLength;
+	CompressedDataHeader compHeader;
+	TCOHeader tcoHeader;
+};
+CHECKSZ(PackEntry, 0x50);
+
+// FNV-1a over the lower-cased name, file names on Windows are case-insensitive
+uint64 HashPackName(std::string_view name);
+
+// Packs all .tco files in `dir` into `packPath`
+int RunPack(const std::filesystem::path& dir, const std::filesystem::path& packPath);
+
+// Read-only view of a pack file through one memory mapping
+class PackReader {
+public:
+	PackReader() = default;
+	~PackReader();
+	PackReader(const PackReader&) = delete;
+	PackReader& operator=(const PackReader&) = delete;
+
+	// Returns an error message, or an empty string on success
+	std::string Open(const std::filesystem::path& path);
+	void Close();
+
+	uint64 GetNumEntries() const { return m_numEntries; }
+	const PackEntry& GetEntry(uint64 index) const { return m_pEntries[index]; }
+	std::string_view GetName(const PackEntry& entry) const;
+	const char* GetData(const PackEntry& entry) const { return m_pBase + entry.offset; }
+
+	// O(log n) lookup by file name, nullptr if not present
+	const PackEntry* Find(std::string_view name) const;
+
+	// Entry metadata in the same form the header prescan produces
+	std::vector<TCOFileInfo> GetFileInfos() const;
+
+private:
+	void* m_hFile = nullptr;
+	void* m_hMapping = nullptr;
+	const char* m_pBase = nullptr;
+	uint64 m_size = 0;
+
+	const PackEntry* m_pEntries = nullptr;
+	uint64 m_numEntries = 0;
+	const char* m_pNames = nullptr;
+	uint64 m_namesSize = 0;
+};
@@ -0,0 +1,253 @@
+#include "Prune.h"
+#include "TCO.h"
+#include "Options.h"
+#include "Scheduler.h"
+#include "Storage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <format>
+#include <fstream>
+#include <map>
+#include <set>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+
+// FILETIME ticks are 100 ns
+constexpr uint64 TicksPerDay = 24ull * 60 * 60 * 10'000'000;
+
+struct PruneEntry {
+	TCOFileInfo info;
+	// FILETIME of the later of the last access and the last write
+	uint64 lastUse = 0;
+	// Headers parsed, the game can load the entry
+	bool valid = false;
+	// Listed in the dump manifest and kept with --keep-dumped
+	bool keep = false;
+	bool prune = false;
+};
+
+static uint64 ToTicks(const FILETIME& time) {
+	return (uint64(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+}
+
+static std::string FormatDate(uint64 ticks) {
+	FILETIME time = {DWORD(ticks), DWORD(ticks >> 32)};
+	SYSTEMTIME sys;
+	if ( ticks == 0 || !FileTimeToSystemTime(&time, &sys) )
+		return "unknown";
+	return std::format("{:04}-{:02}-{:02}", sys.wYear, sys.wMonth, sys.wDay);
+}
+
+static std::string FormatBytes(double bytes) {
+	if ( bytes >= 1024.0 * 1024.0 * 1024.0 )
+		return std::format("{:.2f} GB", bytes / (1024.0 * 1024.0 * 1024.0));
+	return std::format("{:.1f} MB", bytes / (1024.0 * 1024.0));
+}
+
+// Source file names the manifest of earlier dumps lists as written, see Durability.h
+static std::set<std::string> ReadDumpedNames(const std::filesystem::path& manifestPath) {
+	std::set<std::string> setNames;
+	std::ifstream file(manifestPath);
+	for ( std::string line; std::getline(file, line); ) {
+		uint64 first = line.find('\t');
+		uint64 second = first == std::string::npos ? std::string::npos : line.find('\t', first + 1);
+		if ( second != std::string::npos )
+			setNames.emplace(line.substr(first + 1, second - first - 1));
+	}
+	return setNames;
+}
+
+static void ScanOneFile(const std::filesystem::path& path, PruneEntry& entry) {
+	entry.info.path = path;
+
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	bool hasAttributes = GetFileAttributesExW(path.wstring().c_str(), GetFileExInfoStandard, &attributes);
+	if ( hasAttributes ) {
+		// Last access times are only as fresh as the volume keeps them, the write time still bounds them from below
+		entry.lastUse = std::max(ToTicks(attributes.ftLastAccessTime), ToTicks(attributes.ftLastWriteTime));
+		entry.info.fileSize = (uint64(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+	}
+
+	// A failed prescan still leaves the file size, and the entry is pruned as unreadable
+	uint64 fileSize = entry.info.fileSize;
+	entry.valid = PrescanFile(path, entry.info).empty();
+	if ( !entry.valid )
+		entry.info.fileSize = fileSize;
+
+	// Reading the headers counts as an access, which would make every entry look just used to the next run
+	if ( hasAttributes && GetStorage().IsLocal() ) {
+		HANDLE hFile = CreateFileW(
+			path.wstring().c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, 0, nullptr
+		);
+		if ( hFile != INVALID_HANDLE_VALUE ) {
+			SetFileTime(hFile, nullptr, &attributes.ftLastAccessTime, nullptr);
+			CloseHandle(hFile);
+		}
+	}
+}
+
+// Moves a file to `dir`, copying it where a rename cannot cross volumes
+static bool MoveToDir(const std::filesystem::path& path, const std::filesystem::path& dir, std::string& err) {
+	std::filesystem::path target = dir / path.filename();
+	std::error_code ec;
+	std::filesystem::rename(path, target, ec);
+	if ( !ec )
+		return true;
+
+	if ( !std::filesystem::copy_file(path, target, std::filesystem::copy_options::overwrite_existing, ec) || !std::filesystem::remove(path, ec) ) {
+		err = std::format("Failed to move to '{}': {}", target.string(), ec.message());
+		return false;
+	}
+	return true;
+}
+
+static bool WriteReport(const std::string& path, const std::vector<PruneEntry>& vecEntries) {
+	std::ofstream file(path, std::ios::trunc);
+	if ( !file )
+		return false;
+
+	file << "file,action,layout,width,height,bytes,last_use\n";
+	for ( const PruneEntry& entry : vecEntries ) {
+		file << std::format(
+			"{},{},{},{},{},{},{}\n",
+			entry.info.path.filename().string(), entry.prune ? "prune" : entry.keep ? "keep-dumped" : "keep",
+			entry.valid ? ToString(entry.info.tcoHeader.layout) : "invalid", entry.info.tcoHeader.width, entry.info.tcoHeader.height,
+			entry.info.fileSize, FormatDate(entry.lastUse)
+		);
+	}
+	return bool(file);
+}
+
+int RunPrune(const std::filesystem::path& dir) {
+	if ( gOptions.pruneBudgetMB == UINT64_MAX ) {
+		Print("prune requires --budget-mb=<n>");
+		return 1;
+	}
+	uint64 budget = gOptions.pruneBudgetMB << 20;
+
+	std::vector<std::filesystem::path> vecPaths = CollectTCOFiles(dir);
+	std::vector<PruneEntry> vecEntries(vecPaths.size());
+	ParallelFor(vecPaths.size(), [&](uint64 i) {
+		ScanOneFile(vecPaths[i], vecEntries[i]);
+	});
+
+	uint64 totalBytes = 0;
+	uint64 numInvalid = 0;
+	for ( const PruneEntry& entry : vecEntries ) {
+		totalBytes += entry.info.fileSize;
+		numInvalid += !entry.valid;
+	}
+	Print(std::format(
+		"Found {} TCO files, {} in total, budget {}{}",
+		vecEntries.size(), FormatBytes(double(totalBytes)), FormatBytes(double(budget)),
+		numInvalid != 0 ? std::format(", {} with unreadable headers", numInvalid) : ""
+	));
+
+	if ( gOptions.keepDumped ) {
+		std::filesystem::path manifestPath = "./Textures_OUT/manifest.txt";
+		std::set<std::string> setDumped = ReadDumpedNames(manifestPath);
+		if ( setDumped.empty() )
+			Print(std::format("'{}' lists no dumped files, nothing is kept by --keep-dumped", manifestPath.string()));
+		for ( PruneEntry& entry : vecEntries )
+			entry.keep = setDumped.contains(entry.info.path.filename().string());
+	}
+
+	// Unreadable entries first, then the least recently used, and of those used on the same day the largest
+	std::sort(vecEntries.begin(), vecEntries.end(), [](const PruneEntry& a, const PruneEntry& b) {
+		if ( a.valid != b.valid )
+			return !a.valid;
+		if ( a.lastUse / TicksPerDay != b.lastUse / TicksPerDay )
+			return a.lastUse < b.lastUse;
+		return a.info.fileSize > b.info.fileSize;
+	});
+
+	uint64 remainingBytes = totalBytes;
+	uint64 numPruned = 0;
+	uint64 prunedBytes = 0;
+	std::map<std::string, std::pair<uint64, uint64>> mapLayouts;
+	for ( PruneEntry& entry : vecEntries ) {
+		if ( remainingBytes <= budget )
+			break;
+		if ( entry.keep )
+			continue;
+
+		entry.prune = true;
+		remainingBytes -= entry.info.fileSize;
+		++numPruned;
+		prunedBytes += entry.info.fileSize;
+
+		auto& [count, bytes] = mapLayouts[entry.valid ? ToString(entry.info.tcoHeader.layout) : "invalid"];
+		++count;
+		bytes += entry.info.fileSize;
+	}
+
+	std::string reportPath = (gOptions.reportPath.empty() ? "./prune_report" : gOptions.reportPath) + ".csv";
+	if ( !WriteReport(reportPath, vecEntries) )
+		Print(std::format("Failed to write report to '{}'", reportPath));
+
+	if ( numPruned == 0 ) {
+		Print(totalBytes <= budget ? "The cache fits the budget, nothing to prune" : "The entries kept by --keep-dumped alone exceed the budget, nothing to prune");
+		return 0;
+	}
+
+	uint64 firstUse = UINT64_MAX;
+	uint64 lastUse = 0;
+	for ( const PruneEntry& entry : vecEntries ) {
+		if ( entry.prune && entry.valid ) {
+			firstUse = std::min(firstUse, entry.lastUse);
+			lastUse = std::max(lastUse, entry.lastUse);
+		}
+	}
+
+	Print(std::format(
+		"\n{} {} files, reclaiming {} ({} left):",
+		gOptions.pruneApply ? "Pruning" : "Would prune", numPruned, FormatBytes(double(prunedBytes)), FormatBytes(double(remainingBytes))
+	));
+	for ( const auto& [layout, totals] : mapLayouts )
+		Print(std::format("  {:<10} {:>7} files {:>12}", layout, totals.first, FormatBytes(double(totals.second))));
+	if ( lastUse != 0 )
+		Print(std::format("Last used between {} and {}", FormatDate(firstUse), FormatDate(lastUse)));
+	if ( remainingBytes > budget )
+		Print("WARNING: the entries kept by --keep-dumped alone exceed the budget");
+	Print(std::format("Every entry is listed in '{}'", reportPath));
+
+	if ( !gOptions.pruneApply ) {
+		Print(std::format("\nDry run, nothing was {}. Run again with --apply to do so.", gOptions.pruneMoveTo.empty() ? "deleted" : "moved"));
+		return 0;
+	}
+
+	std::filesystem::path moveTo = gOptions.pruneMoveTo;
+	if ( !moveTo.empty() ) {
+		std::error_code ec;
+		std::filesystem::create_directories(moveTo, ec);
+		if ( ec ) {
+			Print(std::format("Failed to create '{}': {}", moveTo.string(), ec.message()));
+			return 1;
+		}
+	}
+
+	std::atomic<uint64> numFailed = 0;
+	ParallelFor(vecEntries.size(), [&](uint64 i) {
+		const PruneEntry& entry = vecEntries[i];
+		if ( !entry.prune )
+			return;
+
+		std::string err;
+		std::error_code ec;
+		if ( !moveTo.empty() ) {
+			if ( !MoveToDir(entry.info.path, moveTo, err) ) {
+				LogError(entry.info.path.filename().string(), err);
+				++numFailed;
+			}
+		} else if ( !std::filesystem::remove(entry.info.path, ec) ) {
+			LogError(entry.info.path.filename().string(), std::format("Failed to delete: {}", ec ? ec.message() : "not found"));
+			++numFailed;
+		}
+	});
+
+	Print(std::format("\n{} {} files{}", moveTo.empty() ? "Deleted" : "Moved", numPruned - numFailed, numFailed != 0 ? std::format(", {} failed", numFailed.load()) : ""));
+	return numFailed != 0 ? 1 : 0;
+}
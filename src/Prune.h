@@ -0,0 +1,13 @@
+#pragma once
+
+#include "Common.h"
+
+/*
+	Trims the TCO files in `dir` down to --budget-mb. Entries are ranked by their last use, the later of the
+	access and write times, and on the same day by size, largest first. Entries whose headers do not parse
+	are never loaded by the game and go first. The oldest entries are pruned until the rest fits the budget,
+	skipping entries listed in the dump manifest with --keep-dumped.
+	What would be reclaimed is always printed and written to --report first, files are only deleted (or moved
+	to --move-to) with --apply.
+*/
+int RunPrune(const std::filesystem::path& dir);
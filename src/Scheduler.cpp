@@ -0,0 +1,287 @@
+#include "Scheduler.h"
+#include "Options.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+uint32 GetNumThreads() {
+	if ( gOptions.numThreads != 0 )
+		return gOptions.numThreads;
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+uint32 GetNumHybridThreads() {
+	const CpuTopology& topology = GetCpuTopology();
+	if ( !gOptions.hybridScheduling || !topology.IsHybrid() )
+		return GetNumThreads();
+	return uint32(std::min<uint64>(GetNumThreads(), topology.vecProcessors.size()));
+}
+
+void ParallelFor(uint64 count, const std::function<void(uint64)>& fn) {
+	uint32 numThreads = uint32(std::min<uint64>(GetNumThreads(), count));
+	std::atomic<uint64> nextIndex = 0;
+
+	auto worker = [&]() {
+		for ( uint64 i = nextIndex++; i < count; i = nextIndex++ )
+			fn(i);
+	};
+
+	std::vector<std::thread> vecThreads;
+	for ( uint32 i = 1; i < numThreads; ++i )
+		vecThreads.emplace_back(worker);
+	worker();
+
+	for ( std::thread& th : vecThreads )
+		th.join();
+}
+
+void ParallelForHybrid(uint64 count, const std::function<void(uint64, CoreType)>& fn) {
+	const CpuTopology& topology = GetCpuTopology();
+	uint32 numThreads = uint32(std::min<uint64>(GetNumHybridThreads(), count));
+
+	if ( !gOptions.hybridScheduling || !topology.IsHybrid() || numThreads < 2 ) {
+		ParallelFor(count, [&fn](uint64 i) { fn(i, CoreType::Performance); });
+		return;
+	}
+
+	std::mutex mutex;
+	uint64 front = 0;
+	uint64 back = count;
+
+	auto worker = [&](const LogicalProcessor& proc) {
+		PinCurrentThread(proc);
+		for ( ;; ) {
+			uint64 i;
+			{
+				std::scoped_lock l(mutex);
+				if ( front == back )
+					return;
+				i = proc.type == CoreType::Performance ? front++ : --back;
+			}
+			fn(i, proc.type);
+		}
+	};
+
+	// Processors are listed P-cores first, with fewer threads than processors the E-cores are left out first.
+	// Workers get threads of their own, so the caller keeps its affinity.
+	std::vector<std::thread> vecThreads;
+	for ( uint32 i = 0; i < numThreads; ++i )
+		vecThreads.emplace_back(worker, std::cref(topology.vecProcessors[i]));
+
+	for ( std::thread& th : vecThreads )
+		th.join();
+}
+
+// One ParallelForHelpers() call, on the caller's stack
+struct HelperCall {
+	const std::function<void(uint64)>* pFn;
+	uint64 count;
+	std::atomic<uint64> nextIndex = 0;
+	// Helpers that took an invitation of this call and may still run `pFn`, guarded by the pool mutex
+	uint32 numRunning = 0;
+};
+
+// Threads of ParallelForHelpers(), started on first use. Every call queues one invitation per helper it could use,
+// a helper taking one runs indices of that call until none are left.
+class HelperPool {
+public:
+	~HelperPool() {
+		{
+			std::scoped_lock l(m_mutex);
+			m_stop = true;
+		}
+		m_queueCV.notify_all();
+		for ( std::thread& th : m_vecThreads )
+			th.join();
+	}
+
+	void Run(HelperCall& call) {
+		{
+			std::scoped_lock l(m_mutex);
+			if ( m_vecThreads.empty() ) {
+				for ( uint32 i = 0; i < GetNumThreads(); ++i )
+					m_vecThreads.emplace_back(&HelperPool::Worker, this);
+			}
+			uint64 numInvitations = std::min<uint64>(call.count - 1, m_vecThreads.size());
+			for ( uint64 i = 0; i < numInvitations; ++i )
+				m_dequeInvitations.push_back(&call);
+		}
+		m_queueCV.notify_all();
+
+		RunIndices(call);
+
+		// Invitations nobody took are withdrawn, then the helpers still on an index are waited for
+		std::unique_lock l(m_mutex);
+		std::erase(m_dequeInvitations, &call);
+		m_doneCV.wait(l, [&call]() { return call.numRunning == 0; });
+	}
+
+private:
+	static void RunIndices(HelperCall& call) {
+		for ( uint64 i = call.nextIndex++; i < call.count; i = call.nextIndex++ )
+			(*call.pFn)(i);
+	}
+
+	void Worker() {
+		std::unique_lock l(m_mutex);
+		for ( ;; ) {
+			m_queueCV.wait(l, [this]() { return m_stop || !m_dequeInvitations.empty(); });
+			if ( m_stop )
+				return;
+
+			// Taken under the mutex, so the caller cannot return while this helper is about to run its indices
+			HelperCall& call = *m_dequeInvitations.front();
+			m_dequeInvitations.pop_front();
+			++call.numRunning;
+			l.unlock();
+			RunIndices(call);
+			l.lock();
+			if ( --call.numRunning == 0 )
+				m_doneCV.notify_all();
+		}
+	}
+
+	std::mutex m_mutex;
+	std::condition_variable m_queueCV;
+	std::condition_variable m_doneCV;
+	std::deque<HelperCall*> m_dequeInvitations;
+	std::vector<std::thread> m_vecThreads;
+	bool m_stop = false;
+};
+
+void ParallelForHelpers(uint64 count, const std::function<void(uint64)>& fn) {
+	if ( count == 0 )
+		return;
+	if ( count == 1 ) {
+		fn(0);
+		return;
+	}
+
+	static HelperPool pool;
+	HelperCall call;
+	call.pFn = &fn;
+	call.count = count;
+	pool.Run(call);
+}
+
+bool MatchGlob(std::string_view pattern, std::string_view name) {
+	auto lower = [](char c) { return (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c; };
+
+	// Iterative matching with backtracking to the most recent '*'
+	uint64 p = 0;
+	uint64 n = 0;
+	uint64 starP = std::string_view::npos;
+	uint64 starN = 0;
+	while ( n < name.size() ) {
+		if ( p < pattern.size() && (pattern[p] == '?' || lower(pattern[p]) == lower(name[n])) ) {
+			++p;
+			++n;
+		} else if ( p < pattern.size() && pattern[p] == '*' ) {
+			starP = p++;
+			starN = n;
+		} else if ( starP != std::string_view::npos ) {
+			p = starP + 1;
+			n = ++starN;
+		} else {
+			return false;
+		}
+	}
+
+	while ( p < pattern.size() && pattern[p] == '*' )
+		++p;
+	return p == pattern.size();
+}
+
+static bool MatchesPriority(const std::string& pattern, const TCOFileInfo& info) {
+	constexpr std::string_view layoutPrefix = "layout:";
+	if ( pattern.starts_with(layoutPrefix) )
+		return MatchGlob(std::string_view(pattern).substr(layoutPrefix.size()), ToString(info.tcoHeader.layout));
+	return MatchGlob(pattern, info.path.filename().string());
+}
+
+std::vector<uint64> BuildWorkOrder(const std::vector<TCOFileInfo>& vecInfos, const std::vector<std::string>& vecPriority, uint64& numPrioritized) {
+	constexpr uint64 notPrioritized = ~0ull;
+
+	std::vector<uint64> vecRank(vecInfos.size(), notPrioritized);
+	numPrioritized = 0;
+	for ( uint64 i = 0; i < vecInfos.size(); ++i ) {
+		for ( uint64 p = 0; p < vecPriority.size(); ++p ) {
+			if ( MatchesPriority(vecPriority[p], vecInfos[i]) ) {
+				vecRank[i] = p;
+				++numPrioritized;
+				break;
+			}
+		}
+	}
+
+	std::vector<uint64> vecOrder(vecInfos.size());
+	for ( uint64 i = 0; i < vecOrder.size(); ++i )
+		vecOrder[i] = i;
+
+	std::stable_sort(vecOrder.begin(), vecOrder.end(), [&](uint64 a, uint64 b) {
+		if ( vecRank[a] != vecRank[b] )
+			return vecRank[a] < vecRank[b];
+		return vecInfos[a].compHeader.decompressedSize > vecInfos[b].compHeader.decompressedSize;
+	});
+	return vecOrder;
+}
+
+std::vector<WorkBatch> BuildBatches(const std::vector<TCOFileInfo>& vecInfos, std::vector<uint64>& vecOrder, uint64 numPrioritized, bool homogeneous) {
+	constexpr uint64 maxBatchFiles = 32;
+	constexpr uint64 maxBatchBytes = 64ull << 20;
+
+	std::vector<WorkBatch> vecBatches;
+	for ( uint64 i = 0; i < numPrioritized; ++i )
+		vecBatches.push_back({i, i + 1});
+
+	if ( !homogeneous ) {
+		for ( uint64 i = numPrioritized; i < vecOrder.size(); ++i )
+			vecBatches.push_back({i, i + 1});
+		return vecBatches;
+	}
+
+	auto getSize = [&](uint64 idx) { return uint64(vecInfos[idx].compHeader.decompressedSize); };
+	auto getGroup = [&](uint64 idx) {
+		return std::make_pair(int(vecInfos[idx].tcoHeader.layout), GetSizeClass(getSize(idx)));
+	};
+
+	// Group by layout and size class, largest first within each group
+	std::stable_sort(vecOrder.begin() + numPrioritized, vecOrder.end(), [&](uint64 a, uint64 b) {
+		auto groupA = getGroup(a);
+		auto groupB = getGroup(b);
+		if ( groupA != groupB )
+			return groupA < groupB;
+		return getSize(a) > getSize(b);
+	});
+
+	struct BatchRange {
+		WorkBatch batch;
+		uint64 bytes;
+	};
+	std::vector<BatchRange> vecRanges;
+	for ( uint64 i = numPrioritized; i < vecOrder.size(); ) {
+		BatchRange range = {{i, i}, 0};
+		auto group = getGroup(vecOrder[i]);
+		while ( range.batch.end < vecOrder.size() && getGroup(vecOrder[range.batch.end]) == group ) {
+			uint64 size = getSize(vecOrder[range.batch.end]);
+			bool full = range.batch.end - range.batch.begin >= maxBatchFiles || range.bytes + size > maxBatchBytes;
+			if ( full && range.batch.end != range.batch.begin )
+				break;
+			range.bytes += size;
+			++range.batch.end;
+		}
+		vecRanges.push_back(range);
+		i = range.batch.end;
+	}
+
+	std::stable_sort(vecRanges.begin(), vecRanges.end(), [](const BatchRange& a, const BatchRange& b) {
+		return a.bytes > b.bytes;
+	});
+	for ( const BatchRange& range : vecRanges )
+		vecBatches.push_back(range.batch);
+	return vecBatches;
+}
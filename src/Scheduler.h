@@ -0,0 +1,51 @@
+#pragma once
+
+#include <functional>
+#include <string_view>
+
+#include "Common.h"
+#include "TCO.h"
+#include "Topology.h"
+
+// Worker count from --threads, or the number of hardware threads
+uint32 GetNumThreads();
+// Workers ParallelForHybrid() starts. On hybrid CPUs each is pinned to a logical processor of its own,
+// so GetNumThreads() is capped at their number there.
+uint32 GetNumHybridThreads();
+
+// Calls `fn` for every index in [0, count) on GetNumThreads() threads.
+// Indices are handed out one at a time, so uneven work items do not leave threads idle.
+void ParallelFor(uint64 count, const std::function<void(uint64)>& fn);
+
+// ParallelFor() for work ordered from heaviest to lightest, e.g. by BuildBatches().
+// On hybrid CPUs every worker is pinned to one logical processor. Performance cores take items from the front,
+// efficiency cores from the back, until both ends meet, so the big items do not end up on a slow core while
+// neither type idles as long as work is left. Elsewhere, or with --no-hybrid, this is a plain ParallelFor().
+void ParallelForHybrid(uint64 count, const std::function<void(uint64, CoreType)>& fn);
+
+// Calls `fn` for every index in [0, count) on the calling thread, with the help of whichever of the GetNumThreads()
+// helper threads shared by the whole process are idle. Indices the helpers do not get to are run by the caller,
+// so it never waits for a free helper, and nested calls from a helper cannot deadlock. Unlike ParallelFor(), no
+// threads are started per call, so work split off by every worker at once adds at most GetNumThreads() threads.
+void ParallelForHelpers(uint64 count, const std::function<void(uint64)>& fn);
+
+// Case-insensitive wildcard match supporting '*' and '?'
+bool MatchGlob(std::string_view pattern, std::string_view name);
+
+// Order in which to process files, as indices into `vecInfos`.
+// Files matching a priority pattern come first, ordered by the first pattern they match. A pattern is a
+// file name glob, or "layout:<name>" to match a layout. All remaining files follow, largest first, so that
+// the biggest items do not start last and leave a single thread running at the end.
+std::vector<uint64> BuildWorkOrder(const std::vector<TCOFileInfo>& vecInfos, const std::vector<std::string>& vecPriority, uint64& numPrioritized);
+
+// A run of consecutive entries in a work order that one worker processes back to back
+struct WorkBatch {
+	uint64 begin;
+	uint64 end;
+};
+
+// Splits a work order from BuildWorkOrder() into batches. Prioritized files stay single, in front.
+// The rest is regrouped so that each batch holds files of one layout and size class, which keeps one
+// decode path and buffer size hot per worker. Batches are capped in file count and bytes to stay
+// balanced, and ordered largest first. Without `homogeneous` every file becomes its own batch.
+std::vector<WorkBatch> BuildBatches(const std::vector<TCOFileInfo>& vecInfos, std::vector<uint64>& vecOrder, uint64 numPrioritized, bool homogeneous);
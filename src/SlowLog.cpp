@@ -0,0 +1,143 @@
+#include "SlowLog.h"
+#include "Options.h"
+
+#include <algorithm>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+struct SlowFile {
+	TCOFileInfo info;
+	uint64 nanoseconds = 0;
+	bool hasStages = false;
+	uint64 stageNanoseconds[int(FileStage::Count)] = {};
+};
+
+static std::mutex gSlowMutex;
+static std::vector<SlowFile> gVecSlowFiles;
+
+const char* ToString(FileStage stage) {
+	switch(stage) {
+		case FileStage::Read:
+			return "read";
+		case FileStage::Decode:
+			return "decode";
+		case FileStage::Encode:
+			return "encode";
+		case FileStage::Write:
+			return "write";
+		default:
+			return "ERROR";
+	}
+}
+
+static std::string FormatEntry(const SlowFile& file) {
+	const TCOFileInfo& info = file.info;
+	std::string line = std::format("{} {:.1f} ms", info.path.filename().string(), file.nanoseconds / 1e6);
+	if ( file.hasStages ) {
+		for ( int i = 0; i < int(FileStage::Count); ++i )
+			line += std::format(", {} {:.1f} ms", ToString(FileStage(i)), file.stageNanoseconds[i] / 1e6);
+	}
+
+	const TCOHeader& header = info.tcoHeader;
+	const CompressedDataHeader& compHeader = info.compHeader;
+	line += std::format(
+		" | {}x{} {} mips {} flipV {}, file {} bytes, compressed {} -> {} bytes ({:.2f}x)",
+		header.width, header.height, ToString(header.layout), header.numMips, header.flipV, info.fileSize,
+		compHeader.compressedSize, compHeader.decompressedSize,
+		compHeader.compressedSize != 0 ? double(compHeader.decompressedSize) / compHeader.compressedSize : 0.0
+	);
+	return line;
+}
+
+// The options of this run, minus those that select files or only concern the slow log itself
+static std::string GetReplayArgs() {
+	std::string args;
+	for ( uint64 i = 0; i < gOptions.vecArgs.size(); ++i ) {
+		const std::string& arg = gOptions.vecArgs[i];
+		if ( arg.starts_with("--slow-ms=") || arg.starts_with("--repro-dir=") || arg.starts_with("--pack=") || arg.starts_with("--worker=") )
+			continue;
+		if ( arg.starts_with("--files-from=") )
+			continue;
+		// The two argument form, its list goes with it
+		if ( arg == "--files-from" ) {
+			++i;
+			continue;
+		}
+		args += arg.find(' ') == std::string::npos ? std::format(" {}", arg) : std::format(" \"{}\"", arg);
+	}
+	return args;
+}
+
+/*
+	Each bundle is a directory with the file as the only entry of Textures/ and the command line that produced it,
+	so running that command from the bundle directory replays exactly this file, e.g. under a profiler.
+	Entries of a pack are written out from the mapping.
+*/
+static void WriteReproBundle(const SlowFile& file) {
+	std::string fName = file.info.path.filename().string();
+	std::filesystem::path dir = std::filesystem::path(gOptions.reproDir) / fName;
+
+	std::error_code ec;
+	std::filesystem::create_directories(dir / "Textures", ec);
+	if ( file.info.pData != nullptr ) {
+		std::ofstream out(dir / "Textures" / fName, std::ios::binary | std::ios::trunc);
+		out.write(file.info.pData, file.info.fileSize);
+		ec = out ? std::error_code() : std::make_error_code(std::errc::io_error);
+	} else if ( !ec ) {
+		std::filesystem::copy_file(file.info.path, dir / "Textures" / fName, std::filesystem::copy_options::overwrite_existing, ec);
+	}
+	if ( ec ) {
+		Print(std::format("Failed to write the repro bundle of '{}': {}", fName, ec.message()));
+		return;
+	}
+
+	std::ofstream out(dir / "repro.txt", std::ios::trunc);
+	out << std::format("command: CacheDumper.exe{}\n", GetReplayArgs());
+	out << "Run it from this directory to replay the file.\n";
+	out << FormatEntry(file) << '\n';
+}
+
+void RecordFileTime(const TCOFileInfo& info, std::chrono::steady_clock::duration elapsed, const FileStageTimes* pTimes) {
+	if ( gOptions.slowFileMs == 0 || elapsed < std::chrono::milliseconds(gOptions.slowFileMs) )
+		return;
+
+	SlowFile file;
+	file.info = info;
+	file.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	if ( pTimes ) {
+		file.hasStages = true;
+		for ( int i = 0; i < int(FileStage::Count); ++i )
+			file.stageNanoseconds[i] = pTimes->nanoseconds[i];
+	}
+
+	Print(std::format("SLOW: {}", FormatEntry(file)));
+
+	// Bundles are written right away, a later crash must not lose them
+	if ( !gOptions.reproDir.empty() )
+		WriteReproBundle(file);
+
+	std::scoped_lock l(gSlowMutex);
+	gVecSlowFiles.push_back(std::move(file));
+}
+
+void WriteSlowLog() {
+	std::scoped_lock l(gSlowMutex);
+	if ( gVecSlowFiles.empty() )
+		return;
+
+	std::sort(gVecSlowFiles.begin(), gVecSlowFiles.end(), [](const SlowFile& a, const SlowFile& b) {
+		return a.nanoseconds > b.nanoseconds;
+	});
+
+	std::ofstream file("./Textures_OUT/slow_files.txt", std::ios::trunc);
+	for ( const SlowFile& slowFile : gVecSlowFiles )
+		file << FormatEntry(slowFile) << '\n';
+
+	Print(std::format(
+		"\n{} files took longer than {} ms, listed in ./Textures_OUT/slow_files.txt{}",
+		gVecSlowFiles.size(), gOptions.slowFileMs,
+		gOptions.reproDir.empty() ? "" : std::format(" with repro bundles in {}", gOptions.reproDir)
+	));
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+#include "Common.h"
+#include "TCO.h"
+
+enum class FileStage {
+	Read,
+	Decode,
+	Encode,
+	Write,
+	Count
+};
+
+const char* ToString(FileStage stage);
+
+// Time spent in each stage of one file. Encoders of several formats run in parallel, so the stages can add up to more than the file took.
+struct FileStageTimes {
+	std::atomic<uint64> nanoseconds[int(FileStage::Count)] = {};
+};
+
+// Adds the time until it goes out of scope to one stage, does nothing without `pTimes`
+class StageTimer {
+public:
+	StageTimer(FileStageTimes* pTimes, FileStage stage) : m_pTimes(pTimes), m_stage(stage), m_start(std::chrono::steady_clock::now()) {}
+	~StageTimer() {
+		if ( m_pTimes )
+			m_pTimes->nanoseconds[int(m_stage)] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+	}
+
+	StageTimer(const StageTimer&) = delete;
+	StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+	FileStageTimes* m_pTimes;
+	FileStage m_stage;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+// Records the file if it took longer than --slow-ms, and copies it into a repro bundle under --repro-dir.
+// `pTimes` may be nullptr where no stage breakdown was measured (worker processes).
+void RecordFileTime(const TCOFileInfo& info, std::chrono::steady_clock::duration elapsed, const FileStageTimes* pTimes);
+
+// Writes every recorded file to ./Textures_OUT/slow_files.txt, slowest first, and prints a summary
+void WriteSlowLog();
@@ -0,0 +1,237 @@
+#include "Storage.h"
+#include "Options.h"
+
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+
+class LocalStorage : public Storage {
+public:
+	IOStatus Read(const std::filesystem::path& path, std::string& data, std::string& err, uint64 maxSize, uint64* pFileSize) override {
+		try {
+			if ( !std::filesystem::exists(path) )
+				return IOStatus::NotFound;
+
+			uint64 fileSize = std::filesystem::file_size(path);
+			if ( pFileSize )
+				*pFileSize = fileSize;
+
+			uint64 size = std::min(fileSize, maxSize);
+			data.assign(size, '\0');
+			std::ifstream file;
+			file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+			file.open(path, std::ios::binary);
+			file.read(data.data(), size);
+			return IOStatus::Ok;
+
+		} catch ( const std::exception& e ) {
+			err = e.what();
+			return IOStatus::Failed;
+		}
+	}
+
+	IOStatus Write(const std::filesystem::path& path, const void* data, uint64 size, std::string& err) override {
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if ( !file || !file.write((const char*)data, size) ) {
+			err = "Failed to write file";
+			return IOStatus::Failed;
+		}
+		return IOStatus::Ok;
+	}
+
+	IOStatus Sync(const std::filesystem::path& path, std::string& err) override {
+		// Flushing needs write access, the handle the file was written through is long closed
+		HANDLE hFile = CreateFileW(path.wstring().c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+		if ( hFile == INVALID_HANDLE_VALUE ) {
+			DWORD code = GetLastError();
+			err = std::format("Failed to open file for flushing ({})", code);
+			return code == ERROR_FILE_NOT_FOUND ? IOStatus::NotFound : IOStatus::Failed;
+		}
+
+		bool flushed = FlushFileBuffers(hFile);
+		if ( !flushed )
+			err = std::format("Failed to flush file ({})", GetLastError());
+		CloseHandle(hFile);
+		return flushed ? IOStatus::Ok : IOStatus::Failed;
+	}
+
+	IOStatus Rename(const std::filesystem::path& from, const std::filesystem::path& to, std::string& err) override {
+		std::error_code ec;
+		std::filesystem::rename(from, to, ec);
+		if ( ec ) {
+			err = std::format("Failed to rename file: {}", ec.message());
+			return IOStatus::Failed;
+		}
+		return IOStatus::Ok;
+	}
+};
+
+/*
+	Wraps the local file system with the behaviour of a slow network share or hard drive:
+	every operation waits a fixed latency plus jitter, transfers share one link of limited bandwidth
+	(a FIFO, so latencies overlap but transfers queue up), and a fraction of operations fails.
+	Jitter and failures are derived from the seed, the path and how often that path was accessed,
+	so runs are reproducible regardless of how threads interleave.
+*/
+class SimulatedStorage : public Storage {
+public:
+	SimulatedStorage(const SimStorageOptions& opts) : m_opts(opts) {}
+
+	IOStatus Read(const std::filesystem::path& path, std::string& data, std::string& err, uint64 maxSize, uint64* pFileSize) override {
+		bool fail = Simulate(path, 'r', 0);
+		if ( fail ) {
+			err = "Simulated transient read error";
+			return IOStatus::Failed;
+		}
+
+		IOStatus status = m_local.Read(path, data, err, maxSize, pFileSize);
+		if ( status == IOStatus::Ok )
+			Transfer(data.size());
+		return status;
+	}
+
+	IOStatus Write(const std::filesystem::path& path, const void* data, uint64 size, std::string& err) override {
+		if ( Simulate(path, 'w', size) ) {
+			err = "Simulated transient write error";
+			return IOStatus::Failed;
+		}
+		return m_local.Write(path, data, size, err);
+	}
+
+	IOStatus Sync(const std::filesystem::path& path, std::string& err) override {
+		if ( Simulate(path, 's', 0) ) {
+			err = "Simulated transient flush error";
+			return IOStatus::Failed;
+		}
+		return m_local.Sync(path, err);
+	}
+
+	IOStatus Rename(const std::filesystem::path& from, const std::filesystem::path& to, std::string& err) override {
+		if ( Simulate(from, 'm', 0) ) {
+			err = "Simulated transient rename error";
+			return IOStatus::Failed;
+		}
+		return m_local.Rename(from, to, err);
+	}
+
+	bool IsLocal() const override { return false; }
+
+	std::string GetStats() const override {
+		return std::format(
+			"Simulated storage: {} operations, {} injected errors, {:.1f} MB transferred",
+			m_numOps.load(), m_numErrors.load(), m_numBytes.load() / (1024.0 * 1024.0)
+		);
+	}
+
+private:
+	static uint64 Mix(uint64 x) {
+		// splitmix64 finalizer
+		x += 0x9E3779B97F4A7C15ull;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+
+	// Waits the latency and decides whether the operation fails. Writes pass their size, reads transfer after the fact.
+	bool Simulate(const std::filesystem::path& path, char kind, uint64 writeSize) {
+		++m_numOps;
+
+		std::string key = kind + path.string();
+		uint64 attempt;
+		{
+			std::scoped_lock l(m_mutex);
+			attempt = m_mapAttempts[key]++;
+		}
+		uint64 h = Mix(m_opts.seed ^ Mix(std::hash<std::string>()(key) ^ Mix(attempt)));
+		double jitterRand = double(h >> 11) / double(1ull << 53);
+		double errorRand = double(Mix(h) >> 11) / double(1ull << 53);
+
+		double latencyMs = m_opts.latencyMs + m_opts.jitterMs * jitterRand;
+		if ( latencyMs > 0.0 )
+			std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(latencyMs));
+
+		if ( errorRand < m_opts.errorRate ) {
+			++m_numErrors;
+			return true;
+		}
+
+		if ( writeSize != 0 )
+			Transfer(writeSize);
+		return false;
+	}
+
+	void Transfer(uint64 bytes) {
+		m_numBytes += bytes;
+		if ( m_opts.bandwidthMBps <= 0.0 )
+			return;
+
+		auto duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(bytes / (m_opts.bandwidthMBps * 1024.0 * 1024.0))
+		);
+		std::chrono::steady_clock::time_point done;
+		{
+			std::scoped_lock l(m_mutex);
+			auto start = std::max(std::chrono::steady_clock::now(), m_linkFreeAt);
+			done = start + duration;
+			m_linkFreeAt = done;
+		}
+		std::this_thread::sleep_until(done);
+	}
+
+	SimStorageOptions m_opts;
+	LocalStorage m_local;
+
+	std::mutex m_mutex;
+	std::unordered_map<std::string, uint64> m_mapAttempts;
+	std::chrono::steady_clock::time_point m_linkFreeAt = {};
+
+	std::atomic<uint64> m_numOps = 0;
+	std::atomic<uint64> m_numErrors = 0;
+	std::atomic<uint64> m_numBytes = 0;
+};
+
+static std::unique_ptr<Storage> gpStorage = std::make_unique<LocalStorage>();
+
+void InitStorage() {
+	if ( gOptions.simStorage.enabled )
+		gpStorage = std::make_unique<SimulatedStorage>(gOptions.simStorage);
+}
+
+Storage& GetStorage() {
+	return *gpStorage;
+}
+
+template<typename Fn>
+static IOStatus Retry(Fn fn) {
+	IOStatus status = IOStatus::Failed;
+	for ( uint32 attempt = 0; ; ++attempt ) {
+		status = fn();
+		if ( status != IOStatus::Failed || attempt >= gOptions.ioRetries )
+			return status;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10ll << std::min(attempt, 8u)));
+	}
+}
+
+IOStatus ReadWithRetry(const std::filesystem::path& path, std::string& data, std::string& err, uint64 maxSize, uint64* pFileSize) {
+	return Retry([&]() { return GetStorage().Read(path, data, err, maxSize, pFileSize); });
+}
+
+IOStatus WriteWithRetry(const std::filesystem::path& path, const void* data, uint64 size, std::string& err) {
+	return Retry([&]() { return GetStorage().Write(path, data, size, err); });
+}
+
+IOStatus SyncWithRetry(const std::filesystem::path& path, std::string& err) {
+	return Retry([&]() { return GetStorage().Sync(path, err); });
+}
+
+IOStatus RenameWithRetry(const std::filesystem::path& from, const std::filesystem::path& to, std::string& err) {
+	return Retry([&]() { return GetStorage().Rename(from, to, err); });
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+
+#include "Common.h"
+
+enum class IOStatus {
+	Ok, NotFound, Failed
+};
+
+// Backend all file reads and writes of inputs and outputs go through
+class Storage {
+public:
+	virtual ~Storage() = default;
+
+	// Reads the first `maxSize` bytes of a file, all of it by default, and optionally its total size
+	virtual IOStatus Read(const std::filesystem::path& path, std::string& data, std::string& err, uint64 maxSize = ~0ull, uint64* pFileSize = nullptr) = 0;
+	// Creates or replaces a file
+	virtual IOStatus Write(const std::filesystem::path& path, const void* data, uint64 size, std::string& err) = 0;
+	// Flushes a written file from the file cache to the device
+	virtual IOStatus Sync(const std::filesystem::path& path, std::string& err) = 0;
+	// Moves `from` to `to`, replacing it if it exists
+	virtual IOStatus Rename(const std::filesystem::path& from, const std::filesystem::path& to, std::string& err) = 0;
+
+	// False for backends that only simulate the local file system's behaviour
+	virtual bool IsLocal() const { return true; }
+	// One line summary of what the backend did, empty if there is nothing to report
+	virtual std::string GetStats() const { return {}; }
+};
+
+// Selects the backend from the options, the local file system unless a --sim-* option is given
+void InitStorage();
+Storage& GetStorage();
+
+// Read() and Write() of the current backend, retried up to --io-retries times with exponential backoff.
+// A missing file is not retried.
+IOStatus ReadWithRetry(const std::filesystem::path& path, std::string& data, std::string& err, uint64 maxSize = ~0ull, uint64* pFileSize = nullptr);
+IOStatus WriteWithRetry(const std::filesystem::path& path, const void* data, uint64 size, std::string& err);
+IOStatus SyncWithRetry(const std::filesystem::path& path, std::string& err);
+IOStatus RenameWithRetry(const std::filesystem::path& from, const std::filesystem::path& to, std::string& err);
@@ -0,0 +1,297 @@
+#include "Sweep.h"
+#include "Options.h"
+#include "Pack.h"
+#include "Scheduler.h"
+#include "Storage.h"
+#include "TCO.h"
+
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <set>
+#include <thread>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+
+// Series whose efficiency drops below this are reported as saturated from that thread count
+constexpr double SaturatedEfficiency = 0.8;
+
+struct SweepResult {
+	double seconds = 0.0;
+	uint32 exitCode = 0;
+};
+
+// Options of this run handed on to every dump, minus the command and those each point sets itself
+static std::string GetPassthroughArgs() {
+	static constexpr std::string_view SetPerPoint[] = {
+		"--threads=", "--formats=", "--batch-io", "--unbuffered", "--max-files=", "--report=", "--sweep-"
+	};
+
+	std::string args;
+	for ( uint64 i = 0; i < gOptions.vecArgs.size(); ++i ) {
+		const std::string& arg = gOptions.vecArgs[i];
+		if ( i == 0 && !arg.starts_with("-") )
+			continue;
+		if ( std::any_of(std::begin(SetPerPoint), std::end(SetPerPoint), [&](std::string_view prefix) { return arg.starts_with(prefix); }) )
+			continue;
+		args += arg.find(' ') == std::string::npos ? std::format(" {}", arg) : std::format(" \"{}\"", arg);
+	}
+	return args;
+}
+
+// Runs one dump with its output discarded, and times it from process creation to exit
+static bool RunDump(const std::string& args, SweepResult& result) {
+	char exePath[MAX_PATH];
+	GetModuleFileNameA(nullptr, exePath, MAX_PATH);
+	std::string cmdLine = std::format("\"{}\" dump{}", exePath, args);
+
+	// Printing every file would cost the dump time and drown the sweep's own output
+	SECURITY_ATTRIBUTES sa = {sizeof(sa), nullptr, TRUE};
+	HANDLE hNul = CreateFileA("NUL", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+
+	STARTUPINFOA si = {};
+	si.cb = sizeof(si);
+	si.dwFlags = STARTF_USESTDHANDLES;
+	si.hStdInput = hNul;
+	si.hStdOutput = hNul;
+	si.hStdError = hNul;
+	PROCESS_INFORMATION pi = {};
+
+	auto start = std::chrono::steady_clock::now();
+	BOOL created = CreateProcessA(nullptr, cmdLine.data(), nullptr, nullptr, TRUE, 0, nullptr, nullptr, &si, &pi);
+	if ( hNul != INVALID_HANDLE_VALUE )
+		CloseHandle(hNul);
+	if ( !created )
+		return false;
+
+	WaitForSingleObject(pi.hProcess, INFINITE);
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	DWORD exitCode = 0;
+	GetExitCodeProcess(pi.hProcess, &exitCode);
+	result.exitCode = exitCode;
+
+	CloseHandle(pi.hThread);
+	CloseHandle(pi.hProcess);
+	return true;
+}
+
+/*
+	Drops every clean page of the file cache (the standby list), the Windows counterpart of evicting the corpus
+	with posix_fadvise(POSIX_FADV_DONTNEED). Needs the profile-single-process privilege, held by administrators.
+*/
+static bool PurgeFileCache() {
+	HANDLE hToken;
+	if ( !OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken) )
+		return false;
+
+	TOKEN_PRIVILEGES privileges = {};
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	// AdjustTokenPrivileges() succeeds with ERROR_NOT_ALL_ASSIGNED if the privilege is not held
+	bool enabled = LookupPrivilegeValueA(nullptr, "SeProfileSingleProcessPrivilege", &privileges.Privileges[0].Luid)
+		&& AdjustTokenPrivileges(hToken, FALSE, &privileges, 0, nullptr, nullptr) && GetLastError() == ERROR_SUCCESS;
+	CloseHandle(hToken);
+	if ( !enabled )
+		return false;
+
+	using NtSetSystemInformationFn = LONG(WINAPI*)(int, void*, ULONG);
+	auto pNtSetSystemInformation = (NtSetSystemInformationFn)GetProcAddress(GetModuleHandleA("ntdll.dll"), "NtSetSystemInformation");
+	if ( pNtSetSystemInformation == nullptr )
+		return false;
+
+	// SystemMemoryListInformation, MemoryPurgeStandbyList
+	constexpr int SystemMemoryListInformation = 80;
+	int command = 4;
+	return pNtSetSystemInformation(SystemMemoryListInformation, &command, sizeof(command)) >= 0;
+}
+
+// Reads every corpus file once, so warm points find it in the file cache
+static void WarmFileCache(const std::vector<std::filesystem::path>& vecPaths) {
+	ParallelFor(vecPaths.size(), [&](uint64 i) {
+		std::ifstream file(vecPaths[i], std::ios::binary);
+		std::vector<char> buffer(1 << 20);
+		while ( file.read(buffer.data(), buffer.size()) || file.gcount() != 0 ) {}
+	});
+}
+
+static std::vector<uint32> GetThreadCounts() {
+	std::vector<uint32> vecThreads = gOptions.vecSweepThreads;
+	if ( vecThreads.empty() ) {
+		uint32 numHardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+		for ( uint32 n = 1; n < numHardwareThreads; n *= 2 )
+			vecThreads.push_back(n);
+		vecThreads.push_back(numHardwareThreads);
+	}
+
+	std::sort(vecThreads.begin(), vecThreads.end());
+	vecThreads.erase(std::unique(vecThreads.begin(), vecThreads.end()), vecThreads.end());
+	return vecThreads;
+}
+
+int RunSweep(const std::filesystem::path& dir) {
+	// The corpus is what one dump with the current options reads
+	std::vector<std::filesystem::path> vecCorpus;
+	uint64 numFiles = 0;
+	uint64 corpusBytes = 0;
+	if ( !gOptions.packPath.empty() ) {
+		PackReader pack;
+		std::string err = pack.Open(gOptions.packPath);
+		if ( !err.empty() ) {
+			Print(std::format("Failed to open pack '{}': {}", gOptions.packPath, err));
+			return 1;
+		}
+		numFiles = pack.GetNumEntries();
+		for ( uint64 i = 0; i < numFiles; ++i )
+			corpusBytes += pack.GetEntry(i).size;
+		vecCorpus.emplace_back(gOptions.packPath);
+	} else {
+		vecCorpus = CollectTCOFiles(dir);
+		numFiles = vecCorpus.size();
+		for ( const std::filesystem::path& path : vecCorpus ) {
+			std::error_code ec;
+			uint64 size = std::filesystem::file_size(path, ec);
+			corpusBytes += ec ? 0 : size;
+		}
+	}
+	if ( numFiles == 0 ) {
+		Print("No TCO files to sweep over");
+		return 1;
+	}
+
+	std::vector<uint32> vecThreads = GetThreadCounts();
+	uint32 maxThreads = vecThreads.back();
+
+	std::vector<bool> vecCold;
+	if ( gOptions.sweepWarm )
+		vecCold.push_back(false);
+	if ( gOptions.sweepCold )
+		vecCold.push_back(true);
+
+	std::vector<bool> vecWeak;
+	if ( gOptions.sweepStrong )
+		vecWeak.push_back(false);
+	if ( gOptions.sweepWeak )
+		vecWeak.push_back(true);
+
+	// The dump only reads through --batch-io / --unbuffered from a local directory, not from a pack or simulated storage
+	bool directIO = gOptions.packPath.empty() && GetStorage().IsLocal();
+
+	bool canPurge = gOptions.sweepCold && PurgeFileCache();
+	if ( gOptions.sweepCold && !canPurge ) {
+		if ( !directIO ) {
+			Print("Cold points need an elevated process to empty the file cache when reading from a pack or simulated storage, where --unbuffered has no effect");
+			return 1;
+		}
+		Print("Emptying the file cache needs an elevated process, cold points read with --unbuffered instead");
+	}
+
+	std::string reportPath = (gOptions.reportPath.empty() ? "./sweep_report" : gOptions.reportPath) + ".csv";
+	std::ofstream csv(reportPath, std::ios::trunc);
+	if ( !csv ) {
+		Print(std::format("Failed to write report to '{}'", reportPath));
+		return 1;
+	}
+	csv << "scaling,cache,cold_method,io,formats,threads,files,input_mb,seconds,files_per_second,mb_per_second,speedup,efficiency,exit_code\n";
+
+	Print(std::format(
+		"Sweeping {} files ({:.1f} MB) over {} thread counts, {} I/O backends, {} format sets, {} cache states and {} scaling modes",
+		numFiles, corpusBytes / (1024.0 * 1024.0), vecThreads.size(), gOptions.vecSweepIO.size(),
+		gOptions.vecSweepFormats.size(), vecCold.size(), vecWeak.size()
+	));
+
+	std::string passthrough = GetPassthroughArgs();
+	bool cacheWarm = false;
+	bool failed = false;
+	// Warm points first, so the cache only has to be filled once
+	for ( bool cold : vecCold ) {
+		for ( bool weak : vecWeak ) {
+			// Backends that end up reading the same way are measured once, under the mode they really used
+			std::set<std::string> setMeasuredIO;
+			for ( const std::string& requestedIO : gOptions.vecSweepIO ) {
+				std::string coldMethod = !cold ? "" : canPurge ? "purge" : "unbuffered";
+				std::string io = !directIO ? "normal" : coldMethod == "unbuffered" ? "unbuffered" : requestedIO;
+				if ( !setMeasuredIO.insert(io).second ) {
+					Print(std::format("\n{} scaling, {}: {} I/O reads like {} I/O here, skipped", weak ? "Weak" : "Strong", cold ? "cold" : "warm", requestedIO, io));
+					continue;
+				}
+
+				for ( const std::string& formats : gOptions.vecSweepFormats ) {
+					Print(std::format("\n{} scaling, {}, {} I/O, {}:", weak ? "Weak" : "Strong", cold ? "cold" : "warm", io, formats));
+
+					SweepResult baseline;
+					uint32 baselineThreads = 0;
+					bool saturated = false;
+					for ( uint32 numThreads : vecThreads ) {
+						uint64 pointFiles = weak ? std::max<uint64>((numFiles * numThreads + maxThreads / 2) / maxThreads, 1) : numFiles;
+						double pointMB = corpusBytes * (double(pointFiles) / numFiles) / (1024.0 * 1024.0);
+
+						std::string formatList = formats;
+						std::replace(formatList.begin(), formatList.end(), '+', ',');
+						std::string args = std::format("{} --threads={} --formats={}", passthrough, numThreads, formatList);
+						if ( io == "unbuffered" )
+							args += " --unbuffered";
+						else if ( io == "batch" )
+							args += " --batch-io";
+						if ( pointFiles != numFiles )
+							args += std::format(" --max-files={}", pointFiles);
+
+						SweepResult best;
+						for ( uint32 run = 0; run < gOptions.sweepRepeat; ++run ) {
+							if ( cold && canPurge ) {
+								PurgeFileCache();
+								cacheWarm = false;
+							} else if ( !cold && !cacheWarm ) {
+								WarmFileCache(vecCorpus);
+								cacheWarm = true;
+							}
+
+							SweepResult result;
+							if ( !RunDump(args, result) ) {
+								Print(std::format("Failed to start a dump ({})", GetLastError()));
+								return 1;
+							}
+							if ( run == 0 || result.seconds < best.seconds )
+								best = result;
+						}
+
+						if ( baselineThreads == 0 ) {
+							baseline = best;
+							baselineThreads = numThreads;
+						}
+
+						// Weak scaling ideally keeps the time constant while the work grows with the threads
+						double threadRatio = double(numThreads) / baselineThreads;
+						double speedup = weak ? threadRatio * baseline.seconds / best.seconds : baseline.seconds / best.seconds;
+						double efficiency = speedup / threadRatio;
+
+						Print(std::format(
+							"  {:>4} threads {:>7} files {:>9.2f} s {:>9.1f} MB/s  speedup {:>6.2f}  efficiency {:>5.2f}{}",
+							numThreads, pointFiles, best.seconds, pointMB / best.seconds, speedup, efficiency,
+							best.exitCode != 0 ? std::format("  (exit code {})", best.exitCode) : ""
+						));
+						if ( !saturated && efficiency < SaturatedEfficiency && numThreads != baselineThreads ) {
+							saturated = true;
+							Print(std::format("  ^ efficiency below {:.0f}% from {} threads", SaturatedEfficiency * 100.0, numThreads));
+						}
+						failed |= best.exitCode != 0;
+
+						csv << std::format(
+							"{},{},{},{},{},{},{},{:.3f},{:.4f},{:.2f},{:.2f},{:.4f},{:.4f},{}\n",
+							weak ? "weak" : "strong", cold ? "cold" : "warm", coldMethod, io, formats, numThreads, pointFiles,
+							pointMB, best.seconds, pointFiles / best.seconds, pointMB / best.seconds, speedup, efficiency, best.exitCode
+						);
+						// A sweep can run for hours, finished points must survive it being stopped
+						csv.flush();
+					}
+				}
+			}
+		}
+	}
+
+	Print(std::format("\nWrote '{}'", reportPath));
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "Common.h"
+
+/*
+	Times whole dumps of `dir`, or of the pack given by --pack, in child processes of this executable, across
+	every combination of --sweep-threads, --sweep-io, --sweep-formats, --sweep-cache and --sweep-scaling.
+	Strong scaling dumps the whole cache at every thread count. Weak scaling dumps a share of it that grows with
+	the thread count (--max-files), so the largest thread count dumps all of it.
+	Cold points empty the file cache before each run, which needs an elevated process. Otherwise they read with
+	--unbuffered instead, which keeps reads out of the cache but not the writes.
+	Each series reports speedup and efficiency against its smallest thread count, written to <report>.csv.
+*/
+int RunSweep(const std::filesystem::path& dir);
@@ -0,0 +1,162 @@
+#include "TCO.h"
+#include "Options.h"
+#include "Scheduler.h"
+#include "Storage.h"
+
+#include <algorithm>
+#include <array>
+#include <format>
+#include <mutex>
+
+template<typename T>
+static bool Read(const char*& buf, const char* end, T& res, bool advance = true) {
+	if ( buf + sizeof(T) >= end ) {
+		return false;
+	}
+	res = *(const T*)buf;
+	if ( advance )
+		buf += sizeof(T);
+	return true;
+}
+
+static const std::array<uint64, 5> gSizeClassLimits = {
+	64ull << 10, 256ull << 10, 1ull << 20, 4ull << 20, 16ull << 20
+};
+static const std::array<const char*, 6> gSizeClassNames = {
+	"<64K", "64K-256K", "256K-1M", "1M-4M", "4M-16M", ">=16M"
+};
+
+uint32 GetSizeClass(uint64 decompressedSize) {
+	uint32 i = 0;
+	while ( i < gSizeClassLimits.size() && decompressedSize >= gSizeClassLimits[i] )
+		++i;
+	return i;
+}
+
+const char* GetSizeClassName(uint32 sizeClass) {
+	return sizeClass < gSizeClassNames.size() ? gSizeClassNames[sizeClass] : "ERROR";
+}
+
+uint64 GetMipChainSize(const TCOHeader& header, uint32 numLevels) {
+	uint64 blockDim = 1;
+	uint64 blockBytes = 0;
+	switch ( header.layout ) {
+		case TCOLayout::BC1:
+		case TCOLayout::BC4:
+			blockDim = 4;
+			blockBytes = 8;
+			break;
+		case TCOLayout::BC2:
+		case TCOLayout::BC3:
+		case TCOLayout::BC5:
+		case TCOLayout::BC6H:
+		case TCOLayout::BC7:
+			blockDim = 4;
+			blockBytes = 16;
+			break;
+		case TCOLayout::R11G11B10:
+		case TCOLayout::RGBA8:
+		case TCOLayout::RG16:
+		case TCOLayout::R16:
+			blockBytes = 4;
+			break;
+		case TCOLayout::R8:
+			blockBytes = 1;
+			break;
+		default:
+			return 0;
+	}
+
+	uint64 size = 0;
+	for ( uint32 level = 0; level < std::min(numLevels, std::max(header.numMips, 1u)); ++level ) {
+		uint64 width = std::max<uint64>(header.width >> level, 1);
+		uint64 height = std::max<uint64>(header.height >> level, 1);
+		size += ((width + blockDim - 1) / blockDim) * ((height + blockDim - 1) / blockDim) * blockBytes;
+	}
+	return size;
+}
+
+std::string ParseTCOHeaders(const char* data, uint64 size, CompressedDataHeader& compHeader, TCOHeader& tcoHeader) {
+	if ( size < sizeof(TCOHeader) )
+		return "File is incomplete or malformed";
+
+	const char* pData = data;
+	const char* pDataEnd = data + size;
+
+	BaseHeader baseHeader;
+	if ( !Read(pData, pDataEnd, baseHeader, false) )
+		return "Failed to read base header";
+
+	if ( baseHeader.flag != 0x4 )
+		return std::format("ERROR: File has unsupported type flag: {}", baseHeader.flag);
+
+	if ( !Read(pData, pDataEnd, compHeader) )
+		return "Failed to read compressed data header";
+
+	if ( compHeader.dataHeaderSize != sizeof(TCOHeader) )
+		return "File dataHeaderSize did not match TCOHeader size";
+
+	if ( !Read(pData, pDataEnd, tcoHeader) )
+		return "Failed to read TCO header";
+
+	uint32 layoutId = uint32(tcoHeader.layout);
+	if ( layoutId == gOptions.bc6hLayoutId )
+		tcoHeader.layout = TCOLayout::BC6H;
+	else if ( layoutId == gOptions.bc7LayoutId )
+		tcoHeader.layout = TCOLayout::BC7;
+	else if ( layoutId == uint32(TCOLayout::BC6H) || layoutId == uint32(TCOLayout::BC7) )
+		tcoHeader.layout = TCOLayout::Unassigned;
+
+	return {};
+}
+
+std::string PrescanFile(const std::filesystem::path& path, TCOFileInfo& info) {
+	info.path = path;
+
+	std::string buf;
+	std::string readErr;
+	IOStatus status = ReadWithRetry(path, buf, readErr, TCOPayloadOffset + 1, &info.fileSize);
+	if ( status == IOStatus::NotFound )
+		return "Failed to read headers: file not found";
+	if ( status != IOStatus::Ok )
+		return std::format("Failed to read headers: {}", readErr);
+
+	std::string err = ParseTCOHeaders(buf.data(), buf.size(), info.compHeader, info.tcoHeader);
+	if ( !err.empty() )
+		return err;
+
+	if ( TCOPayloadOffset + info.compHeader.compressedSize > info.fileSize )
+		return "Compressed size exceeds the file size";
+
+	return {};
+}
+
+std::vector<TCOFileInfo> PrescanFiles(const std::vector<std::filesystem::path>& vecPaths) {
+	std::vector<TCOFileInfo> vecInfos(vecPaths.size());
+	std::vector<uint8> vecValid(vecPaths.size(), 0);
+
+	ParallelFor(vecPaths.size(), [&](uint64 i) {
+		std::string err = PrescanFile(vecPaths[i], vecInfos[i]);
+		if ( !err.empty() )
+			LogError(vecPaths[i].filename().string(), err);
+		else
+			vecValid[i] = 1;
+	});
+
+	std::vector<TCOFileInfo> vecRes;
+	vecRes.reserve(vecInfos.size());
+	for ( uint64 i = 0; i < vecInfos.size(); ++i ) {
+		if ( vecValid[i] )
+			vecRes.emplace_back(std::move(vecInfos[i]));
+	}
+	return vecRes;
+}
+
+std::vector<std::filesystem::path> CollectTCOFiles(const std::filesystem::path& dir) {
+	std::vector<std::filesystem::path> vecFiles;
+	for ( const auto& file : std::filesystem::directory_iterator(dir) ) {
+		if ( file.is_regular_file() && file.path().filename().string().ends_with(".tco") )
+			vecFiles.emplace_back(file.path());
+	}
+	return vecFiles;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Common.h"
+
+enum class TCOLayout : int {
+	BC1, BC2, BC3, BC4, BC5,
+	_Not_Used_,
+	R11G11B10, RGBA8, RG16,
+	R16, R32, R32G8, R24G8,
+	R8,
+	// Not seen in 0.7.3.776 caches yet. The ids are assumed, --bc6h-layout= / --bc7-layout= move them.
+	BC6H, BC7,
+	// A raw BC6H or BC7 id while that format was moved to another id, decoded as nothing
+	Unassigned = -1
+};
+CHECKSZ(TCOLayout, 0x4);
+
+inline const char* ToString(TCOLayout layout) {
+	switch(layout) {
+		case TCOLayout::BC1:
+			return "BC1";
+		case TCOLayout::BC2:
+			return "BC2";
+		case TCOLayout::BC3:
+			return "BC3";
+		case TCOLayout::BC4:
+			return "BC4";
+		case TCOLayout::BC5:
+			return "BC5";
+		case TCOLayout::_Not_Used_:
+			return "NOT USED";
+		case TCOLayout::R11G11B10:
+			return "R11G11B10";
+		case TCOLayout::RGBA8:
+			return "RGBA8";
+		case TCOLayout::RG16:
+			return "RG16";
+		case TCOLayout::R16:
+			return "R16";
+		case TCOLayout::R32:
+			return "R32";
+		case TCOLayout::R32G8:
+			return "R32G8";
+		case TCOLayout::R24G8:
+			return "R24G8";
+		case TCOLayout::R8:
+			return "R8";
+		case TCOLayout::BC6H:
+			return "BC6H";
+		case TCOLayout::BC7:
+			return "BC7";
+		case TCOLayout::Unassigned:
+			return "UNASSIGNED";
+		default:
+			return "ERROR";
+	}
+}
+
+struct BaseHeader {
+	uint32 flag;
+};
+
+struct CompressedDataHeader : BaseHeader {
+	char _unk[0x8];
+	uint32 dataHeaderSize;
+	uint32 compressedSize;
+	uint32 decompressedSize;
+};
+CHECKSZ(CompressedDataHeader, 0x18);
+
+struct TCOHeader : BaseHeader {
+	uint32 width;
+	uint32 height;
+	TCOLayout layout;
+	uint32 numMips;
+	bool flipV;
+	char _pad[0x3];
+};
+CHECKSZ(TCOHeader, 0x18);
+
+// The LZ4 payload directly follows both headers
+constexpr uint64 TCOPayloadOffset = sizeof(CompressedDataHeader) + sizeof(TCOHeader);
+
+// Bytes taken by the first `numLevels` mips at the start of a decompressed payload.
+// 0 for layouts whose per-pixel size is not known for certain.
+uint64 GetMipChainSize(const TCOHeader& header, uint32 numLevels);
+
+// Buckets of decompressed payload size, used to group entries of similar cost
+uint32 GetSizeClass(uint64 decompressedSize);
+const char* GetSizeClassName(uint32 sizeClass);
+
+// Header fields of one cache entry, gathered without touching the payload
+struct TCOFileInfo {
+	std::filesystem::path path;
+	uint64 fileSize = 0;
+	CompressedDataHeader compHeader = {};
+	TCOHeader tcoHeader = {};
+	// Whole file contents if the entry lives in a mapped pack, nullptr for loose files
+	const char* pData = nullptr;
+};
+
+// Validates and copies out the headers of a TCO file held in memory.
+// Returns an error message, or an empty string on success.
+std::string ParseTCOHeaders(const char* data, uint64 size, CompressedDataHeader& compHeader, TCOHeader& tcoHeader);
+
+// Reads only the headers of a single file
+std::string PrescanFile(const std::filesystem::path& path, TCOFileInfo& info);
+
+// Prescans all files in parallel. Files that fail are logged and left out of the result.
+std::vector<TCOFileInfo> PrescanFiles(const std::vector<std::filesystem::path>& vecPaths);
+
+// All .tco files directly inside `dir`
+std::vector<std::filesystem::path> CollectTCOFiles(const std::filesystem::path& dir);
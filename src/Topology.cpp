@@ -0,0 +1,93 @@
+#include "Topology.h"
+
+#include <algorithm>
+#include <memory>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+
+const char* ToString(CoreType type) {
+	switch(type) {
+		case CoreType::Performance:
+			return "P-core";
+		case CoreType::Efficiency:
+			return "E-core";
+		default:
+			return "ERROR";
+	}
+}
+
+// Calls `fn` for every entry of the given relationship
+template<typename Fn>
+static void ForEachProcessorInfo(LOGICAL_PROCESSOR_RELATIONSHIP relation, Fn fn) {
+	DWORD size = 0;
+	GetLogicalProcessorInformationEx(relation, nullptr, &size);
+	if ( size == 0 )
+		return;
+
+	std::unique_ptr<uint8[]> pBuffer(new uint8[size]);
+	if ( !GetLogicalProcessorInformationEx(relation, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)pBuffer.get(), &size) )
+		return;
+
+	for ( DWORD offset = 0; offset < size; ) {
+		const auto* pInfo = (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)(pBuffer.get() + offset);
+		fn(*pInfo);
+		offset += pInfo->Size;
+	}
+}
+
+static CpuTopology QueryTopology() {
+	struct Core {
+		GROUP_AFFINITY mask;
+		uint8 efficiencyClass;
+		uint32 l2Size;
+	};
+	std::vector<Core> vecCores;
+
+	ForEachProcessorInfo(RelationProcessorCore, [&](const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX& info) {
+		vecCores.push_back({info.Processor.GroupMask[0], info.Processor.EfficiencyClass, 0});
+	});
+
+	ForEachProcessorInfo(RelationCache, [&](const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX& info) {
+		if ( info.Cache.Level != 2 )
+			return;
+		for ( Core& core : vecCores ) {
+			if ( core.mask.Group == info.Cache.GroupMask.Group && (core.mask.Mask & info.Cache.GroupMask.Mask) != 0 )
+				core.l2Size = info.Cache.CacheSize;
+		}
+	});
+
+	uint8 maxClass = 0;
+	for ( const Core& core : vecCores )
+		maxClass = std::max(maxClass, core.efficiencyClass);
+
+	CpuTopology topology;
+	for ( const Core& core : vecCores ) {
+		// Intel hybrid parts report two classes, anything below the top one is treated as an E-core
+		CoreType type = core.efficiencyClass == maxClass ? CoreType::Performance : CoreType::Efficiency;
+		for ( uint8 bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit ) {
+			if ( (core.mask.Mask >> bit) & 1 ) {
+				topology.vecProcessors.push_back({core.mask.Group, bit, type, core.l2Size});
+				++(type == CoreType::Performance ? topology.numPerformance : topology.numEfficiency);
+			}
+		}
+	}
+
+	std::stable_sort(topology.vecProcessors.begin(), topology.vecProcessors.end(), [](const LogicalProcessor& a, const LogicalProcessor& b) {
+		return a.type < b.type;
+	});
+	return topology;
+}
+
+const CpuTopology& GetCpuTopology() {
+	static const CpuTopology topology = QueryTopology();
+	return topology;
+}
+
+bool PinCurrentThread(const LogicalProcessor& proc) {
+	GROUP_AFFINITY affinity = {};
+	affinity.Mask = KAFFINITY(1) << proc.number;
+	affinity.Group = proc.group;
+	return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+#include "Common.h"
+
+enum class CoreType : int {
+	Performance, Efficiency
+};
+
+const char* ToString(CoreType type);
+
+struct LogicalProcessor {
+	uint16 group;
+	uint8 number;
+	CoreType type;
+	// Size of the L2 cache of its core in bytes, 0 if unknown
+	uint32 l2Size;
+};
+
+// Logical processors grouped by core type, performance cores first.
+// On CPUs with a single core type, every processor counts as a performance core.
+struct CpuTopology {
+	std::vector<LogicalProcessor> vecProcessors;
+	uint32 numPerformance = 0;
+	uint32 numEfficiency = 0;
+
+	bool IsHybrid() const { return numPerformance != 0 && numEfficiency != 0; }
+};
+
+// Queried once from GetLogicalProcessorInformationEx(), where a higher efficiency class means a faster core
+const CpuTopology& GetCpuTopology();
+
+// Restricts the calling thread to one logical processor
+bool PinCurrentThread(const LogicalProcessor& proc);